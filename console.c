@@ -1,9 +1,11 @@
 /* Implementation of simple command-line interface */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -65,6 +67,9 @@ static bool has_infile = false;
 static cmd_func_t quit_helpers[MAXQUIT];
 static int quit_helper_cnt = 0;
 
+static idle_func_t idle_helper = NULL;
+static cmd_func_t pre_cmd_helper = NULL;
+
 static void init_in();
 
 static bool push_file(char *fname);
@@ -211,6 +216,8 @@ static bool interpret_cmda(int argc, char *argv[])
     while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
         next_cmd = next_cmd->next;
     if (next_cmd) {
+        if (pre_cmd_helper)
+            pre_cmd_helper(argc, argv);
         ok = next_cmd->operation(argc, argv);
         if (!ok)
             record_error();
@@ -248,6 +255,18 @@ void add_quit_helper(cmd_func_t qf)
         report_event(MSG_FATAL, "Exceeded limit on quit helpers");
 }
 
+/* Set function doing background work while the console is idle */
+void set_idle_helper(idle_func_t f)
+{
+    idle_helper = f;
+}
+
+/* Set function to be executed before each command */
+void set_pre_cmd_helper(cmd_func_t f)
+{
+    pre_cmd_helper = f;
+}
+
 /* Turn echoing on/off */
 void set_echo(bool on)
 {
@@ -305,6 +324,23 @@ bool get_int(char *vname, int *loc)
     return true;
 }
 
+/* Extract a non-negative count from text and store at loc */
+bool get_size(char *vname, size_t *loc)
+{
+    char *end = NULL;
+    while (isspace((unsigned char) *vname))
+        vname++;
+    if (*vname == '-')
+        return false;
+    errno = 0;
+    unsigned long long v = strtoull(vname, &end, 0);
+    if (errno || end == vname || *end != '\0' || v > SIZE_MAX)
+        return false;
+
+    *loc = (size_t) v;
+    return true;
+}
+
 static bool do_option(int argc, char *argv[])
 {
     if (argc == 1) {
@@ -405,6 +441,30 @@ static bool do_time(int argc, char *argv[])
 static bool use_linenoise = true;
 static int web_fd;
 
+/* Called by linenoise before reading each key. Keeps running background work
+ * in slices until the user or the web server has something for us.
+ */
+static int console_eventmux(char *buf, size_t buflen)
+{
+    while (idle_helper) {
+        fd_set readset;
+        FD_ZERO(&readset);
+        FD_SET(STDIN_FILENO, &readset);
+        int max_fd = STDIN_FILENO;
+        if (web_fd > 0) {
+            FD_SET(web_fd, &readset);
+            max_fd = max_fd > web_fd ? max_fd : web_fd;
+        }
+        struct timeval poll = {0, 0};
+        if (select(max_fd + 1, &readset, NULL, NULL, &poll) != 0)
+            break;
+        if (!idle_helper())
+            break;
+    }
+
+    return web_fd > 0 ? web_eventmux(buf, buflen) : 0;
+}
+
 static bool do_web(int argc, char *argv[])
 {
     int port = 9999;
@@ -416,7 +476,6 @@ static bool do_web(int argc, char *argv[])
     web_fd = web_open(port);
     if (web_fd > 0) {
         printf("listen on port %d, fd is %d\n", port, web_fd);
-        line_set_eventmux_callback(web_eventmux);
         use_linenoise = false;
     } else {
         perror("ERROR");
@@ -452,6 +511,7 @@ void init_cmd()
     init_in();
     init_time(&last_time);
     first_time = last_time;
+    line_set_eventmux_callback(console_eventmux);
 }
 
 /* Create new buffer for named file.
@@ -603,6 +663,9 @@ static int cmd_select(int nfds,
             if (cmdline)
                 interpret_cmd(cmdline);
         }
+        /* Give background work a slice between two commands */
+        if (idle_helper)
+            idle_helper();
     }
     return 0;
 }
@@ -668,6 +731,8 @@ bool run_console(char *infile_name)
         char *cmdline;
         while (use_linenoise && (cmdline = linenoise(prompt))) {
             interpret_cmd(cmdline);
+            if (idle_helper)
+                idle_helper();
             line_history_add(cmdline);       /* Add to the history. */
             line_history_save(HISTORY_FILE); /* Save the history on disk. */
             line_free(cmdline);
@@ -2,6 +2,7 @@
 #define LAB0_CONSOLE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <sys/select.h>
 
 #include "linenoise.h"
@@ -53,9 +54,25 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter);
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
+/* Extract a count, which may exceed the range of int, from text */
+bool get_size(char *vname, size_t *loc);
+
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Function doing a bounded amount of background work whenever the console is
+ * idle. Returns true as long as work remains.
+ */
+typedef bool (*idle_func_t)(void);
+
+/* Set function to run between commands and while waiting for input */
+void set_idle_helper(idle_func_t f);
+
+/* Set function to run before each command with its arguments, e.g. to finish
+ * background work the command depends on
+ */
+void set_pre_cmd_helper(cmd_func_t f);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
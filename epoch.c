@@ -0,0 +1,87 @@
+#include <sched.h>
+#include <string.h>
+
+#include "epoch.h"
+
+/* Nodes pending before ep_retire() tries to free some */
+#define EP_BATCH 64
+
+/* Initialize a domain without readers or retired nodes */
+void ep_init(ep_domain_t *d)
+{
+    memset(d, 0, sizeof(ep_domain_t));
+}
+
+/* Reserve a free slot for a reader */
+int ep_register(ep_domain_t *d)
+{
+    for (int i = 0; i < EP_MAX_READERS; i++) {
+        int free_slot = 0;
+        if (__atomic_compare_exchange_n(&d->slot[i].taken, &free_slot, 1,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_RELAXED))
+            return i;
+    }
+    return -1;
+}
+
+/* Release the slot of a reader */
+void ep_unregister(ep_domain_t *d, int slot)
+{
+    __atomic_store_n(&d->slot[slot].state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&d->slot[slot].taken, 0, __ATOMIC_RELEASE);
+}
+
+/* File node under the current epoch */
+void ep_retire(ep_domain_t *d,
+               struct ep_node *node,
+               void (*fn)(struct ep_node *node))
+{
+    struct ep_node **limbo = &d->limbo[d->epoch % 3];
+    node->fn = fn;
+    node->next = *limbo;
+    *limbo = node;
+    if (++d->pending >= EP_BATCH)
+        ep_reclaim(d);
+}
+
+/* Advance the epoch if every reader in a traversal has seen it. The nodes
+ * retired two epochs before the new one are then out of reach, and their
+ * list is reused for the new epoch.
+ */
+bool ep_reclaim(ep_domain_t *d)
+{
+    // Nodes unlinked so far must be out of reach before the readers are read
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long e = d->epoch;
+    for (int i = 0; i < EP_MAX_READERS; i++) {
+        unsigned long s = __atomic_load_n(&d->slot[i].state, __ATOMIC_ACQUIRE);
+        if ((s & 1) && s >> 1 != e)
+            return false;
+    }
+    __atomic_store_n(&d->epoch, e + 1, __ATOMIC_RELEASE);
+
+    struct ep_node **limbo = &d->limbo[(e + 1) % 3];
+    struct ep_node *node = *limbo;
+    *limbo = NULL;
+    while (node) {
+        struct ep_node *next = node->next;
+        node->fn(node);
+        d->pending--;
+        node = next;
+    }
+    return true;
+}
+
+/* Advance the epoch three times, waiting for the readers in between, which
+ * empties every list of retired nodes in turn
+ */
+void ep_barrier(ep_domain_t *d)
+{
+    for (int advanced = 0; advanced < 3;) {
+        if (ep_reclaim(d))
+            advanced++;
+        else
+            sched_yield();
+    }
+}
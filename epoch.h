@@ -0,0 +1,157 @@
+#ifndef LAB0_EPOCH_H
+#define LAB0_EPOCH_H
+
+/* This program implements epoch-based reclamation, which lets threads read a
+ * linked structure without any lock while one writer changes it.
+ *
+ * Readers bracket every traversal with ep_enter() and ep_exit(), which only
+ * write to a slot of their own. The writer unlinks nodes as usual, but hands
+ * them to ep_retire() rather than freeing them, which files them under the
+ * current epoch of the domain. The epoch only moves on once every reader in
+ * the middle of a traversal has started it in the current epoch, so once the
+ * epoch has moved on twice since a node was retired, no reader can still hold
+ * a pointer to it, and the writer frees it. Neither side ever waits for the
+ * other: readers never block the writer, they only delay frees.
+ *
+ * Only the writer retires and frees nodes, so that the lists of retired nodes
+ * need no lock of their own.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+#define EP_MAX_READERS 64
+#define EP_CACHE_LINE 64
+
+/**
+ * struct ep_node - Link of a retired node, embedded in its structure
+ * @next: next node retired in the same epoch
+ * @fn: function freeing the structure, usually through container_of()
+ */
+struct ep_node {
+    struct ep_node *next;
+    void (*fn)(struct ep_node *node);
+};
+
+/**
+ * ep_slot_t - State of a reader
+ * @state: 0 outside of any traversal, otherwise twice the epoch the current
+ *         traversal started in plus 1
+ * @taken: whether a reader registered the slot
+ */
+typedef struct {
+    unsigned long state;
+    int taken;
+    char pad[EP_CACHE_LINE - sizeof(unsigned long) - sizeof(int)];
+} ep_slot_t;
+
+/**
+ * ep_domain_t - Readers and retired nodes of a structure
+ * @epoch: current epoch, only advanced by the writer
+ * @slot: state of each reader, on cache lines of their own
+ * @limbo: nodes retired in each of the last three epochs, by epoch modulo 3
+ * @pending: number of nodes in @limbo
+ */
+typedef struct {
+    unsigned long epoch;
+    char pad[EP_CACHE_LINE - sizeof(unsigned long)];
+    ep_slot_t slot[EP_MAX_READERS];
+    struct ep_node *limbo[3];
+    size_t pending;
+} ep_domain_t;
+
+/**
+ * ep_init() - Initialize a domain without readers or retired nodes
+ * @d: domain
+ */
+void ep_init(ep_domain_t *d);
+
+/**
+ * ep_register() - Reserve a slot for a reader
+ * @d: domain
+ *
+ * Return: the slot, -1 if all EP_MAX_READERS slots are taken
+ */
+int ep_register(ep_domain_t *d);
+
+/**
+ * ep_unregister() - Release the slot of a reader outside of any traversal
+ * @d: domain
+ * @slot: slot returned by ep_register()
+ */
+void ep_unregister(ep_domain_t *d, int slot);
+
+/**
+ * ep_enter() - Start a traversal
+ * @d: domain
+ * @slot: slot of the reader
+ *
+ * Nodes reachable from now on stay allocated until ep_exit().
+ */
+static inline void ep_enter(ep_domain_t *d, int slot)
+{
+    unsigned long e = __atomic_load_n(&d->epoch, __ATOMIC_RELAXED);
+    // Announced before any pointer of the structure is read, as a full
+    // barrier; it also releases what earlier traversals read to the writer
+    __atomic_exchange_n(&d->slot[slot].state, 2 * e + 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * ep_exit() - End a traversal
+ * @d: domain
+ * @slot: slot of the reader
+ */
+static inline void ep_exit(ep_domain_t *d, int slot)
+{
+    __atomic_store_n(&d->slot[slot].state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * ep_list_next() - Follow the next link of a list node during a traversal
+ * @node: list node
+ *
+ * Pairs with the release stores publishing new nodes, so that a reader sees
+ * every field of a node once it sees the node.
+ *
+ * Return: the next node
+ */
+static inline struct list_head *ep_list_next(const struct list_head *node)
+{
+    return __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * ep_retire() - Hand a node over to be freed once no reader can reach it
+ * @d: domain
+ * @node: link embedded in the node, which must be unlinked already
+ * @fn: function freeing the node
+ *
+ * Calls ep_reclaim() once enough nodes are pending. Writer only.
+ */
+void ep_retire(ep_domain_t *d,
+               struct ep_node *node,
+               void (*fn)(struct ep_node *node));
+
+/**
+ * ep_reclaim() - Advance the epoch if every reader allows it, and free the
+ * nodes which no reader can reach anymore
+ * @d: domain
+ *
+ * Never waits. Writer only.
+ *
+ * Return: true if the epoch advanced
+ */
+bool ep_reclaim(ep_domain_t *d);
+
+/**
+ * ep_barrier() - Wait until no reader can reach any retired node, then free
+ * them all
+ * @d: domain
+ *
+ * Writer only, typically before tearing the structure down.
+ */
+void ep_barrier(ep_domain_t *d);
+
+#endif /* LAB0_EPOCH_H */
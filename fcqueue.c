@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fcqueue.h"
+#include "queue.h"
+
+#define FC_BLOCK_LEN 16
+#define FC_MIN_BYTES 256
+
+/* Bytes a varint of a size_t takes at most */
+#define VARINT_MAX ((sizeof(size_t) * 8 + 6) / 7)
+
+/**
+ * struct fc_block - Block of front-coded strings
+ * @list: node of the list of blocks of the queue
+ * @count: the number of strings in the block
+ * @len: bytes of @data in use
+ * @cap: size of @data
+ * @data: the strings, each coded as the varint length of the prefix shared
+ *        with the string before it, 0 for the first one, the varint length of
+ *        the rest, then the bytes of the rest
+ */
+struct fc_block {
+    struct list_head list;
+    size_t count;
+    size_t len;
+    size_t cap;
+    unsigned char data[];
+};
+
+static size_t put_varint(unsigned char *p, size_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static size_t get_varint(const unsigned char *p, size_t *v)
+{
+    size_t n = 0;
+    unsigned int shift = 0;
+    *v = 0;
+    do {
+        *v |= (size_t) (p[n] & 0x7f) << shift;
+        shift += 7;
+    } while (p[n++] & 0x80);
+    return n;
+}
+
+static struct fc_block *block_new(fcqueue_t *q, size_t cap)
+{
+    struct fc_block *b = malloc(sizeof(struct fc_block) + cap);
+    if (!b)
+        return NULL;
+    b->count = 0;
+    b->len = 0;
+    b->cap = cap;
+    q->bytes += sizeof(struct fc_block) + cap;
+    return b;
+}
+
+static void block_free(fcqueue_t *q, struct fc_block *b)
+{
+    q->bytes -= sizeof(struct fc_block) + b->cap;
+    free(b);
+}
+
+/* Move block b into a new one of cap bytes, which takes its place in the list
+ * of blocks. Return NULL, leaving b as it was, if allocation failed.
+ */
+static struct fc_block *block_resize(fcqueue_t *q,
+                                     struct fc_block *b,
+                                     size_t cap)
+{
+    struct fc_block *nb = block_new(q, cap);
+    if (!nb)
+        return NULL;
+    nb->count = b->count;
+    nb->len = b->len;
+    memcpy(nb->data, b->data, b->len);
+    nb->list.prev = b->list.prev;
+    nb->list.next = b->list.next;
+    nb->list.prev->next = &nb->list;
+    nb->list.next->prev = &nb->list;
+    block_free(q, b);
+    return nb;
+}
+
+/* Create an empty queue */
+fcqueue_t *fcq_new(size_t block_len)
+{
+    fcqueue_t *q = malloc(sizeof(fcqueue_t));
+    if (!q)
+        return NULL;
+    INIT_LIST_HEAD(&q->blocks);
+    q->size = 0;
+    q->block_len = block_len ? block_len : FC_BLOCK_LEN;
+    q->max_len = 0;
+    q->bytes = sizeof(fcqueue_t);
+    q->tail = NULL;
+    q->tail_cap = 0;
+    return q;
+}
+
+/* Free all storage used by queue */
+void fcq_free(fcqueue_t *q)
+{
+    if (!q)
+        return;
+    struct fc_block *b, *safe;
+    list_for_each_entry_safe(b, safe, &q->blocks, list)
+        free(b);
+    free(q->tail);
+    free(q);
+}
+
+/* Append a copy of s, coded against the string appended before it */
+bool fcq_insert_tail(fcqueue_t *q, const char *s)
+{
+    if (!q || !s)
+        return false;
+    size_t len = strlen(s);
+    if (len >= q->tail_cap) {
+        size_t cap = q->tail_cap ? 2 * q->tail_cap : 64;
+        while (cap <= len)
+            cap *= 2;
+        char *tail = malloc(cap);
+        if (!tail)
+            return false;
+        if (q->tail)
+            strcpy(tail, q->tail);
+        free(q->tail);
+        q->bytes += cap - q->tail_cap;
+        q->tail = tail;
+        q->tail_cap = cap;
+    }
+
+    struct fc_block *b = NULL;
+    if (!list_empty(&q->blocks))
+        b = list_last_entry(&q->blocks, struct fc_block, list);
+    size_t prefix = 0;
+    if (b && b->count < q->block_len) {
+        while (prefix < len && q->tail[prefix] == s[prefix])
+            prefix++;
+    }
+    size_t need = 2 * VARINT_MAX + len - prefix;
+
+    if (!b || b->count == q->block_len) {
+        // A full block will not grow anymore: give its spare bytes back
+        if (b && b->len < b->cap)
+            block_resize(q, b, b->len);
+        b = block_new(q, need > FC_MIN_BYTES ? need : FC_MIN_BYTES);
+        if (!b)
+            return false;
+        list_add_tail(&b->list, &q->blocks);
+    } else if (b->len + need > b->cap) {
+        size_t cap = 2 * b->cap;
+        while (b->len + need > cap)
+            cap *= 2;
+        b = block_resize(q, b, cap);
+        if (!b)
+            return false;
+    }
+
+    unsigned char *p = b->data + b->len;
+    p += put_varint(p, prefix);
+    p += put_varint(p, len - prefix);
+    memcpy(p, s + prefix, len - prefix);
+    b->len = p + len - prefix - b->data;
+    b->count++;
+    memcpy(q->tail + prefix, s + prefix, len - prefix + 1);
+    if (len > q->max_len)
+        q->max_len = len;
+    q->size++;
+    return true;
+}
+
+/* Remove the first string of the first block, recoding the second one in full
+ * in its place. The recoded string never takes more bytes than the two did.
+ */
+bool fcq_remove_head(fcqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || list_empty(&q->blocks))
+        return false;
+    struct fc_block *b = list_first_entry(&q->blocks, struct fc_block, list);
+
+    size_t pre1, len1, pre2, len2;
+    size_t off1 = get_varint(b->data, &pre1);
+    off1 += get_varint(b->data + off1, &len1);
+    if (sp && bufsize) {
+        size_t n = len1 < bufsize - 1 ? len1 : bufsize - 1;
+        memcpy(sp, b->data + off1, n);
+        sp[n] = '\0';
+    }
+    q->size--;
+    if (b->count == 1) {
+        list_del(&b->list);
+        block_free(q, b);
+        return true;
+    }
+
+    size_t off2 = off1 + len1;
+    off2 += get_varint(b->data + off2, &pre2);
+    off2 += get_varint(b->data + off2, &len2);
+    size_t end = off2 + len2;
+
+    unsigned char hdr[2 * VARINT_MAX];
+    size_t h = put_varint(hdr, 0);
+    h += put_varint(hdr + h, pre2 + len2);
+    // The shared prefix and the rest of the second string both move to where
+    // they belong, in the order which keeps either from being overwritten
+    if (h <= off1) {
+        memmove(b->data + h, b->data + off1, pre2);
+        memmove(b->data + h + pre2, b->data + off2, len2);
+    } else {
+        memmove(b->data + h + pre2, b->data + off2, len2);
+        memmove(b->data + h, b->data + off1, pre2);
+    }
+    memcpy(b->data, hdr, h);
+    size_t first = h + pre2 + len2;
+    memmove(b->data + first, b->data + end, b->len - end);
+    b->len -= end - first;
+    b->count--;
+    return true;
+}
+
+/* Sort queue and move its strings into a new front-coded queue */
+fcqueue_t *fcq_from_sorted(struct list_head *head,
+                           bool descend,
+                           size_t block_len)
+{
+    if (!head)
+        return NULL;
+    q_sort(head, descend);
+    fcqueue_t *q = fcq_new(block_len);
+    if (!q)
+        return NULL;
+
+    element_t *e;
+    list_for_each_entry(e, head, list) {
+        if (!fcq_insert_tail(q, e->value)) {
+            fcq_free(q);
+            return NULL;
+        }
+    }
+    // The last block is complete too
+    if (!list_empty(&q->blocks)) {
+        struct fc_block *b =
+            list_last_entry(&q->blocks, struct fc_block, list);
+        if (b->len < b->cap)
+            block_resize(q, b, b->len);
+    }
+
+    while (!list_empty(head))
+        q_release_element(q_remove_head(head, NULL, 0));
+    return q;
+}
+
+/* Start decoding queue from its head */
+bool fcq_iter_init(fcq_iter_t *it, const fcqueue_t *q)
+{
+    it->head = &q->blocks;
+    it->node = &q->blocks;
+    it->pos = 0;
+    it->left = 0;
+    it->buf = malloc(q->max_len + 1);
+    return it->buf;
+}
+
+/* Rebuild the next string on top of the one decoded before it */
+const char *fcq_iter_next(fcq_iter_t *it)
+{
+    const struct fc_block *b;
+    while (!it->left) {
+        if (it->node->next == it->head)
+            return NULL;
+        it->node = it->node->next;
+        b = list_entry(it->node, struct fc_block, list);
+        it->pos = 0;
+        it->left = b->count;
+    }
+    b = list_entry(it->node, struct fc_block, list);
+
+    size_t pre, len;
+    const unsigned char *p = b->data + it->pos;
+    p += get_varint(p, &pre);
+    p += get_varint(p, &len);
+    memcpy(it->buf + pre, p, len);
+    it->buf[pre + len] = '\0';
+    it->pos = p + len - b->data;
+    it->left--;
+    return it->buf;
+}
+
+/* Release the storage of a cursor */
+void fcq_iter_end(fcq_iter_t *it)
+{
+    free(it->buf);
+    it->buf = NULL;
+}
@@ -0,0 +1,134 @@
+#ifndef LAB0_FCQUEUE_H
+#define LAB0_FCQUEUE_H
+
+/* This program implements a queue of strings compressed by front coding.
+ *
+ * The strings are stored back to back in blocks of up to @block_len strings.
+ * The first string of a block is stored in full, and every other one as the
+ * length of the prefix it shares with the string before it followed by the
+ * rest of its bytes, both lengths being varints. Sorted strings, and keys of
+ * a hierarchy in particular, share long prefixes with their neighbours, so
+ * most of their bytes go away, along with the links and value pointer of an
+ * element_t and the allocations of both. The price is that strings can only be
+ * read in order, each one being rebuilt from the one before it, and that
+ * blocks restart in full so that no walk ever goes back further than the
+ * start of its block. The queue is meant to be built once from a sorted
+ * queue, read many times and emptied from the head.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+/**
+ * fcqueue_t - Queue of front-coded strings
+ * @blocks: list of the blocks, the head of the queue being in the first one
+ * @size: the number of strings in the queue
+ * @block_len: the number of strings a block holds at most
+ * @max_len: length of the longest string appended so far
+ * @bytes: bytes allocated for the queue and its blocks
+ * @tail: copy of the last string appended, which the next one is coded
+ *        against
+ * @tail_cap: size of @tail
+ */
+typedef struct {
+    struct list_head blocks;
+    size_t size;
+    size_t block_len;
+    size_t max_len;
+    size_t bytes;
+    char *tail;
+    size_t tail_cap;
+} fcqueue_t;
+
+/**
+ * fcq_iter_t - Cursor decoding the strings of a queue in order
+ * @head: list of the blocks of the queue
+ * @node: list node of the block of the next string
+ * @pos: offset of the next string in its block
+ * @left: strings of the block not decoded yet
+ * @buf: the string decoded last, rebuilt in place by the next one
+ */
+typedef struct {
+    const struct list_head *head;
+    const struct list_head *node;
+    size_t pos;
+    size_t left;
+    char *buf;
+} fcq_iter_t;
+
+/**
+ * fcq_new() - Create an empty queue
+ * @block_len: the number of strings a block holds at most, 16 if 0
+ *
+ * Return: NULL if could not allocate space
+ */
+fcqueue_t *fcq_new(size_t block_len);
+
+/**
+ * fcq_free() - Free all storage used by a queue
+ * @q: queue
+ */
+void fcq_free(fcqueue_t *q);
+
+/**
+ * fcq_insert_tail() - Append a copy of a string to a queue
+ * @q: queue
+ * @s: string
+ *
+ * Return: true for success, false if allocation failed or @q is NULL
+ */
+bool fcq_insert_tail(fcqueue_t *q, const char *s);
+
+/**
+ * fcq_remove_head() - Remove the string at the head of a queue
+ * @q: queue
+ * @sp: buffer the string is copied to, NULL if not needed
+ * @bufsize: size of @sp, the string being truncated to @bufsize - 1 bytes
+ *
+ * The next string takes the place of the head at the start of its block, so
+ * that it becomes a full string; no allocation happens.
+ *
+ * Return: true for success, false if @q is NULL or empty
+ */
+bool fcq_remove_head(fcqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * fcq_from_sorted() - Sort a queue and move its strings into a new
+ * front-coded queue
+ * @head: header of the queue, sorted with q_sort() and left empty
+ * @descend: whether to sort in descending order
+ * @block_len: the number of strings a block holds at most, 16 if 0
+ *
+ * Return: the new queue, NULL if allocation failed, in which case @head holds
+ * every element it had, sorted
+ */
+fcqueue_t *fcq_from_sorted(struct list_head *head,
+                           bool descend,
+                           size_t block_len);
+
+/**
+ * fcq_iter_init() - Start decoding a queue from its head
+ * @it: cursor
+ * @q: queue, which must not change until fcq_iter_end()
+ *
+ * Return: true for success, false if allocation failed
+ */
+bool fcq_iter_init(fcq_iter_t *it, const fcqueue_t *q);
+
+/**
+ * fcq_iter_next() - Decode the next string of a queue
+ * @it: cursor
+ *
+ * Return: the string, valid until the next call, NULL past the tail
+ */
+const char *fcq_iter_next(fcq_iter_t *it);
+
+/**
+ * fcq_iter_end() - Release the storage of a cursor
+ * @it: cursor
+ */
+void fcq_iter_end(fcq_iter_t *it);
+
+#endif /* LAB0_FCQUEUE_H */
@@ -0,0 +1,211 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filemerge.h"
+#include "losertree.h"
+#include "queue.h"
+
+#define FM_IO_BUF (1 << 20)
+#define FM_MIN_LINE 128
+
+/**
+ * fm_src_t - Sorted file being merged
+ * @map: mapping of the whole file, NULL if it is read through @f
+ * @map_len: size of @map
+ * @pos: offset in @map of the next line
+ * @f: stream of a file which cannot be mapped, NULL if mapped or empty
+ * @buf: last line read from @f, with room for a null byte
+ * @buf_cap: size of @buf
+ * @line: current line, not null-terminated, NULL once the file is exhausted
+ * @len: length of @line
+ */
+typedef struct {
+    char *map;
+    size_t map_len;
+    size_t pos;
+    FILE *f;
+    char *buf;
+    size_t buf_cap;
+    const char *line;
+    size_t len;
+} fm_src_t;
+
+typedef struct {
+    fm_src_t *src;
+    bool descend;
+} fm_merge_t;
+
+/* Make sure a buffer can hold need bytes, keeping its contents */
+static bool fm_reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+        return true;
+    size_t new_cap = *cap * 2 > need ? *cap * 2 : need;
+    char *p = malloc(new_cap);
+    if (!p)
+        return false;
+    if (*buf)
+        memcpy(p, *buf, *cap);
+    free(*buf);
+    *buf = p;
+    *cap = new_cap;
+    return true;
+}
+
+/* Map a file, or open it for buffered reads if it cannot be mapped */
+static bool fm_open(fm_src_t *s, const char *path)
+{
+    memset(s, 0, sizeof(fm_src_t));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        if (!st.st_size) {
+            close(fd);
+            return true;
+        }
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            s->map = p;
+            s->map_len = st.st_size;
+            close(fd);
+            return true;
+        }
+    }
+
+    if (!fm_reserve(&s->buf, &s->buf_cap, FM_MIN_LINE) ||
+        !(s->f = fdopen(fd, "r"))) {
+        close(fd);
+        return false;
+    }
+    setvbuf(s->f, NULL, _IOFBF, FM_IO_BUF);
+    return true;
+}
+
+static void fm_close(fm_src_t *s)
+{
+    if (s->map)
+        munmap(s->map, s->map_len);
+    if (s->f)
+        fclose(s->f);
+    free(s->buf);
+}
+
+/* Move on to the next line of a file. Return false on read errors. */
+static bool fm_next(fm_src_t *s)
+{
+    s->line = NULL;
+    if (s->map) {
+        if (s->pos >= s->map_len)
+            return true;
+        const char *p = s->map + s->pos;
+        const char *nl = memchr(p, '\n', s->map_len - s->pos);
+        s->line = p;
+        s->len = nl ? (size_t) (nl - p) : s->map_len - s->pos;
+        s->pos += s->len + 1;
+        return true;
+    }
+    if (!s->f)
+        return true;
+
+    size_t len = 0;
+    int c;
+    while ((c = getc_unlocked(s->f)) != EOF && c != '\n') {
+        if (!fm_reserve(&s->buf, &s->buf_cap, len + 2))
+            return false;
+        s->buf[len++] = c;
+    }
+    if (c == EOF && !len)
+        return !ferror(s->f);
+    s->buf[len] = '\0';
+    s->line = s->buf;
+    s->len = len;
+    return true;
+}
+
+/* Compare the current lines of two files like strcmp(), exhausted files
+ * coming last
+ */
+static int fm_cmp(void *ctx, int a, int b)
+{
+    const fm_merge_t *m = ctx;
+    const fm_src_t *sa = &m->src[a], *sb = &m->src[b];
+    if (!sa->line || !sb->line)
+        return !sa->line - !sb->line;
+    size_t len = sa->len < sb->len ? sa->len : sb->len;
+    int cmp = memcmp(sa->line, sb->line, len);
+    if (!cmp)
+        cmp = (sa->len > sb->len) - (sa->len < sb->len);
+    return m->descend ? -cmp : cmp;
+}
+
+/* Merge sorted files of strings into a queue or a stream */
+bool fm_merge(const char *const paths[],
+              int n,
+              bool descend,
+              struct list_head *head,
+              FILE *out,
+              size_t *cnt)
+{
+    *cnt = 0;
+    if (n < 1)
+        return true;
+    if (!out && !head)
+        return false;
+    fm_src_t *src = malloc(sizeof(fm_src_t) * n);
+    if (!src)
+        return false;
+
+    bool ok = true;
+    int opened = 0;
+    while (ok && opened < n) {
+        ok = fm_open(&src[opened], paths[opened]);
+        opened++;
+        ok = ok && fm_next(&src[opened - 1]);
+    }
+
+    fm_merge_t m = {src, descend};
+    loser_tree_t lt;
+    ok = ok && lt_init(&lt, n, fm_cmp, &m);
+    if (ok) {
+        // Mapped lines are not null-terminated, so they get copied here
+        char *str = NULL;
+        size_t str_cap = 0;
+        while (ok) {
+            fm_src_t *s = &src[lt_winner(&lt)];
+            if (!s->line)
+                break;
+            if (out) {
+                ok = fwrite(s->line, 1, s->len, out) == s->len &&
+                     putc('\n', out) != EOF;
+            } else if (s->map) {
+                ok = fm_reserve(&str, &str_cap, s->len + 1);
+                if (ok) {
+                    memcpy(str, s->line, s->len);
+                    str[s->len] = '\0';
+                    ok = q_insert_tail(head, str);
+                }
+            } else {
+                ok = q_insert_tail(head, s->buf);
+            }
+            if (ok)
+                (*cnt)++;
+            ok = ok && fm_next(s);
+            lt_replay(&lt);
+        }
+        free(str);
+        lt_free(&lt);
+    }
+
+    for (int i = 0; i < opened; i++)
+        fm_close(&src[i]);
+    free(src);
+    return ok;
+}
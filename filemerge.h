@@ -0,0 +1,42 @@
+#ifndef LAB0_FILEMERGE_H
+#define LAB0_FILEMERGE_H
+
+/* This program merges sorted files of strings in a single pass.
+ *
+ * Each file holds one string per line. Files are mapped into memory and read
+ * sequentially; a file that cannot be mapped, such as a pipe, is read through
+ * a large stdio buffer instead. A loser tree picks the next line, which goes
+ * straight to the tail of a queue or to an output stream, so no intermediate
+ * queue is ever built.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "list.h"
+
+/**
+ * fm_merge() - Merge sorted files of strings
+ * @paths: names of the files, each sorted in ascending/descending order
+ * @n: number of files
+ * @descend: whether the files are sorted in descending order
+ * @head: queue whose tail receives the strings, used when @out is NULL
+ * @out: stream receiving the strings one per line, NULL to fill @head
+ * @cnt: set to the number of strings merged
+ *
+ * Equal strings come out in the order of @paths, and in file order within a
+ * file. A final line without a newline counts as a line. The output is only
+ * sorted if every file is.
+ *
+ * Return: true for success, false if a file could not be opened or read, a
+ * string could not be inserted or @out could not be written
+ */
+bool fm_merge(const char *const paths[],
+              int n,
+              bool descend,
+              struct list_head *head,
+              FILE *out,
+              size_t *cnt);
+
+#endif /* LAB0_FILEMERGE_H */
@@ -1,5 +1,6 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdint.h>
@@ -41,24 +42,50 @@ typedef struct __block_element {
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Allocated blocks are spread over shards by address, each with a list, a
+ * count and a lock of its own, so that threads allocate and free at the same
+ * time without contending on a single lock. A block belongs to the shard of
+ * its address, so any thread can free it, and cautious mode only has to look
+ * for it among the blocks of one shard.
+ */
+#define HARNESS_SHARDS 16
+
+typedef struct {
+    pthread_mutex_t lock;
+    block_element_t *allocated;
+    size_t allocated_count;
+} shard_t;
+
+static shard_t shards[HARNESS_SHARDS] = {
+    [0 ... HARNESS_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Read by every thread allocating, hence accessed atomically */
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
 static bool error_occurred = false;
 static char *error_message = "";
 
-static int time_limit = 1;
+int time_limit = 1;
 
-/* Data for managing exceptions */
+/* Data for managing exceptions, which only the thread setting them up can
+ * take
+ */
 static jmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
+static pthread_t jmp_thread;
 static bool time_limited = false;
 
+/* Whether the thread is in the middle of an allocation or a free, with a shard
+ * locked or the allocator of the C library halfway through a call, and the
+ * exception which arrived meanwhile, taken on the way out instead
+ */
+static __thread volatile sig_atomic_t in_harness;
+static __thread char *volatile deferred;
+
 /* For test_malloc and test_calloc */
 typedef enum {
     TEST_MALLOC,
@@ -67,6 +94,33 @@ typedef enum {
 
 /* Internal functions */
 
+static void flag_error()
+{
+    __atomic_store_n(&error_occurred, true, __ATOMIC_RELAXED);
+}
+
+static void enter_harness()
+{
+    in_harness = true;
+}
+
+static void leave_harness()
+{
+    in_harness = false;
+    if (deferred) {
+        char *msg = deferred;
+        deferred = NULL;
+        trigger_exception(msg);
+    }
+}
+
+/* Shard of the block at address b */
+static shard_t *shard_of(const block_element_t *b)
+{
+    uintptr_t a = (uintptr_t) b >> 4;
+    return &shards[(a ^ (a >> 7) ^ (a >> 14)) % HARNESS_SHARDS];
+}
+
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
@@ -75,20 +129,21 @@ static bool fail_allocation()
 }
 
 /* Find header of block, given its payload.
- * Signal error if doesn't seem like legitimate block
+ * Signal error if doesn't seem like legitimate block.
+ * The lock of the shard of the block must be held.
  */
 static block_element_t *find_header(void *p)
 {
     if (!p) {
         report_event(MSG_ERROR, "Attempting to free null block");
-        error_occurred = true;
+        flag_error();
     }
 
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
-    if (cautious_mode) {
+    if (__atomic_load_n(&cautious_mode, __ATOMIC_RELAXED)) {
         /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
+        block_element_t *ab = shard_of(b)->allocated;
         bool found = false;
         while (ab && !found) {
             found = ab == b;
@@ -98,7 +153,7 @@ static block_element_t *find_header(void *p)
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
-            error_occurred = true;
+            flag_error();
         }
     }
 
@@ -107,7 +162,7 @@ static block_element_t *find_header(void *p)
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
             p);
-        error_occurred = true;
+        flag_error();
     }
 
     return b;
@@ -124,7 +179,7 @@ static size_t *find_footer(block_element_t *b)
 
 static void *alloc(alloc_t alloc_type, size_t size)
 {
-    if (noallocate_mode) {
+    if (__atomic_load_n(&noallocate_mode, __ATOMIC_RELAXED)) {
         char *msg_alloc_forbidden[] = {
             "Calls to malloc are disallowed",
             "Calls to calloc are disallowed",
@@ -133,12 +188,14 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
+    enter_harness();
     if (fail_allocation()) {
         char *msg_alloc_failure[] = {
             "Malloc returning NULL",
             "Calloc returning NULL",
         };
         report_event(MSG_WARN, "%s", msg_alloc_failure[alloc_type]);
+        leave_harness();
         return NULL;
     }
 
@@ -146,7 +203,7 @@ static void *alloc(alloc_t alloc_type, size_t size)
         malloc(size + sizeof(block_element_t) + sizeof(size_t));
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
-        error_occurred = true;
+        flag_error();
     }
 
     // cppcheck-suppress nullPointerRedundantCheck
@@ -156,15 +213,27 @@ static void *alloc(alloc_t alloc_type, size_t size)
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, !alloc_type * FILLCHAR, size);
+
+    shard_t *sh = shard_of(new_block);
+    pthread_mutex_lock(&sh->lock);
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
+    new_block->next = sh->allocated;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->prev = NULL;
 
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    if (sh->allocated)
+        sh->allocated->prev = new_block;
+    sh->allocated = new_block;
+    sh->allocated_count++;
+    pthread_mutex_unlock(&sh->lock);
+
+    // The caller would lose the block to the exception, so it goes back, the
+    // free taking the exception on its way out
+    if (deferred) {
+        test_free(p);
+        return NULL;
+    }
+    leave_harness();
 
     return p;
 }
@@ -189,7 +258,7 @@ void *test_calloc(size_t nelem, size_t elsize)
 
 void test_free(void *p)
 {
-    if (noallocate_mode) {
+    if (__atomic_load_n(&noallocate_mode, __ATOMIC_RELAXED)) {
         report_event(MSG_FATAL, "Calls to free disallowed");
         return;
     }
@@ -197,6 +266,10 @@ void test_free(void *p)
     if (!p)
         return;
 
+    shard_t *sh =
+        shard_of((block_element_t *) ((size_t) p - sizeof(block_element_t)));
+    enter_harness();
+    pthread_mutex_lock(&sh->lock);
     block_element_t *b = find_header(p);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
@@ -204,7 +277,7 @@ void test_free(void *p)
                      "Corruption detected in block with address %p when "
                      "attempting to free it",
                      p);
-        error_occurred = true;
+        flag_error();
     }
     b->magic_header = MAGICFREE;
     *find_footer(b) = MAGICFREE;
@@ -216,12 +289,14 @@ void test_free(void *p)
     if (bp)
         bp->next = bn;
     else
-        allocated = bn;
+        sh->allocated = bn;
     if (bn)
         bn->prev = bp;
+    sh->allocated_count--;
+    pthread_mutex_unlock(&sh->lock);
 
     free(b);
-    allocated_count--;
+    leave_harness();
 }
 
 // cppcheck-suppress unusedFunction
@@ -235,9 +310,16 @@ char *test_strdup(const char *s)
     return memcpy(new, s, len);
 }
 
+/* Count the blocks allocated by every thread */
 size_t allocation_check()
 {
-    return allocated_count;
+    size_t cnt = 0;
+    for (int i = 0; i < HARNESS_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        cnt += shards[i].allocated_count;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return cnt;
 }
 
 /* Implementation of functions for testing */
@@ -247,7 +329,7 @@ size_t allocation_check()
  */
 void set_cautious_mode(bool cautious)
 {
-    cautious_mode = cautious;
+    __atomic_store_n(&cautious_mode, cautious, __ATOMIC_RELAXED);
 }
 
 /* Set/unset restricted allocation mode.
@@ -255,15 +337,13 @@ void set_cautious_mode(bool cautious)
  */
 void set_noallocate_mode(bool noallocate)
 {
-    noallocate_mode = noallocate;
+    __atomic_store_n(&noallocate_mode, noallocate, __ATOMIC_RELAXED);
 }
 
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    return __atomic_exchange_n(&error_occurred, false, __ATOMIC_RELAXED);
 }
 
 /* Prepare for a risky operation using setjmp.
@@ -286,6 +366,7 @@ bool exception_setup(bool limit_time)
     }
 
     /* Got here from initial call */
+    jmp_thread = pthread_self();
     jmp_ready = true;
     if (limit_time) {
         alarm(time_limit);
@@ -306,13 +387,22 @@ void exception_cancel()
     error_message = "";
 }
 
-/* Use longjmp to return to most recent exception setup */
+/* Use longjmp to return to most recent exception setup. Other threads than
+ * the one which set it up can only flag the error.
+ */
 void trigger_exception(char *msg)
 {
-    error_occurred = true;
-    error_message = msg;
-    if (jmp_ready)
-        siglongjmp(env, 1);
-    else
+    flag_error();
+    if (!jmp_ready)
         exit(1);
+    if (!pthread_equal(pthread_self(), jmp_thread)) {
+        report_event(MSG_ERROR, "%s", msg);
+        return;
+    }
+    if (in_harness) {
+        deferred = msg;
+        return;
+    }
+    error_message = msg;
+    siglongjmp(env, 1);
 }
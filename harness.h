@@ -24,6 +24,9 @@ size_t allocation_check();
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Seconds a time-limited operation may take, 0 for no limit */
+extern int time_limit;
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -0,0 +1,19 @@
+#ifndef LAB0_HASH_H
+#define LAB0_HASH_H
+
+#include <stdint.h>
+
+/* FNV-1a hash of a string, shared by the hash index and the filter of queues,
+ * the routing of sharded queues and the checksums of qtest
+ */
+static inline uint64_t hash_string(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+#endif /* LAB0_HASH_H */
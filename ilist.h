@@ -0,0 +1,193 @@
+/* Circular doubly-linked list over an array, linked by 32-bit indices */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * struct ilist_head - Node of a circular doubly-linked list held in an array
+ * @prev: Index of the previous node in the same array.
+ * @next: Index of the next node in the same array.
+ *
+ * Mirrors struct list_head, except that the nodes of a list all live in one
+ * array, the arena, and refer to each other by position instead of by
+ * address. A node costs 8 bytes instead of 16 on 64-bit builds, and stays
+ * valid when the arena is moved to grow it. The head of a list is an entry
+ * of the arena as well; every function and macro below takes the arena as
+ * its first argument and node indices after that.
+ */
+struct ilist_head {
+    uint32_t prev;
+    uint32_t next;
+};
+
+/**
+ * INIT_ILIST_HEAD() - Initialize an empty list
+ * @l: arena
+ * @head: index of the head of the list
+ */
+static inline void INIT_ILIST_HEAD(struct ilist_head *l, uint32_t head)
+{
+    l[head].next = head;
+    l[head].prev = head;
+}
+
+/**
+ * ilist_add() - Add a node at the beginning of a list
+ * @l: arena
+ * @node: index of the new node
+ * @head: index of the head of the list
+ */
+static inline void ilist_add(struct ilist_head *l, uint32_t node, uint32_t head)
+{
+    uint32_t next = l[head].next;
+
+    l[next].prev = node;
+    l[node].next = next;
+    l[node].prev = head;
+    l[head].next = node;
+}
+
+/**
+ * ilist_add_tail() - Add a node at the end of a list
+ * @l: arena
+ * @node: index of the new node
+ * @head: index of the head of the list
+ */
+static inline void ilist_add_tail(struct ilist_head *l,
+                                  uint32_t node,
+                                  uint32_t head)
+{
+    uint32_t prev = l[head].prev;
+
+    l[prev].next = node;
+    l[node].next = head;
+    l[node].prev = prev;
+    l[head].prev = node;
+}
+
+/**
+ * ilist_del() - Remove a node from its list
+ * @l: arena
+ * @node: index of the node
+ *
+ * The links of @node are left as they were.
+ */
+static inline void ilist_del(struct ilist_head *l, uint32_t node)
+{
+    uint32_t next = l[node].next;
+    uint32_t prev = l[node].prev;
+
+    l[next].prev = prev;
+    l[prev].next = next;
+}
+
+/**
+ * ilist_empty() - Check if a list is empty
+ * @l: arena
+ * @head: index of the head of the list
+ *
+ * Return: 0 - list is not empty, !0 - list is empty
+ */
+static inline int ilist_empty(const struct ilist_head *l, uint32_t head)
+{
+    return l[head].next == head;
+}
+
+/**
+ * ilist_is_singular() - Check if a list has exactly one node
+ * @l: arena
+ * @head: index of the head of the list
+ *
+ * Return: 0 - list is not singular, !0 - list has exactly one entry
+ */
+static inline int ilist_is_singular(const struct ilist_head *l, uint32_t head)
+{
+    return !ilist_empty(l, head) && l[head].prev == l[head].next;
+}
+
+/**
+ * ilist_move() - Move a node to the beginning of a list
+ * @l: arena
+ * @node: index of the node
+ * @head: index of the head of the list
+ */
+static inline void ilist_move(struct ilist_head *l,
+                              uint32_t node,
+                              uint32_t head)
+{
+    ilist_del(l, node);
+    ilist_add(l, node, head);
+}
+
+/**
+ * ilist_move_tail() - Move a node to the end of a list
+ * @l: arena
+ * @node: index of the node
+ * @head: index of the head of the list
+ */
+static inline void ilist_move_tail(struct ilist_head *l,
+                                   uint32_t node,
+                                   uint32_t head)
+{
+    ilist_del(l, node);
+    ilist_add_tail(l, node, head);
+}
+
+/**
+ * ilist_first() - Get the first node of a list
+ * @l: arena
+ * @head: index of the head of the list
+ *
+ * Return: index of the first node, @head if the list is empty
+ */
+#define ilist_first(l, head) ((l)[head].next)
+
+/**
+ * ilist_last() - Get the last node of a list
+ * @l: arena
+ * @head: index of the head of the list
+ *
+ * Return: index of the last node, @head if the list is empty
+ */
+#define ilist_last(l, head) ((l)[head].prev)
+
+/**
+ * ilist_for_each - Iterate over list nodes
+ * @l: arena
+ * @node: uint32_t used as iterator
+ * @head: index of the head of the list
+ *
+ * The nodes and the head of the list must be kept unmodified while iterating
+ * through it.
+ */
+#define ilist_for_each(l, node, head) \
+    for (node = (l)[head].next; node != (head); node = (l)[node].next)
+
+/**
+ * ilist_for_each_reverse - Iterate over list nodes backwards
+ * @l: arena
+ * @node: uint32_t used as iterator
+ * @head: index of the head of the list
+ */
+#define ilist_for_each_reverse(l, node, head) \
+    for (node = (l)[head].prev; node != (head); node = (l)[node].prev)
+
+/**
+ * ilist_for_each_safe - Iterate over list nodes, allowing removal
+ * @l: arena
+ * @node: uint32_t used as iterator
+ * @safe: uint32_t storing the next node
+ * @head: index of the head of the list
+ */
+#define ilist_for_each_safe(l, node, safe, head)                       \
+    for (node = (l)[head].next, safe = (l)[node].next; node != (head); \
+         node = safe, safe = (l)[node].next)
+
+#ifdef __cplusplus
+}
+#endif
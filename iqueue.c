@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "iqueue.h"
+
+#define IQ_MIN_SLOTS 64
+#define IQ_MIN_POOL 1024
+
+/* Move the node arrays into new ones of cap slots */
+static bool grow_slots(iqueue_t *q, uint32_t cap)
+{
+    struct ilist_head *link = malloc(sizeof(struct ilist_head) * cap);
+    uint32_t *off = malloc(sizeof(uint32_t) * cap);
+    if (!link || !off) {
+        free(link);
+        free(off);
+        return false;
+    }
+    memcpy(link, q->link, sizeof(struct ilist_head) * q->used);
+    memcpy(off, q->off, sizeof(uint32_t) * q->used);
+    free(q->link);
+    free(q->off);
+    q->link = link;
+    q->off = off;
+    q->cap = cap;
+    return true;
+}
+
+/* Hand out an unused slot, 0 for allocation failed */
+static uint32_t alloc_slot(iqueue_t *q)
+{
+    if (q->free_slot) {
+        uint32_t node = q->free_slot;
+        q->free_slot = q->link[node].next;
+        return node;
+    }
+    if (q->used == q->cap) {
+        if (q->cap == UINT32_MAX)
+            return 0;
+        uint32_t cap = q->cap > UINT32_MAX / 2 ? UINT32_MAX : q->cap * 2;
+        if (!grow_slots(q, cap))
+            return 0;
+    }
+    return q->used++;
+}
+
+/* Copy the live strings into a new pool, in list order, with room for len
+ * more bytes. Space of removed strings is reclaimed on the way.
+ */
+static bool repack_pool(iqueue_t *q, uint32_t len)
+{
+    uint64_t need = (uint64_t) q->pool_len - q->pool_dead + len;
+    if (need > UINT32_MAX)
+        return false;
+    uint64_t cap = need * 2 < IQ_MIN_POOL ? IQ_MIN_POOL : need * 2;
+    if (cap > UINT32_MAX)
+        cap = UINT32_MAX;
+
+    char *pool = malloc(cap);
+    if (!pool)
+        return false;
+    uint32_t pool_len = 0, node;
+    ilist_for_each(q->link, node, IQ_HEAD) {
+        const char *s = iq_value(q, node);
+        size_t n = strlen(s) + 1;
+        memcpy(pool + pool_len, s, n);
+        q->off[node] = pool_len;
+        pool_len += n;
+    }
+    free(q->pool);
+    q->pool = pool;
+    q->pool_len = pool_len;
+    q->pool_cap = cap;
+    q->pool_dead = 0;
+    return true;
+}
+
+/* Allocate a node holding a copy of s, which is not linked yet */
+static uint32_t new_node(iqueue_t *q, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    if (len > UINT32_MAX)
+        return 0;
+    if (q->pool_len + len > q->pool_cap && !repack_pool(q, len))
+        return 0;
+    uint32_t node = alloc_slot(q);
+    if (!node)
+        return 0;
+    memcpy(q->pool + q->pool_len, s, len);
+    q->off[node] = q->pool_len;
+    q->pool_len += len;
+    q->size++;
+    return node;
+}
+
+/* Unlink a node and give its slot and string back */
+static void del_node(iqueue_t *q, uint32_t node, char *sp, size_t bufsize)
+{
+    const char *s = iq_value(q, node);
+    size_t len = strlen(s) + 1;
+    if (sp && bufsize) {
+        size_t n = len < bufsize ? len : bufsize;
+        memcpy(sp, s, n - 1);
+        sp[n - 1] = '\0';
+    }
+    ilist_del(q->link, node);
+    q->link[node].next = q->free_slot;
+    q->free_slot = node;
+    q->pool_dead += len;
+    if (!--q->size) {
+        // Nothing is live anymore, so the whole pool can be reused
+        q->pool_len = 0;
+        q->pool_dead = 0;
+    }
+}
+
+/* Create an empty queue */
+iqueue_t *iq_new(void)
+{
+    iqueue_t *q = malloc(sizeof(iqueue_t));
+    if (!q)
+        return NULL;
+    memset(q, 0, sizeof(iqueue_t));
+    if (!grow_slots(q, IQ_MIN_SLOTS)) {
+        free(q);
+        return NULL;
+    }
+    q->used = 1;
+    INIT_ILIST_HEAD(q->link, IQ_HEAD);
+    return q;
+}
+
+/* Free all storage used by queue */
+void iq_free(iqueue_t *q)
+{
+    if (!q)
+        return;
+    free(q->link);
+    free(q->off);
+    free(q->pool);
+    free(q);
+}
+
+/* Insert an element at head of queue */
+bool iq_insert_head(iqueue_t *q, const char *s)
+{
+    if (!q)
+        return false;
+    uint32_t node = new_node(q, s);
+    if (!node)
+        return false;
+    ilist_add(q->link, node, IQ_HEAD);
+    return true;
+}
+
+/* Insert an element at tail of queue */
+bool iq_insert_tail(iqueue_t *q, const char *s)
+{
+    if (!q)
+        return false;
+    uint32_t node = new_node(q, s);
+    if (!node)
+        return false;
+    ilist_add_tail(q->link, node, IQ_HEAD);
+    return true;
+}
+
+/* Remove an element from head of queue */
+bool iq_remove_head(iqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || !q->size)
+        return false;
+    del_node(q, ilist_first(q->link, IQ_HEAD), sp, bufsize);
+    return true;
+}
+
+/* Remove an element from tail of queue */
+bool iq_remove_tail(iqueue_t *q, char *sp, size_t bufsize)
+{
+    if (!q || !q->size)
+        return false;
+    del_node(q, ilist_last(q->link, IQ_HEAD), sp, bufsize);
+    return true;
+}
+
+/* Return number of elements in queue */
+uint32_t iq_size(const iqueue_t *q)
+{
+    return q ? q->size : 0;
+}
+
+/* Delete the middle node in queue */
+bool iq_delete_mid(iqueue_t *q)
+{
+    if (!q || !q->size)
+        return false;
+
+    // The size is known, so walk from whichever end is closer
+    uint32_t mid = q->size / 2, node = ilist_last(q->link, IQ_HEAD);
+    for (uint32_t i = q->size - 1; i > mid; i--)
+        node = q->link[node].prev;
+    del_node(q, node, NULL, 0);
+    return true;
+}
+
+/* Delete all nodes that have duplicate string next to them */
+bool iq_delete_dup(iqueue_t *q)
+{
+    if (!q || !q->size)
+        return false;
+
+    uint32_t a = ilist_first(q->link, IQ_HEAD);
+    while (a != IQ_HEAD) {
+        uint32_t b = q->link[a].next;
+        bool dup = false;
+        while (b != IQ_HEAD && !strcmp(iq_value(q, a), iq_value(q, b))) {
+            uint32_t next = q->link[b].next;
+            del_node(q, b, NULL, 0);
+            b = next;
+            dup = true;
+        }
+        if (dup)
+            del_node(q, a, NULL, 0);
+        a = b;
+    }
+    return true;
+}
+
+/* Swap every two adjacent nodes */
+void iq_swap(iqueue_t *q)
+{
+    if (!q)
+        return;
+
+    uint32_t a = ilist_first(q->link, IQ_HEAD);
+    while (a != IQ_HEAD && q->link[a].next != IQ_HEAD) {
+        uint32_t b = q->link[a].next;
+        ilist_del(q->link, a);
+        ilist_add(q->link, a, b);
+        a = q->link[a].next;
+    }
+}
+
+/* Reverse elements in queue */
+void iq_reverse(iqueue_t *q)
+{
+    if (!q)
+        return;
+
+    uint32_t node = IQ_HEAD;
+    do {
+        struct ilist_head *n = &q->link[node];
+        uint32_t next = n->next;
+        n->next = n->prev;
+        n->prev = next;
+        node = next;
+    } while (node != IQ_HEAD);
+}
+
+/* Reverse the nodes of the list k at a time */
+void iq_reverseK(iqueue_t *q, int k)
+{
+    if (!q || k < 2)
+        return;
+
+    uint32_t anchor = IQ_HEAD;
+    for (uint32_t left = q->size; left >= (uint32_t) k; left -= k) {
+        // Moving each node of the group after the anchor reverses the group
+        uint32_t first = q->link[anchor].next;
+        for (int i = 1; i < k; i++)
+            ilist_move(q->link, q->link[first].next, anchor);
+        anchor = first;
+    }
+}
+
+/* Merge two sorted chains linked through next and ended by 0. Ties go to a,
+ * which holds the earlier nodes, so the merge is stable.
+ */
+static uint32_t merge_chains(iqueue_t *q, uint32_t a, uint32_t b, bool descend)
+{
+    uint32_t res = 0, *tail = &res;
+    while (a && b) {
+        int cmp = strcmp(iq_value(q, a), iq_value(q, b));
+        if (descend ? cmp >= 0 : cmp <= 0) {
+            *tail = a;
+            tail = &q->link[a].next;
+            a = q->link[a].next;
+        } else {
+            *tail = b;
+            tail = &q->link[b].next;
+            b = q->link[b].next;
+        }
+    }
+    *tail = a ? a : b;
+    return res;
+}
+
+/* Sort elements of queue in ascending/descending order */
+void iq_sort(iqueue_t *q, bool descend)
+{
+    if (!q || q->size < 2)
+        return;
+
+    // bin[i] holds a sorted chain of 2^i nodes, or 0. Higher bins hold
+    // earlier nodes, like the digits of a binary counter.
+    uint32_t bin[32] = {0};
+    uint32_t node = ilist_first(q->link, IQ_HEAD);
+    while (node != IQ_HEAD) {
+        uint32_t carry = node;
+        node = q->link[node].next;
+        q->link[carry].next = 0;
+        int i;
+        for (i = 0; bin[i]; i++) {
+            carry = merge_chains(q, bin[i], carry, descend);
+            bin[i] = 0;
+        }
+        bin[i] = carry;
+    }
+    uint32_t res = 0;
+    for (int i = 0; i < 32; i++)
+        res = merge_chains(q, bin[i], res, descend);
+
+    // Restore the prev links and close the circle
+    uint32_t prev = IQ_HEAD;
+    q->link[IQ_HEAD].next = res;
+    for (node = res; node; node = q->link[node].next) {
+        q->link[node].prev = prev;
+        prev = node;
+    }
+    q->link[prev].next = IQ_HEAD;
+    q->link[IQ_HEAD].prev = prev;
+}
+
+/* Delete from right to left every node which is on the wrong side of the
+ * extreme value seen so far
+ */
+static uint32_t monotonic(iqueue_t *q, bool descend)
+{
+    if (!q || !q->size)
+        return 0;
+
+    uint32_t keep = ilist_last(q->link, IQ_HEAD);
+    uint32_t node = q->link[keep].prev;
+    while (node != IQ_HEAD) {
+        uint32_t prev = q->link[node].prev;
+        int cmp = strcmp(iq_value(q, node), iq_value(q, keep));
+        if (descend ? cmp < 0 : cmp > 0)
+            del_node(q, node, NULL, 0);
+        else
+            keep = node;
+        node = prev;
+    }
+    return q->size;
+}
+
+/* Remove every node which has a node with a strictly less value anywhere to
+ * the right side of it */
+uint32_t iq_ascend(iqueue_t *q)
+{
+    return monotonic(q, false);
+}
+
+/* Remove every node which has a node with a strictly greater value anywhere to
+ * the right side of it */
+uint32_t iq_descend(iqueue_t *q)
+{
+    return monotonic(q, true);
+}
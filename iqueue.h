@@ -0,0 +1,185 @@
+#ifndef LAB0_IQUEUE_H
+#define LAB0_IQUEUE_H
+
+/* This program implements a compact queue of strings held in an arena.
+ *
+ * Nodes are slots of one array linked by the 32-bit indices of ilist.h, and
+ * each node finds its string by a 32-bit offset into a shared string pool.
+ * Metadata is 12 bytes per node instead of the 24 bytes of the list_head and
+ * value pointer of element_t, so twice as many nodes share a cache line, at
+ * the price of a limit of 2^32 - 1 nodes and 4 GiB of strings per queue.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ilist.h"
+
+/**
+ * iqueue_t - Arena-backed queue of strings
+ * @link: arena of list nodes; node 0 is the head of the queue
+ * @off: offset in @pool of the string of each node
+ * @cap: number of slots in @link and @off
+ * @used: number of slots handed out so far, including the head
+ * @free_slot: first released slot, chained through @link[].next, 0 if none
+ * @size: the number of elements in the queue
+ * @pool: strings of the elements, each terminated by a null byte
+ * @pool_len: bytes of @pool in use, including those of removed strings
+ * @pool_cap: size of @pool
+ * @pool_dead: bytes of @pool left behind by removed strings
+ */
+typedef struct {
+    struct ilist_head *link;
+    uint32_t *off;
+    uint32_t cap;
+    uint32_t used;
+    uint32_t free_slot;
+    uint32_t size;
+    char *pool;
+    uint32_t pool_len;
+    uint32_t pool_cap;
+    uint32_t pool_dead;
+} iqueue_t;
+
+/* Index of the head of the queue in the arena */
+#define IQ_HEAD 0
+
+/**
+ * iq_value() - Get the string of a node
+ * @q: queue
+ * @node: index of the node
+ *
+ * The pointer stays valid until the next insertion into @q.
+ */
+static inline const char *iq_value(const iqueue_t *q, uint32_t node)
+{
+    return q->pool + q->off[node];
+}
+
+/**
+ * iq_new() - Create an empty queue
+ *
+ * Return: NULL for allocation failed
+ */
+iqueue_t *iq_new(void);
+
+/**
+ * iq_free() - Free all storage used by queue, no effect if @q is NULL
+ * @q: queue
+ */
+void iq_free(iqueue_t *q);
+
+/**
+ * iq_insert_head() - Insert a copy of a string at the head
+ * @q: queue
+ * @s: string would be inserted
+ *
+ * @s must not point into the pool of @q, since the pool may move.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool iq_insert_head(iqueue_t *q, const char *s);
+
+/**
+ * iq_insert_tail() - Insert a copy of a string at the tail
+ * @q: queue
+ * @s: string would be inserted
+ *
+ * @s must not point into the pool of @q, since the pool may move.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool iq_insert_tail(iqueue_t *q, const char *s);
+
+/**
+ * iq_remove_head() - Remove the element from the head
+ * @q: queue
+ * @sp: buffer receiving the removed string, may be NULL
+ * @bufsize: size of @sp
+ *
+ * Return: true for success, false if queue is NULL or empty
+ */
+bool iq_remove_head(iqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * iq_remove_tail() - Remove the element from the tail
+ * @q: queue
+ * @sp: buffer receiving the removed string, may be NULL
+ * @bufsize: size of @sp
+ *
+ * Return: true for success, false if queue is NULL or empty
+ */
+bool iq_remove_tail(iqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * iq_size() - Get the size of the queue in O(1)
+ * @q: queue
+ *
+ * Return: the number of elements in queue, zero if queue is NULL or empty
+ */
+uint32_t iq_size(const iqueue_t *q);
+
+/**
+ * iq_delete_mid() - Delete the middle node, like q_delete_mid()
+ * @q: queue
+ *
+ * Return: true for success, false if queue is NULL or empty
+ */
+bool iq_delete_mid(iqueue_t *q);
+
+/**
+ * iq_delete_dup() - Delete every run of two or more equal adjacent strings
+ * @q: queue, usually sorted beforehand
+ *
+ * Return: true for success, false if queue is NULL or empty
+ */
+bool iq_delete_dup(iqueue_t *q);
+
+/**
+ * iq_swap() - Swap every two adjacent nodes, like q_swap()
+ * @q: queue
+ */
+void iq_swap(iqueue_t *q);
+
+/**
+ * iq_reverse() - Reverse the order of the nodes, like q_reverse()
+ * @q: queue
+ */
+void iq_reverse(iqueue_t *q);
+
+/**
+ * iq_reverseK() - Reverse the nodes k at a time, like q_reverseK()
+ * @q: queue
+ * @k: group size
+ */
+void iq_reverseK(iqueue_t *q, int k);
+
+/**
+ * iq_sort() - Stable sort in ascending/descending order, like q_sort()
+ * @q: queue
+ * @descend: whether or not to sort in descending order
+ *
+ * Allocation free merge sort over the indices.
+ */
+void iq_sort(iqueue_t *q, bool descend);
+
+/**
+ * iq_ascend() - Delete every node which has a strictly less value anywhere
+ * to the right side of it
+ * @q: queue
+ *
+ * Return: the number of elements in queue after performing operation
+ */
+uint32_t iq_ascend(iqueue_t *q);
+
+/**
+ * iq_descend() - Delete every node which has a strictly greater value
+ * anywhere to the right side of it
+ * @q: queue
+ *
+ * Return: the number of elements in queue after performing operation
+ */
+uint32_t iq_descend(iqueue_t *q);
+
+#endif /* LAB0_IQUEUE_H */
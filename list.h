@@ -462,6 +462,296 @@ static inline void list_move_tail(struct list_head *node,
          ++(entry), ++(safe))
 #endif
 
+/**
+ * list_prefetch() - Hint that memory will be read soon
+ * @addr: address to fetch into the cache, need not be dereferenceable
+ *
+ * Expands to nothing useful on compilers without __builtin_prefetch.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define list_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define list_prefetch(addr) ((void) (addr))
+#endif
+
+/**
+ * list_for_each_prefetch - Iterate over list nodes, prefetching ahead
+ * @node: list_head pointer used as iterator
+ * @head: pointer to the head of the list
+ *
+ * Same as list_for_each(), but requests the node after the next one while the
+ * current node is being processed. Following the chain still costs one
+ * dependent load per node, so this mostly pays off when the loop body does
+ * enough work to hide the fetch.
+ */
+#define list_for_each_prefetch(node, head)                \
+    for (node = (head)->next;                             \
+         list_prefetch(node->next->next), node != (head); \
+         node = node->next)
+
+/**
+ * list_for_each_entry_prefetch - Iterate over entries, prefetching ahead
+ * @entry: pointer to the structure type, used as the loop iterator
+ * @head: pointer to the list_head structure representing the list head
+ * @member: name of the list_head member within the structure type of @entry
+ *
+ * Same as list_for_each_entry(), with the prefetching of
+ * list_for_each_prefetch().
+ */
+#if __LIST_HAVE_TYPEOF
+#define list_for_each_entry_prefetch(entry, head, member)          \
+    for (entry = list_entry((head)->next, typeof(*entry), member); \
+         list_prefetch(entry->member.next->next),                  \
+         &entry->member != (head);                                 \
+         entry = list_entry(entry->member.next, typeof(*entry), member))
+#else
+#define list_for_each_entry_prefetch(entry, head, member) \
+    for (entry = (void *) 1; sizeof(struct { int i : -1; }); ++(entry))
+#endif
+
+/**
+ * list_for_each_entry_safe_prefetch - Iterate over entries, allowing removal
+ * @entry: pointer to the structure type, used as the loop iterator
+ * @safe: pointer to the structure type, storing the next entry
+ * @head: pointer to the list_head structure representing the list head
+ * @member: name of the list_head member within the structure type of @entry
+ *
+ * Same as list_for_each_entry_safe(), with the prefetching of
+ * list_for_each_prefetch(). Since @safe is already loaded ahead, the node
+ * after it is the one requested.
+ */
+#if __LIST_HAVE_TYPEOF
+#define list_for_each_entry_safe_prefetch(entry, safe, head, member)   \
+    for (entry = list_entry((head)->next, typeof(*entry), member),     \
+        safe = list_entry(entry->member.next, typeof(*entry), member); \
+         list_prefetch(safe->member.next), &entry->member != (head);   \
+         entry = safe,                                                 \
+        safe = list_entry(safe->member.next, typeof(*entry), member))
+#else
+#define list_for_each_entry_safe_prefetch(entry, safe, head, member) \
+    for (entry = safe = (void *) 1; sizeof(struct { int i : -1; });  \
+         ++(entry), ++(safe))
+#endif
+
+/**
+ * list_next_cursor() - Pick the next unfinished cursor in round-robin order
+ * @cur: array of cursors, @cur[i] being the next node of segment i
+ * @end: array of end markers, segment i is done once @cur[i] equals @end[i]
+ * @n: number of segments
+ * @i: index of the cursor used last, -1 to start from the first one
+ *
+ * Helper of list_for_each_interleaved().
+ *
+ * Return: index of the next cursor to use, -1 if every segment is done
+ */
+static inline int list_next_cursor(struct list_head *cur[],
+                                   struct list_head *const end[],
+                                   int n,
+                                   int i)
+{
+    for (int k = 1; k <= n; k++) {
+        int j = (i + k) % n;
+        if (cur[j] != end[j])
+            return j;
+    }
+    return -1;
+}
+
+/**
+ * list_for_each_interleaved - Iterate over several list segments in turn
+ * @node: list_head pointer used as iterator
+ * @cur: array of cursors, @cur[i] is the first node of segment i
+ * @end: array of end markers, segment i stops before @end[i]
+ * @n: number of segments
+ * @i: int holding the index of the segment which @node belongs to
+ *
+ * Takes one node from every unfinished segment in a round, so the loads of up
+ * to @n independent chains are in flight at once instead of one. Nodes of a
+ * segment are visited in order, but segments are mixed. The cursors are
+ * advanced before the body runs, so @node may be removed. Finding where the
+ * segments start is left to the caller, e.g. from positions kept by a
+ * previous walk or from the pieces of a split list.
+ */
+#define list_for_each_interleaved(node, cur, end, n, i)         \
+    for (i = list_next_cursor(cur, end, n, -1);                 \
+         i >= 0 && (node = (cur)[i], (cur)[i] = node->next, 1); \
+         i = list_next_cursor(cur, end, n, i))
+
+/**
+ * struct hlist_head - Head of a singly-linked list of hash bucket entries
+ * @first: Pointer to the first node of the bucket, or NULL if it is empty.
+ *
+ * Hash tables hold an array of these heads. A head costs only one pointer,
+ * half the size of a list_head, at the price of not being able to reach the
+ * tail of the bucket in constant time.
+ */
+struct hlist_head {
+    struct hlist_node *first;
+};
+
+/**
+ * struct hlist_node - Node of a hash bucket list
+ * @next: Pointer to the next node in the bucket, or NULL for the last one.
+ * @pprev: Pointer to the @next member of the previous node, or to the @first
+ *         member of the head for the first node. NULL for an unhashed node.
+ *
+ * The indirect @pprev lets a node remove itself without knowing which bucket
+ * it belongs to.
+ */
+struct hlist_node {
+    struct hlist_node *next, **pprev;
+};
+
+/**
+ * INIT_HLIST_HEAD() - Initialize an empty hash bucket
+ * @head: Pointer to the hlist_head structure to initialize.
+ */
+static inline void INIT_HLIST_HEAD(struct hlist_head *head)
+{
+    head->first = NULL;
+}
+
+/**
+ * INIT_HLIST_NODE() - Initialize a hash bucket node as unhashed
+ * @node: Pointer to the hlist_node structure to initialize.
+ */
+static inline void INIT_HLIST_NODE(struct hlist_node *node)
+{
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+/**
+ * hlist_unhashed() - Check whether a node is not linked into any bucket
+ * @node: Pointer to the hlist_node structure to check.
+ *
+ * Returns: non-zero if @node is unhashed, 0 otherwise.
+ */
+static inline int hlist_unhashed(const struct hlist_node *node)
+{
+    return !node->pprev;
+}
+
+/**
+ * hlist_empty() - Check whether a hash bucket has no nodes
+ * @head: Pointer to the hlist_head structure to check.
+ *
+ * Returns: non-zero if the bucket is empty, 0 otherwise.
+ */
+static inline int hlist_empty(const struct hlist_head *head)
+{
+    return !head->first;
+}
+
+/**
+ * hlist_add_head() - Add a node at the beginning of a hash bucket
+ * @node: Pointer to the hlist_node structure to add.
+ * @head: Pointer to the hlist_head structure of the bucket.
+ */
+static inline void hlist_add_head(struct hlist_node *node,
+                                  struct hlist_head *head)
+{
+    struct hlist_node *first = head->first;
+
+    node->next = first;
+    if (first)
+        first->pprev = &node->next;
+    head->first = node;
+    node->pprev = &head->first;
+}
+
+/**
+ * hlist_del() - Remove a node from its hash bucket
+ * @node: Pointer to the hlist_node structure to remove.
+ *
+ * As with list_del(), @node is left in an undefined state afterwards.
+ */
+static inline void hlist_del(struct hlist_node *node)
+{
+    struct hlist_node *next = node->next;
+    struct hlist_node **pprev = node->pprev;
+
+    *pprev = next;
+    if (next)
+        next->pprev = pprev;
+}
+
+/**
+ * hlist_del_init() - Remove a node from its hash bucket and mark it unhashed
+ * @node: Pointer to the hlist_node structure to remove.
+ *
+ * Unlike hlist_del(), calling this on an unhashed node is a no-op.
+ */
+static inline void hlist_del_init(struct hlist_node *node)
+{
+    if (hlist_unhashed(node))
+        return;
+    hlist_del(node);
+    INIT_HLIST_NODE(node);
+}
+
+/**
+ * hlist_entry() - Get the entry for this hash bucket node
+ * @node: pointer to hash bucket node
+ * @type: type of the entry containing the node
+ * @member: name of the hlist_node member variable in struct @type
+ *
+ * Return: @type pointer of entry containing node
+ */
+#define hlist_entry(node, type, member) container_of(node, type, member)
+
+/**
+ * hlist_entry_safe() - Get the entry for a hash bucket node which may be NULL
+ * @node: pointer to hash bucket node, or NULL
+ * @type: type of the entry containing the node
+ * @member: name of the hlist_node member variable in struct @type
+ *
+ * Return: @type pointer of entry containing node, NULL if @node is NULL
+ */
+#define hlist_entry_safe(node, type, member) \
+    ((node) ? hlist_entry(node, type, member) : NULL)
+
+/**
+ * hlist_for_each_entry - Iterate over the entries of a hash bucket
+ * @entry: Pointer to the structure type, used as the loop iterator.
+ * @head: Pointer to the hlist_head structure of the bucket.
+ * @member: Name of the hlist_node member within the structure type of @entry.
+ *
+ * The bucket must be kept unmodified while iterating through it. @entry is
+ * NULL after the loop has run to completion.
+ */
+#if __LIST_HAVE_TYPEOF
+#define hlist_for_each_entry(entry, head, member)                          \
+    for (entry = hlist_entry_safe((head)->first, typeof(*entry), member); \
+         entry;                                                            \
+         entry = hlist_entry_safe(entry->member.next, typeof(*entry), member))
+#else
+#define hlist_for_each_entry(entry, head, member) \
+    for (entry = (void *) 1; sizeof(struct { int i : -1; }); ++(entry))
+#endif
+
+/**
+ * hlist_for_each_entry_safe - Iterate over a hash bucket, allowing removal
+ * @entry: Pointer to the structure type, used as the loop iterator.
+ * @safe: Pointer to a hlist_node structure, storing the next node for safe
+ *        iteration.
+ * @head: Pointer to the hlist_head structure of the bucket.
+ * @member: Name of the hlist_node member within the structure type of @entry.
+ *
+ * Removing @entry during the iteration is safe. Other modifications to the
+ * bucket may result in undefined behavior.
+ */
+#if __LIST_HAVE_TYPEOF
+#define hlist_for_each_entry_safe(entry, safe, head, member)               \
+    for (entry = hlist_entry_safe((head)->first, typeof(*entry), member); \
+         entry && ((safe = entry->member.next), 1);                        \
+         entry = hlist_entry_safe(safe, typeof(*entry), member))
+#else
+#define hlist_for_each_entry_safe(entry, safe, head, member)        \
+    for (entry = safe = (void *) 1; sizeof(struct { int i : -1; }); \
+         ++(entry), ++(safe))
+#endif
+
 #undef __LIST_HAVE_TYPEOF
 
 #ifdef __cplusplus
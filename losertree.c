@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "losertree.h"
+
+/* Whether source a beats source b, ties going to the lower index */
+static bool beats(const loser_tree_t *lt, int a, int b)
+{
+    int cmp = lt->cmp(lt->ctx, a, b);
+    return cmp < 0 || (!cmp && a < b);
+}
+
+/* Play the initial tournament */
+bool lt_init(loser_tree_t *lt, int k, lt_cmp_t cmp, void *ctx)
+{
+    lt->k = k;
+    lt->cmp = cmp;
+    lt->ctx = ctx;
+    lt->node = malloc(sizeof(int) * k);
+    // Winners of the matches, leaves at k..2k-1 standing for the sources
+    int *win = malloc(sizeof(int) * 2 * k);
+    if (!lt->node || !win) {
+        free(lt->node);
+        free(win);
+        lt->node = NULL;
+        return false;
+    }
+
+    for (int i = 0; i < k; i++)
+        win[k + i] = i;
+    for (int i = k - 1; i > 0; i--) {
+        int a = win[2 * i], b = win[2 * i + 1];
+        bool a_wins = beats(lt, a, b);
+        win[i] = a_wins ? a : b;
+        lt->node[i] = a_wins ? b : a;
+    }
+    lt->node[0] = k > 1 ? win[1] : 0;
+    free(win);
+    return true;
+}
+
+/* Free the storage used by a tree */
+void lt_free(loser_tree_t *lt)
+{
+    free(lt->node);
+    lt->node = NULL;
+}
+
+/* Replay the matches from the leaf of the last winner up to the root */
+int lt_replay(loser_tree_t *lt)
+{
+    int s = lt->node[0];
+    for (int i = (s + lt->k) / 2; i > 0; i /= 2) {
+        if (beats(lt, lt->node[i], s)) {
+            int tmp = lt->node[i];
+            lt->node[i] = s;
+            s = tmp;
+        }
+    }
+    lt->node[0] = s;
+    return s;
+}
@@ -0,0 +1,81 @@
+#ifndef LAB0_LOSERTREE_H
+#define LAB0_LOSERTREE_H
+
+/* This program implements a tournament tree of losers for k-way merging.
+ *
+ * The tree does not hold any item itself. It ranks k sources, numbered from 0
+ * to k - 1, through a callback comparing the current items of two sources.
+ * After the item of the winning source has been consumed and the source has
+ * moved on, lt_replay() finds the next winner with about log2(k) comparisons,
+ * all on the path from that source to the root, instead of the 2 log2(k) of a
+ * binary heap.
+ */
+
+#include <stdbool.h>
+
+/**
+ * lt_cmp_t - Compare the current items of two sources
+ * @ctx: context given to lt_init()
+ * @a: index of a source
+ * @b: index of another source
+ *
+ * An exhausted source must compare greater than any source which is not.
+ *
+ * Return: negative, zero or positive like strcmp()
+ */
+typedef int (*lt_cmp_t)(void *ctx, int a, int b);
+
+/**
+ * loser_tree_t - Tournament tree of losers
+ * @k: number of sources
+ * @node: @node[0] is the winner, @node[1..k-1] the loser of each match
+ * @cmp: comparison of the current items of two sources
+ * @ctx: context passed to @cmp
+ */
+typedef struct {
+    int k;
+    int *node;
+    lt_cmp_t cmp;
+    void *ctx;
+} loser_tree_t;
+
+/**
+ * lt_init() - Play the initial tournament between k sources
+ * @lt: tree to initialize
+ * @k: number of sources, at least one
+ * @cmp: comparison of the current items of two sources
+ * @ctx: context passed to @cmp
+ *
+ * Equal items are won by the source with the lower index, so merging runs
+ * numbered in their original order is stable.
+ *
+ * Return: true for success, false for allocation failed
+ */
+bool lt_init(loser_tree_t *lt, int k, lt_cmp_t cmp, void *ctx);
+
+/**
+ * lt_free() - Free the storage used by a tree
+ * @lt: tree initialized by lt_init()
+ */
+void lt_free(loser_tree_t *lt);
+
+/**
+ * lt_winner() - Get the source holding the smallest current item
+ * @lt: tree
+ *
+ * Return: index of the winning source
+ */
+static inline int lt_winner(const loser_tree_t *lt)
+{
+    return lt->node[0];
+}
+
+/**
+ * lt_replay() - Update the tree after the winning source has moved on
+ * @lt: tree
+ *
+ * Return: index of the new winning source
+ */
+int lt_replay(loser_tree_t *lt);
+
+#endif /* LAB0_LOSERTREE_H */
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pqueue.h"
+
+/* While an element sits in the heap, its list_head is reused as follows */
+#define child prev
+#define sibling next
+
+/* Link two heaps and return the root of the result */
+static struct list_head *meld(struct list_head *a, struct list_head *b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (strcmp(list_entry(b, element_t, list)->value,
+               list_entry(a, element_t, list)->value) < 0) {
+        struct list_head *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    // b becomes the first child of a
+    b->sibling = a->child;
+    a->child = b;
+    a->sibling = NULL;
+    return a;
+}
+
+/* Two-pass pairing of the children of a removed root: meld them in pairs from
+ * left to right, then fold the pairs from right to left. The pairs are stacked
+ * through their sibling links, so no recursion or allocation is needed.
+ */
+static struct list_head *merge_pairs(struct list_head *first)
+{
+    struct list_head *stack = NULL;
+    while (first) {
+        struct list_head *a = first, *b = first->sibling;
+        if (!b) {
+            a->sibling = stack;
+            stack = a;
+            break;
+        }
+        first = b->sibling;
+        a = meld(a, b);
+        a->sibling = stack;
+        stack = a;
+    }
+
+    struct list_head *root = NULL;
+    while (stack) {
+        struct list_head *next = stack->sibling;
+        stack->sibling = NULL;
+        root = meld(root, stack);
+        stack = next;
+    }
+    return root;
+}
+
+void pq_init(pqueue_t *pq)
+{
+    pq->root = NULL;
+    pq->size = 0;
+}
+
+void pq_free(pqueue_t *pq)
+{
+    struct list_head *node = pq->root;
+    while (node) {
+        if (node->child) {
+            // Hoist the first child in front of node, node adopts the rest
+            struct list_head *c = node->child;
+            node->child = c->sibling;
+            c->sibling = node;
+            node = c;
+        } else {
+            struct list_head *next = node->sibling;
+            q_release_element(list_entry(node, element_t, list));
+            node = next;
+        }
+    }
+    pq_init(pq);
+}
+
+void pq_push(pqueue_t *pq, element_t *e)
+{
+    e->list.child = NULL;
+    e->list.sibling = NULL;
+    INIT_HLIST_NODE(&e->hash);
+    pq->root = meld(pq->root, &e->list);
+    pq->size++;
+}
+
+bool pq_insert(pqueue_t *pq, const char *s)
+{
+    element_t *e = malloc(sizeof(element_t));
+    if (!e)
+        return false;
+    e->value = strdup(s);
+    if (!e->value) {
+        free(e);
+        return false;
+    }
+    pq_push(pq, e);
+    return true;
+}
+
+element_t *pq_peek(const pqueue_t *pq)
+{
+    return pq->root ? list_entry(pq->root, element_t, list) : NULL;
+}
+
+element_t *pq_pop(pqueue_t *pq)
+{
+    struct list_head *root = pq->root;
+    if (!root)
+        return NULL;
+
+    pq->root = merge_pairs(root->child);
+    pq->size--;
+    root->child = NULL;
+    root->sibling = NULL;
+    return list_entry(root, element_t, list);
+}
+
+void pq_meld(pqueue_t *dst, pqueue_t *src)
+{
+    dst->root = meld(dst->root, src->root);
+    dst->size += src->size;
+    pq_init(src);
+}
+
+void pq_meld_queue(pqueue_t *pq, struct list_head *head)
+{
+    element_t *e;
+    while ((e = q_remove_head(head, NULL, 0)))
+        pq_push(pq, e);
+}
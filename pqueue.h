@@ -0,0 +1,92 @@
+#ifndef LAB0_PQUEUE_H
+#define LAB0_PQUEUE_H
+
+/* This program implements a priority queue over queue elements.
+ *
+ * It uses a pairing heap whose links reuse the list_head embedded in each
+ * element_t: while an element sits in the heap, @list.prev points to its first
+ * child and @list.next to its next sibling. An element is therefore either in
+ * a queue or in a priority queue, never in both, and moving it between the two
+ * costs no allocation.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/**
+ * pqueue_t - Priority queue of strings, smallest string first
+ * @root: list_head of the root element, NULL if the priority queue is empty
+ * @size: the number of elements in the priority queue
+ */
+typedef struct {
+    struct list_head *root;
+    size_t size;
+} pqueue_t;
+
+/**
+ * pq_init() - Initialize an empty priority queue
+ * @pq: priority queue
+ */
+void pq_init(pqueue_t *pq);
+
+/**
+ * pq_free() - Free all elements held by the priority queue
+ * @pq: priority queue
+ */
+void pq_free(pqueue_t *pq);
+
+/**
+ * pq_insert() - Insert a copy of a string in O(1)
+ * @pq: priority queue
+ * @s: string would be inserted
+ *
+ * Return: true for success, false for allocation failed
+ */
+bool pq_insert(pqueue_t *pq, const char *s);
+
+/**
+ * pq_push() - Insert an existing element in O(1)
+ * @pq: priority queue
+ * @e: element which is not linked into any queue
+ */
+void pq_push(pqueue_t *pq, element_t *e);
+
+/**
+ * pq_peek() - Get the element holding the smallest string
+ * @pq: priority queue
+ *
+ * Return: the smallest element, %NULL if the priority queue is empty
+ */
+element_t *pq_peek(const pqueue_t *pq);
+
+/**
+ * pq_pop() - Remove the element holding the smallest string
+ * @pq: priority queue
+ *
+ * Runs in O(log n) amortized time. Equal strings are not guaranteed to come
+ * out in insertion order. As with q_remove_head(), the element is unlinked but
+ * not released.
+ *
+ * Return: the removed element, %NULL if the priority queue is empty
+ */
+element_t *pq_pop(pqueue_t *pq);
+
+/**
+ * pq_meld() - Move all elements of a priority queue into another one in O(1)
+ * @dst: priority queue receiving the elements
+ * @src: priority queue which becomes empty
+ */
+void pq_meld(pqueue_t *dst, pqueue_t *src);
+
+/**
+ * pq_meld_queue() - Move all elements of a queue into a priority queue
+ * @pq: priority queue receiving the elements
+ * @head: header of queue, which becomes empty
+ *
+ * Runs in O(n) without allocating, whatever the order of the queue is.
+ */
+void pq_meld_queue(pqueue_t *pq, struct list_head *head);
+
+#endif /* LAB0_PQUEUE_H */
@@ -1,8 +1,11 @@
 /* Implementation of testing code for queue code */
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -45,7 +48,15 @@ extern int show_entropy;
 #include "queue.h"
 
 #include "console.h"
+#include "fcqueue.h"
+#include "filemerge.h"
+#include "hash.h"
+#include "iqueue.h"
+#include "pqueue.h"
 #include "report.h"
+#include "shmqueue.h"
+#include "squeue.h"
+#include "tpool.h"
 
 /* Settable parameters */
 
@@ -67,6 +78,9 @@ typedef struct {
 static queue_chain_t chain = {.size = 0};
 static queue_contex_t *current = NULL;
 
+/* Priority queue shared by all the pq_* commands */
+static pqueue_t pq;
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_LIST_SIZE;
 static int fail_count = 0;
@@ -75,6 +89,9 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+/* Queues longer than this are sorted on disk, 0 for never */
+static int spill = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -127,7 +144,8 @@ static bool do_free(int argc, char *argv[])
 
     q_show(3);
 
-    size_t bcnt = allocation_check();
+    /* Elements held by the priority queue are not owned by any queue */
+    size_t bcnt = allocation_check() - 2 * pq.size;
     if (!chain.size && bcnt > 0) {
         report(1,
                "ERROR: There is no queue, but %lu blocks are still allocated",
@@ -201,7 +219,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
 
     char *lasts = NULL;
     char randstr_buf[MAX_RANDSTR_LEN];
-    int reps = 1;
+    size_t reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
         report(1, "%s needs 1-2 arguments", argv[0]);
@@ -210,7 +228,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
 
     char *inserts = argv[1];
     if (argc == 3) {
-        if (!get_int(argv[2], &reps) || reps < 1) {
+        if (!get_size(argv[2], &reps) || reps < 1) {
             report(1, "Invalid number of insertions '%s'", argv[2]);
             return false;
         }
@@ -227,7 +245,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     error_check();
 
     if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
+        for (size_t r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
@@ -417,6 +435,287 @@ static inline bool do_rt(int argc, char *argv[])
     return queue_remove(POS_TAIL, argc, argv);
 }
 
+/* Parse the optional "head"/"tail" and expected value of peek and pop */
+static bool parse_end(int argc,
+                      char *argv[],
+                      position_t *pos,
+                      const char **expect)
+{
+    *pos = POS_HEAD;
+    *expect = NULL;
+    int i = 1;
+    if (i < argc && !strcmp(argv[i], "tail")) {
+        *pos = POS_TAIL;
+        i++;
+    } else if (i < argc && !strcmp(argv[i], "head")) {
+        i++;
+    }
+    if (i < argc)
+        *expect = argv[i++];
+    if (i < argc) {
+        report(1, "%s takes [end] [str], end being head or tail", argv[0]);
+        return false;
+    }
+    return true;
+}
+
+static bool do_peek(int argc, char *argv[])
+{
+    position_t pos;
+    const char *expect;
+    if (!parse_end(argc, argv, &pos, &expect))
+        return false;
+
+    if (!current || !current->q)
+        report(3, "Warning: Try to access null queue");
+    error_check();
+
+    q_view_t v = {NULL, 0};
+    if (current && exception_setup(true))
+        v = pos == POS_TAIL ? q_peek_tail(current->q) : q_peek_head(current->q);
+    exception_cancel();
+
+    bool ok = true;
+    struct list_head *node = NULL;
+    if (current && current->q && !list_empty(current->q))
+        node = pos == POS_TAIL ? current->q->prev : current->q->next;
+    if (!node) {
+        if (v.value) {
+            report(1, "ERROR: Peeking an empty queue returned %s", v.value);
+            ok = false;
+        } else {
+            report(2, "Queue is empty");
+        }
+    } else if (v.value != list_entry(node, element_t, list)->value) {
+        report(1, "ERROR: Peek did not return the string of the %s element",
+               pos == POS_TAIL ? "tail" : "head");
+        ok = false;
+    } else if (v.len != strlen(v.value)) {
+        report(1, "ERROR: Peek returned length %zu for %s", v.len, v.value);
+        ok = false;
+    } else {
+        report(2, "Peeked %s (length %zu)", v.value, v.len);
+        if (expect && strcmp(v.value, expect)) {
+            report(1, "ERROR: Peeked value %s != expected value %s", v.value,
+                   expect);
+            ok = false;
+        }
+    }
+    return ok && !error_check();
+}
+
+static bool do_pop(int argc, char *argv[])
+{
+    position_t pos;
+    const char *expect;
+    if (!parse_end(argc, argv, &pos, &expect))
+        return false;
+
+    if (!current || !current->size)
+        report(3, "Warning: Calling pop %s on empty queue",
+               pos == POS_TAIL ? "tail" : "head");
+    error_check();
+
+    // The buffer handed over must be the one held by the element
+    const char *held = NULL;
+    if (current && current->q && !list_empty(current->q))
+        held = list_entry(pos == POS_TAIL ? current->q->prev : current->q->next,
+                          element_t, list)
+                   ->value;
+
+    char *value = NULL;
+    if (current && exception_setup(true))
+        value = pos == POS_TAIL ? q_pop_tail_owned(current->q)
+                                : q_pop_head_owned(current->q);
+    exception_cancel();
+
+    bool ok = true;
+    if (value) {
+        current->size--;
+        if (value != held) {
+            report(1, "ERROR: Popped string is not the buffer of the element");
+            ok = false;
+        } else {
+            report(2, "Popped %s from queue", value);
+        }
+        if (expect && strcmp(value, expect)) {
+            report(1, "ERROR: Popped value %s != expected value %s", value,
+                   expect);
+            ok = false;
+        }
+        q_release_value(value);
+    } else if (held) {
+        fail_count++;
+        if (!expect && fail_count < fail_limit) {
+            report(2, "Pop from queue failed");
+        } else {
+            report(1, "ERROR: Pop from queue failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    } else if (expect) {
+        report(1, "ERROR: Queue is empty, expected value %s", expect);
+        ok = false;
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Find a queue of the chain by its ID */
+static queue_contex_t *find_queue(const char *arg)
+{
+    int id;
+    if (!get_int((char *) arg, &id)) {
+        report(1, "Invalid queue ID '%s'", arg);
+        return NULL;
+    }
+    queue_contex_t *ctx;
+    list_for_each_entry(ctx, &chain.head, chain) {
+        if (ctx->id == id)
+            return ctx;
+    }
+    report(1, "No queue with ID %d", id);
+    return NULL;
+}
+
+/* Node at a position of a queue, the head itself at position size */
+static struct list_head *node_at(queue_contex_t *ctx, size_t pos)
+{
+    struct list_head *node = ctx->q->next;
+    while (pos-- && node != ctx->q)
+        node = node->next;
+    return node;
+}
+
+/* Check the sizes of the queues on both ends of a move */
+static bool check_moved(queue_contex_t *src, queue_contex_t *dst, size_t cnt)
+{
+    if (src != dst) {
+        src->size -= cnt;
+        dst->size += cnt;
+    }
+    size_t got_src = q_size(src->q), got_dst = q_size(dst->q);
+    if (got_src != src->size || got_dst != dst->size) {
+        report(1,
+               "ERROR: Queues %d and %d hold %zu and %zu elements, but "
+               "expected %zu and %zu",
+               src->id, dst->id, got_src, got_dst, src->size, dst->size);
+        return false;
+    }
+    return true;
+}
+
+static bool do_move(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+
+    size_t n;
+    if (!get_size(argv[1], &n)) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Calling move on null queue");
+        return false;
+    }
+    queue_contex_t *dst = find_queue(argv[2]);
+    if (!dst)
+        return false;
+    error_check();
+
+    size_t want = n < current->size ? n : current->size;
+    size_t cnt = 0;
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        cnt = q_move_n(current->q, n, dst->q);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (cnt != want) {
+        report(1, "ERROR: Moved %zu elements, but expected %zu", cnt, want);
+        ok = false;
+    } else {
+        report(2, "Moved %zu elements to queue %d", cnt, dst->id);
+    }
+    ok = check_moved(current, dst, want) && ok;
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_splice(int argc, char *argv[])
+{
+    if (argc != 4 && argc != 5) {
+        report(1, "%s needs 3-4 arguments", argv[0]);
+        return false;
+    }
+
+    size_t first, last;
+    if (!get_size(argv[1], &first) || !get_size(argv[2], &last) ||
+        first > last) {
+        report(1, "Invalid range '%s' to '%s'", argv[1], argv[2]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Calling splice on null queue");
+        return false;
+    }
+    if (last >= current->size) {
+        report(1, "Range ends past the %zu elements of queue", current->size);
+        return false;
+    }
+    queue_contex_t *dst = find_queue(argv[3]);
+    if (!dst)
+        return false;
+    size_t pos = dst->size;
+    if (argc == 5 && (!get_size(argv[4], &pos) || pos > dst->size)) {
+        report(1, "Invalid position '%s' (0-%zu)", argv[4], dst->size);
+        return false;
+    }
+    if (dst == current && pos >= first && pos <= last) {
+        report(1, "Position %zu lies within the range", pos);
+        return false;
+    }
+    error_check();
+
+    struct list_head *f = node_at(current, first);
+    struct list_head *l = node_at(current, last);
+    struct list_head *p = node_at(dst, pos);
+    size_t cnt = last - first + 1;
+
+    bool ok = false;
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        ok = q_splice_range(current->q, f, l, dst->q, p);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    if (!ok) {
+        report(1, "ERROR: Failed to splice range");
+        return false;
+    }
+
+    // The range must sit in one piece right in front of the position
+    struct list_head *node = f;
+    for (size_t i = 1; i < cnt && node != l; i++)
+        node = node->next;
+    if (node != l || l->next != p || p->prev != l) {
+        report(1, "ERROR: Range is not in front of position %zu", pos);
+        ok = false;
+    } else {
+        report(2, "Moved %zu elements to queue %d", cnt, dst->id);
+    }
+    ok = check_moved(current, dst, cnt) && ok;
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -540,20 +839,20 @@ static bool do_size(int argc, char *argv[])
         return false;
     }
 
-    int reps = 1;
+    size_t reps = 1;
     bool ok = true;
     if (argc == 2) {
-        if (!get_int(argv[1], &reps))
+        if (!get_size(argv[1], &reps))
             report(1, "Invalid number of calls to size '%s'", argv[1]);
     }
 
-    int cnt = 0;
+    size_t cnt = 0;
     if (!current || !current->q)
         report(3, "Warning: Calling size on null queue");
     error_check();
 
     if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
+        for (size_t r = 0; ok && r < reps; r++) {
             cnt = q_size(current->q);
             ok = ok && !error_check();
         }
@@ -562,11 +861,12 @@ static bool do_size(int argc, char *argv[])
 
     if (current && ok) {
         if (current->size == cnt) {
-            report(2, "Queue size = %d", cnt);
+            report(2, "Queue size = %zu", cnt);
         } else {
             report(1,
-                   "ERROR: Computed queue size as %d, but correct value is %d",
-                   cnt, (int) current->size);
+                   "ERROR: Computed queue size as %zu, but correct value is "
+                   "%zu",
+                   cnt, current->size);
             ok = false;
         }
     }
@@ -576,14 +876,159 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
-bool do_sort(int argc, char *argv[])
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Sort running in the background, one slice at a time while the console is
+ * idle. Only one queue is sorted this way at once.
+ */
+static struct {
+    queue_contex_t *ctx; /* NULL if no sort is running */
+    q_sort_state_t st;
+    int reported; /* last progress reported, in percent */
+    double start;
+    bool failed; /* a background sort went wrong since the last wait */
+} bg_sort;
+
+/* How many steps of q_sort_step() a slice runs */
+#define SORT_SLICE (1 << 16)
+
+/* Check the order of a queue sorted in the background */
+static bool bg_sort_check(void)
+{
+    struct list_head *head = bg_sort.ctx->q;
+    bool desc = bg_sort.st.descend;
+    for (struct list_head *cur_l = head->next;
+         cur_l != head && cur_l->next != head; cur_l = cur_l->next) {
+        int cmp = strcmp(list_entry(cur_l, element_t, list)->value,
+                         list_entry(cur_l->next, element_t, list)->value);
+        if (desc ? cmp < 0 : cmp > 0) {
+            report(1, "ERROR: Queue %d is not sorted in %s order",
+                   bg_sort.ctx->id, desc ? "descending" : "ascending");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Run one slice of the background sort. Returns true while work remains. */
+static bool bg_sort_slice(void)
+{
+    if (!bg_sort.ctx)
+        return false;
+
+    bool done = false;
+    set_noallocate_mode(true);
+    if (exception_setup(true)) {
+        done = q_sort_step(&bg_sort.st, SORT_SLICE);
+    } else {
+        report(1, "ERROR: Background sort of queue %d aborted",
+               bg_sort.ctx->id);
+        bg_sort.failed = true;
+        bg_sort.ctx = NULL;
+    }
+    exception_cancel();
+    set_noallocate_mode(false);
+    if (!bg_sort.ctx)
+        return false;
+
+    if (!done) {
+        int pct = q_sort_progress(&bg_sort.st);
+        if (pct / 10 > bg_sort.reported / 10) {
+            report(2, "Background sort of queue %d: %d%%", bg_sort.ctx->id,
+                   pct);
+            bg_sort.reported = pct;
+        }
+        return true;
+    }
+
+    if (bg_sort_check())
+        report(2, "Background sort of queue %d done in %.3f s",
+               bg_sort.ctx->id, (now_ns() - bg_sort.start) / 1e9);
+    else
+        bg_sort.failed = true;
+    bg_sort.ctx = NULL;
+    return false;
+}
+
+/* Whether the command moves elements between queues, or frees queues other
+ * than the current one, as those merging the chain through collapse_chain()
+ */
+static bool spans_chain(int argc, char *argv[])
+{
+    return !strcmp(argv[0], "merge") || !strcmp(argv[0], "move") ||
+           !strcmp(argv[0], "splice") ||
+           (!strcmp(argv[0], "by") && argc > 2 && !strcmp(argv[2], "merge"));
+}
+
+/* Finish the background sort before commands which could touch its queue */
+static bool bg_sort_sync(int argc, char *argv[])
+{
+    static const char *const safe[] = {
+        "#",    "help", "log",  "new",    "next", "option",
+        "prev", "quit", "show", "source", "time", "wait",   "web",
+    };
+
+    // Other queues are fair game, except for the commands spanning the chain
+    if (!bg_sort.ctx || (current != bg_sort.ctx && !spans_chain(argc, argv)))
+        return true;
+    for (size_t i = 0; i < sizeof(safe) / sizeof(safe[0]); i++) {
+        if (!strcmp(argv[0], safe[i]))
+            return true;
+    }
+    report(3, "Finishing background sort of queue %d first", bg_sort.ctx->id);
+    while (bg_sort_slice())
+        ;
+    return true;
+}
+
+static bool do_wait(int argc, char *argv[])
 {
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
-    int cnt = 0;
+    if (!bg_sort.ctx)
+        report(3, "Warning: No sort is running in the background");
+    while (bg_sort_slice())
+        ;
+
+    bool ok = !bg_sort.failed;
+    bg_sort.failed = false;
+    q_show(3);
+    return ok && !error_check();
+}
+
+bool do_sort(int argc, char *argv[])
+{
+    bool background = argc == 2 && !strcmp(argv[1], "&");
+    if (argc != 1 && !background) {
+        report(1, "%s takes no arguments, or & to run in the background",
+               argv[0]);
+        return false;
+    }
+
+    if (background) {
+        if (!current || !current->q) {
+            report(3, "Warning: Calling sort on null queue");
+            return false;
+        }
+        while (bg_sort_slice())
+            ;
+        bg_sort.ctx = current;
+        bg_sort.reported = 0;
+        bg_sort.start = now_ns();
+        q_sort_begin(&bg_sort.st, current->q, descend);
+        report(2, "Sorting queue %d in the background", current->id);
+        return true;
+    }
+
+    size_t cnt = 0;
     if (!current || !current->q)
         report(3, "Warning: Calling sort on null queue");
     else
@@ -594,7 +1039,11 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
-    set_noallocate_mode(true);
+    // Spilling to disk frees the strings and reads them back
+    bool spilling = spill > 0 && cnt > (size_t) spill;
+    set_noallocate_mode(!spilling);
+    if (spilling && cnt > BIG_LIST_SIZE)
+        set_cautious_mode(false);
 
 /* If the number of elements is too large, it may take a long time to check the
  * stability of the sort. So, MAX_NODES is used to limit the number of elements
@@ -609,13 +1058,14 @@ bool do_sort(int argc, char *argv[])
     } else if (current && current->size > MAX_NODES)
         report(1,
                "Warning: Skip checking the stability of the sort because the "
-               "number of elements %d is too large, exceeds the limit %d.",
+               "number of elements %zu is too large, exceeds the limit %d.",
                current->size, MAX_NODES);
 
     if (current && exception_setup(true))
         q_sort(current->q, descend);
     exception_cancel();
     set_noallocate_mode(false);
+    set_cautious_mode(true);
 
     bool ok = true;
     if (current && current->size) {
@@ -718,150 +1168,2731 @@ static bool do_swap(int argc, char *argv[])
 }
 
 
-static bool do_ascend(int argc, char *argv[])
+/* Keep the strings which have nothing on the wrong side to their right */
+static size_t model_monotonic(char **m, size_t n, bool descend)
 {
-    if (argc != 1) {
-        report(1, "%s takes too much arguments", argv[0]);
+    if (!n)
+        return 0;
+    size_t keep = n - 1;
+    for (size_t i = n - 1; i-- > 0;) {
+        int cmp = strcmp(m[i], m[keep]);
+        if (!(descend ? cmp < 0 : cmp > 0))
+            m[--keep] = m[i];
+    }
+    memmove(m, m + keep, (n - keep) * sizeof(char *));
+    return n - keep;
+}
+
+/* Strings of the elements passed by q_monotonic_each() */
+struct monotonic_out {
+    char **value;
+    size_t n;
+};
+
+static void monotonic_collect(const element_t *e, void *arg)
+{
+    struct monotonic_out *out = arg;
+    out->value[out->n++] = e->value;
+}
+
+/* Run ascend or descend in place, or leaving the queue untouched with copy or
+ * each, and check the elements kept against the model
+ */
+static bool do_monotonic(int argc, char *argv[], bool descend)
+{
+    const char *name = argv[0];
+    bool copy = argc == 2 && !strcmp(argv[1], "copy");
+    bool each = argc == 2 && !strcmp(argv[1], "each");
+    if (argc > 2 || (argc == 2 && !copy && !each)) {
+        report(1, "%s takes no arguments, or copy or each", name);
         return false;
     }
 
     if (!current || !current->q) {
-        report(3, "Warning: Calling ascend on null queue");
+        report(3, "Warning: Calling %s on null queue", name);
         return false;
     }
     error_check();
 
-
-    int cnt = q_size(current->q);
+    size_t cnt = q_size(current->q);
     if (!cnt)
-        report(3, "Warning: Calling ascend on empty queue");
+        report(3, "Warning: Calling %s on empty queue", name);
     else if (cnt < 2)
-        report(3, "Warning: Calling ascend on single node");
+        report(3, "Warning: Calling %s on single node", name);
     error_check();
 
-    if (exception_setup(true))
-        current->size = q_ascend(current->q);
-    set_noallocate_mode(false);
+    // Strings of the queue before, of the elements to keep, and of those kept
+    char **orig = malloc(sizeof(char *) * 3 * (cnt ? cnt : 1));
+    queue_contex_t *dst = copy ? malloc(sizeof(queue_contex_t)) : NULL;
+    if (!orig || (copy && (!dst || !(dst->q = q_new())))) {
+        report(1, "Error: Failed to allocate memory");
+        free(orig);
+        free(dst);
+        return false;
+    }
+    char **m = orig + cnt, **got = m + cnt;
+    size_t n = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (n == cnt)
+            break;
+        orig[n++] = item->value;
+    }
+    memcpy(m, orig, n * sizeof(char *));
+    n = model_monotonic(m, n, descend);
 
     bool ok = true;
+    size_t left = 0;
+    struct monotonic_out out = {.value = got};
+    if (exception_setup(true)) {
+        if (copy)
+            left = q_monotonic_copy(current->q, descend, dst->q);
+        else if (each)
+            left = q_monotonic_each(current->q, descend, monotonic_collect,
+                                    &out);
+        else
+            left = current->size =
+                descend ? q_descend(current->q) : q_ascend(current->q);
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+    set_noallocate_mode(false);
 
-    cnt = current->size;
-    if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
-                report(1,
-                       "ERROR: At least one node violated the ordering rule");
-                ok = false;
+    if (ok && left == SIZE_MAX) {
+        report(1, "ERROR: %s failed to allocate memory", name);
+        ok = false;
+    }
+    if (ok && !each) {
+        struct list_head *head = copy ? dst->q : current->q;
+        list_for_each_entry(item, head, list) {
+            if (out.n == cnt)
                 break;
-            }
+            got[out.n++] = item->value;
+        }
+    }
+    if (ok && (left != n || out.n != n)) {
+        report(1, "ERROR: %zu elements kept and %zu returned, but expected %zu",
+               out.n, left, n);
+        ok = false;
+    }
+    for (size_t i = 0; ok && i < n; i++) {
+        if (copy ? strcmp(got[i], m[i]) : got[i] != m[i]) {
+            report(1, "ERROR: Kept %s at position %zu, but expected %s",
+                   got[i], i, m[i]);
+            ok = false;
+        }
+    }
+    if (ok && (copy || each)) {
+        size_t i = 0;
+        list_for_each_entry(item, current->q, list) {
+            if (i == cnt || item->value != orig[i])
+                break;
+            i++;
+        }
+        if (i != cnt || &item->list != current->q) {
+            report(1, "ERROR: %s changed the queue", name);
+            ok = false;
         }
     }
+    free(orig);
 
+    if (copy) {
+        list_add_tail(&dst->chain, &chain.head);
+        dst->size = ok ? left : q_size(dst->q);
+        dst->id = chain.size++;
+        current = dst;
+    }
     q_show(3);
     return ok && !error_check();
 }
 
-static bool do_descend(int argc, char *argv[])
+static bool do_ascend(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes too much arguments", argv[0]);
-        return false;
-    }
+    return do_monotonic(argc, argv, false);
+}
+
+static bool do_descend(int argc, char *argv[])
+{
+    return do_monotonic(argc, argv, true);
+}
+
+static bool do_reverseK(int argc, char *argv[])
+{
+    size_t k = 0, window = 0;
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling reverseK on null queue");
+        return false;
+    }
+    error_check();
+
+    if (argc == 2 || argc == 3) {
+        if (!get_size(argv[1], &k) || k < 1) {
+            report(1, "Invalid number of K (at least 1)");
+            return false;
+        }
+        if (argc == 3 && (!get_size(argv[2], &window) || !window)) {
+            report(1, "Invalid number of groups per window '%s'", argv[2]);
+            return false;
+        }
+    } else {
+        report(1, "Invalid number of arguments for reverseK");
+        return false;
+    }
+
+    // Remember the elements, to check where each of them ends up
+    size_t n = current->size;
+    element_t **e = malloc(sizeof(element_t *) * (n ? n : 1));
+    if (!e) {
+        report(1, "Error: Failed to allocate memory");
+        return false;
+    }
+    size_t cnt = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (cnt == n)
+            break;
+        e[cnt++] = item;
+    }
+
+    bool ok = true;
+    set_noallocate_mode(true);
+    if (exception_setup(true)) {
+        if (window)
+            q_reverseK_batch(current->q, k, window);
+        else
+            q_reverseK(current->q, k);
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    if (ok) {
+        // Whole groups come out backwards, a short tail as it was
+        size_t full = k > 1 ? cnt / k * k : 0, i = 0;
+        list_for_each_entry(item, current->q, list) {
+            size_t want = i < full ? i / k * k + (k - 1 - i % k) : i;
+            if (i == cnt || item != e[want]) {
+                report(1, "ERROR: Wrong element at position %zu", i);
+                ok = false;
+                break;
+            }
+            i++;
+        }
+        if (ok && i != cnt) {
+            report(1, "ERROR: Queue has %zu elements, but expected %zu", i,
+                   cnt);
+            ok = false;
+        }
+    }
+    free(e);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static int cmp_value(const void *a, const void *b)
+{
+    int cmp = strcmp(*(char *const *) a, *(char *const *) b);
+    return descend ? -cmp : cmp;
+}
+
+/* Snapshot the strings of current queue, sorted in ascending/descending order
+ * as the reference for partial sorting and selection.
+ */
+static char **sorted_values(void)
+{
+    char **values = malloc((current->size + 1) * sizeof(char *));
+    if (!values) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for values");
+        return NULL;
+    }
+
+    size_t n = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (n == current->size)
+            break;
+        values[n++] = item->value;
+    }
+    qsort(values, n, sizeof(char *), cmp_value);
+    return values;
+}
+
+/* Element of the queue along with its original position */
+struct ranked {
+    element_t *e;
+    size_t pos;
+};
+
+/* Order by value, equal values keeping their original order */
+static int cmp_ranked(const void *a, const void *b)
+{
+    const struct ranked *ra = a, *rb = b;
+    int cmp = strcmp(ra->e->value, rb->e->value);
+    if (cmp)
+        return descend ? -cmp : cmp;
+    return (ra->pos > rb->pos) - (ra->pos < rb->pos);
+}
+
+static bool do_topk(int argc, char *argv[])
+{
+    size_t k = 0;
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling topk on null queue");
+        return false;
+    }
+    error_check();
+
+    if (argc != 2 || !get_size(argv[1], &k) || k < 1) {
+        report(1, "Invalid number of K (at least 1)");
+        return false;
+    }
+
+    // Remember the elements, and where each of them must end up: the first k
+    // of a stable sort, then all the others in the order they were in
+    size_t n = current->size;
+    struct ranked *r = malloc(sizeof(struct ranked) * (n ? n : 1));
+    element_t **e = malloc(sizeof(element_t *) * (n ? n : 1));
+    bool *top = calloc(n ? n : 1, sizeof(bool));
+    if (!r || !e || !top) {
+        free(r);
+        free(e);
+        free(top);
+        report(1, "Error: Failed to allocate memory");
+        return false;
+    }
+    size_t cnt = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (cnt == n)
+            break;
+        r[cnt] = (struct ranked){.e = item, .pos = cnt};
+        e[cnt++] = item;
+    }
+    qsort(r, cnt, sizeof(struct ranked), cmp_ranked);
+    size_t m = k < cnt ? k : cnt;
+    for (size_t i = 0; i < m; i++)
+        top[r[i].pos] = true;
+    for (size_t i = 0, j = m; i < cnt; i++) {
+        if (!top[i])
+            r[j++].e = e[i];
+    }
+
+    bool ok = true;
+    if (exception_setup(true))
+        q_sort_topk(current->q, k, descend);
+    else
+        ok = false;
+    exception_cancel();
+
+    if (ok) {
+        size_t i = 0;
+        list_for_each_entry(item, current->q, list) {
+            if (i == cnt || item != r[i].e) {
+                report(1, "ERROR: Wrong element at position %zu", i);
+                ok = false;
+                break;
+            }
+            i++;
+        }
+        if (ok && i != cnt) {
+            report(1, "ERROR: Queue has %zu elements, but expected %zu", i,
+                   cnt);
+            ok = false;
+        }
+        if (ok && q_size(current->q) != cnt) {
+            report(1, "ERROR: Queue size is %zu, but expected %zu",
+                   q_size(current->q), cnt);
+            ok = false;
+        }
+    }
+    free(r);
+    free(e);
+    free(top);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_kth(int argc, char *argv[])
+{
+    size_t k = 0;
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling kth on null queue");
+        return false;
+    }
+    error_check();
+
+    if (argc != 2 || !get_size(argv[1], &k)) {
+        report(1, "Invalid rank K (at least 0)");
+        return false;
+    }
+
+    char **values = sorted_values();
+    if (!values)
+        return false;
+
+    element_t *e = NULL;
+    if (exception_setup(true))
+        e = q_select_kth(current->q, k, descend);
+    exception_cancel();
+
+    bool ok = true;
+    if (k >= current->size) {
+        if (e) {
+            report(1, "ERROR: Selected %s, but rank %zu is out of range",
+                   e->value, k);
+            ok = false;
+        }
+    } else if (!e) {
+        report(1, "ERROR: Failed to select element of rank %zu", k);
+        ok = false;
+    } else if (strcmp(e->value, values[k])) {
+        report(1, "ERROR: Selected %s, but expected %s", e->value, values[k]);
+        ok = false;
+    } else {
+        report(2, "Element of rank %zu = %s", k, e->value);
+    }
+    free(values);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_index(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling index on null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = true;
+    if (exception_setup(true))
+        ok = q_index(current->q);
+    exception_cancel();
+
+    if (!ok)
+        report(1, "ERROR: Failed to attach hash index to queue");
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Count the elements holding string s the slow way, as the reference */
+static size_t count_value(const char *s)
+{
+    size_t cnt = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list)
+        cnt += !strcmp(item->value, s);
+    return cnt;
+}
+
+static bool do_contains(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    size_t reps = 1;
+    if (argc == 3) {
+        if (!get_size(argv[2], &reps) || reps < 1) {
+            report(1, "Invalid number of lookups '%s'", argv[2]);
+            return false;
+        }
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling contains on null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = true, found = false;
+    if (exception_setup(true)) {
+        for (size_t r = 0; ok && r < reps; r++) {
+            found = q_contains(current->q, argv[1]);
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    if (ok) {
+        bool expected = count_value(argv[1]) > 0;
+        if (found != expected) {
+            report(1, "ERROR: Queue %s %s, but q_contains says otherwise",
+                   expected ? "contains" : "does not contain", argv[1]);
+            ok = false;
+        } else {
+            report(2, "Queue %s %s", found ? "contains" : "does not contain",
+                   argv[1]);
+        }
+    }
+
+    return ok && !error_check();
+}
+
+static bool do_filter(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling filter on null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = true;
+    if (exception_setup(true))
+        ok = q_filter(current->q);
+    exception_cancel();
+
+    if (!ok)
+        report(1, "ERROR: Failed to attach filter to queue");
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_maybe(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    size_t reps = 1;
+    if (argc == 3 && (!get_size(argv[2], &reps) || reps < 1)) {
+        report(1, "Invalid number of lookups '%s'", argv[2]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling maybe on null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = true, found = false;
+    if (exception_setup(true)) {
+        for (size_t r = 0; ok && r < reps; r++) {
+            found = q_maybe_contains(current->q, argv[1]);
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    if (ok) {
+        bool present = count_value(argv[1]) > 0;
+        if (present && !found) {
+            report(1, "ERROR: Queue contains %s, but q_maybe_contains says no",
+                   argv[1]);
+            ok = false;
+        } else {
+            report(2, "Queue %s %s%s",
+                   found ? "may contain" : "does not contain", argv[1],
+                   found && !present ? " (false positive)" : "");
+        }
+    }
+
+    return ok && !error_check();
+}
+
+/* Look up random strings and every string of the queue with
+ * q_maybe_contains(), counting the false positives and timing the lookups
+ */
+static bool do_fprate(int argc, char *argv[])
+{
+    size_t n = 10000;
+    if (argc > 2 || (argc == 2 && (!get_size(argv[1], &n) || !n))) {
+        report(1, "%s takes an optional number of lookups", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling fprate on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t cnt = q_size(current->q);
+    char **values = malloc(sizeof(char *) * (cnt ? cnt : 1));
+    char *probe = malloc((size_t) MAX_RANDSTR_LEN * n);
+    bool *hit = malloc(sizeof(bool) * n);
+    if (!values || !probe || !hit) {
+        report(1, "Error: Failed to allocate memory");
+        free(values);
+        free(probe);
+        free(hit);
+        return false;
+    }
+    size_t i = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (i == cnt)
+            break;
+        values[i++] = item->value;
+    }
+    qsort(values, cnt, sizeof(char *), cmp_value);
+    for (i = 0; i < n; i++)
+        fill_rand_string(probe + i * MAX_RANDSTR_LEN, MAX_RANDSTR_LEN);
+
+    bool ok = true;
+    double t = 0;
+    if (exception_setup(true)) {
+        // Leave any pending rebuild of the filter out of the timing
+        q_maybe_contains(current->q, "");
+        t = now_ns();
+        for (i = 0; i < n; i++)
+            hit[i] = q_maybe_contains(current->q, probe + i * MAX_RANDSTR_LEN);
+        t = now_ns() - t;
+        list_for_each_entry(item, current->q, list) {
+            if (!q_maybe_contains(current->q, item->value)) {
+                report(1, "ERROR: q_maybe_contains misses %s", item->value);
+                ok = false;
+                break;
+            }
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+
+    size_t absent = 0, fp = 0;
+    for (i = 0; ok && i < n; i++) {
+        char *s = probe + i * MAX_RANDSTR_LEN;
+        if (bsearch(&s, values, cnt, sizeof(char *), cmp_value)) {
+            if (!hit[i]) {
+                report(1, "ERROR: q_maybe_contains misses %s", s);
+                ok = false;
+            }
+            continue;
+        }
+        absent++;
+        fp += hit[i];
+    }
+    if (ok)
+        report(1,
+               "%zu lookups of absent strings, %zu false positives (%.2f%%), "
+               "%.1f ns per lookup",
+               absent, fp, absent ? 100.0 * fp / absent : 0.0, t / n);
+
+    free(values);
+    free(probe);
+    free(hit);
+    return ok && !error_check();
+}
+
+static bool do_defer(int argc, char *argv[])
+{
+    size_t limit = SIZE_MAX;
+    if (argc > 2 || (argc == 2 && !get_size(argv[1], &limit))) {
+        report(1, "%s takes an optional limit", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling defer on null queue");
+        return false;
+    }
+    error_check();
+
+    if (exception_setup(true))
+        q_set_deferred(current->q, limit);
+    exception_cancel();
+
+    q_show(3);
+    return !error_check();
+}
+
+static bool do_reap(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling reap on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t n = 0;
+    if (exception_setup(true))
+        n = q_flush_graveyard(current->q);
+    exception_cancel();
+
+    report(1, "Freed %zu deleted elements", n);
+    q_show(3);
+    return !error_check();
+}
+
+/* Time q_delete_dup() on n strings inserted twice each, then q_descend() on
+ * n random strings, freeing deleted elements at once or deferring them
+ */
+static bool do_deferbench(int argc, char *argv[])
+{
+    size_t n;
+    if (argc != 2 || !get_size(argv[1], &n) || !n) {
+        report(1, "%s needs a number of strings", argv[0]);
+        return false;
+    }
+    error_check();
+
+    bool ok = true;
+    double ns[2][3];
+    size_t deleted[2][2];
+    set_cautious_mode(false);
+    for (int c = 0; ok && c < 2; c++) {
+        struct list_head *q = NULL;
+        bool done = false;
+        if (exception_setup(true)) {
+            char randstr_buf[MAX_RANDSTR_LEN];
+            q = q_new();
+            for (size_t i = 0; q && ok && i < n; i++) {
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+                ok = q_insert_tail(q, randstr_buf) &&
+                     q_insert_tail(q, randstr_buf);
+            }
+            if (q && ok) {
+                q_set_deferred(q, c ? SIZE_MAX : 0);
+                q_sort(q, false);
+
+                double t = now_ns();
+                q_delete_dup(q);
+                ns[c][0] = now_ns() - t;
+                deleted[c][0] = 2 * n - q_size(q);
+
+                for (size_t i = 0; ok && i < n; i++) {
+                    fill_rand_string(randstr_buf, sizeof(randstr_buf));
+                    ok = q_insert_tail(q, randstr_buf);
+                }
+                size_t before = q_size(q);
+                t = now_ns();
+                q_descend(q);
+                ns[c][1] = now_ns() - t;
+                deleted[c][1] = before - q_size(q);
+
+                t = now_ns();
+                size_t freed = q_flush_graveyard(q);
+                ns[c][2] = now_ns() - t;
+                if (freed != (c ? deleted[c][0] + deleted[c][1] : 0)) {
+                    report(1, "ERROR: Flushed %zu elements, %zu deleted",
+                           freed, c ? deleted[c][0] + deleted[c][1] : 0);
+                    ok = false;
+                }
+            }
+            if (!q || !ok) {
+                report(1, "ERROR: Failed to allocate elements");
+                ok = false;
+            }
+            done = true;
+        } else {
+            ok = false;
+        }
+        exception_cancel();
+        // A timeout may have left the queue half way through an operation
+        if (done)
+            q_free(q);
+    }
+    set_cautious_mode(true);
+
+    if (ok) {
+        // Divide by at least 1, for runs which delete nothing
+        for (int c = 0; c < 2; c++) {
+            for (int op = 0; op < 2; op++)
+                deleted[c][op] += !deleted[c][op];
+        }
+        report(1,
+               "delete_dup %.1f vs %.1f, descend %.1f vs %.1f ns per "
+               "deleted element (free vs defer), then flush %.1f ns each",
+               ns[0][0] / deleted[0][0], ns[1][0] / deleted[1][0],
+               ns[0][1] / deleted[0][1], ns[1][1] / deleted[1][1],
+               ns[1][2] / (deleted[1][0] + deleted[1][1]));
+    }
+    return ok && !error_check();
+}
+
+static bool do_count(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling count on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t cnt = 0;
+    if (exception_setup(true))
+        cnt = q_count_value(current->q, argv[1]);
+    exception_cancel();
+
+    bool ok = true;
+    size_t expected = count_value(argv[1]);
+    if (cnt != expected) {
+        report(1, "ERROR: Counted %zu copies of %s, but correct value is %zu",
+               cnt, argv[1], expected);
+        ok = false;
+    } else {
+        report(2, "Copies of %s = %zu", argv[1], cnt);
+    }
+
+    return ok && !error_check();
+}
+
+static bool do_delval(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling delval on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t expected = count_value(argv[1]);
+    size_t cnt = 0;
+    if (exception_setup(true))
+        cnt = q_delete_value(current->q, argv[1]);
+    exception_cancel();
+
+    bool ok = true;
+    if (cnt != expected) {
+        report(1, "ERROR: Deleted %zu copies of %s, but there were %zu", cnt,
+               argv[1], expected);
+        ok = false;
+    }
+    current->size -= cnt;
+    if (count_value(argv[1])) {
+        report(1, "ERROR: Copies of %s are still in queue", argv[1]);
+        ok = false;
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_pq_insert(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    size_t reps = 1;
+    bool ok = true;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    char *inserts = argv[1];
+    if (argc == 3) {
+        if (!get_size(argv[2], &reps) || reps < 1) {
+            report(1, "Invalid number of insertions '%s'", argv[2]);
+            return false;
+        }
+    }
+
+    bool need_rand = !strcmp(inserts, "RAND");
+    if (need_rand)
+        inserts = randstr_buf;
+
+    error_check();
+
+    if (exception_setup(true)) {
+        for (size_t r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            if (!pq_insert(&pq, inserts)) {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Insertion of %s failed", inserts);
+                else {
+                    report(1,
+                           "ERROR: Insertion of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    report(3, "pq: size = %zu", pq.size);
+    return ok;
+}
+
+static bool do_pq_pop(int argc, char *argv[])
+{
+    size_t reps = 1;
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 2 && (!get_size(argv[1], &reps) || reps < 1)) {
+        report(1, "Invalid number of removals '%s'", argv[1]);
+        return false;
+    }
+
+    if (reps > pq.size) {
+        report(1,
+               "ERROR: Cannot remove %zu elements from priority queue of %zu",
+               reps, pq.size);
+        return false;
+    }
+    error_check();
+
+    if (reps > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+
+    bool ok = true;
+    char last[MAXSTRING] = "";
+    if (exception_setup(true)) {
+        for (size_t r = 0; ok && r < reps; r++) {
+            element_t *e = pq_pop(&pq);
+            if (!e) {
+                report(1, "ERROR: Priority queue became empty unexpectedly");
+                ok = false;
+                break;
+            }
+            if (strcmp(e->value, last) < 0) {
+                report(1, "ERROR: Removed %s after %s, not in ascending order",
+                       e->value, last);
+                ok = false;
+            } else if (reps <= BIG_LIST_SIZE) {
+                report(2, "Removed %s from priority queue", e->value);
+            }
+            strncpy(last, e->value, MAXSTRING - 1);
+            q_release_element(e);
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+
+    report(3, "pq: size = %zu", pq.size);
+    return ok && !error_check();
+}
+
+static bool do_pq_meld(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling pq_meld on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t expected = pq.size + current->size;
+    if (exception_setup(true))
+        pq_meld_queue(&pq, current->q);
+    exception_cancel();
+
+    bool ok = true;
+    current->size = 0;
+    if (pq.size != expected) {
+        report(1, "ERROR: Priority queue has %zu elements, but expected %zu",
+               pq.size, expected);
+        ok = false;
+    }
+
+    report(3, "pq: size = %zu", pq.size);
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Per-element callbacks of the pfor command */
+static void pfor_upper(element_t *e, void *arg)
+{
+    for (char *c = e->value; *c; c++)
+        *c = toupper(*c);
+}
+
+static void pfor_lower(element_t *e, void *arg)
+{
+    for (char *c = e->value; *c; c++)
+        *c = tolower(*c);
+}
+
+/* Give the element a string of its own, allocating and freeing through the
+ * harness from the threads of the pool. A failed copy keeps the old string.
+ */
+static void pfor_copy(element_t *e, void *arg)
+{
+    char *copy = test_strdup(e->value);
+    if (!copy)
+        return;
+    test_free(e->value);
+    e->value = copy;
+}
+
+static int pfor_same(int c)
+{
+    return c;
+}
+
+static void pfor_hash(element_t *e, void *arg)
+{
+    __atomic_fetch_xor((uint64_t *) arg, hash_string(e->value), __ATOMIC_RELAXED);
+}
+
+#define PFOR_MAX_PARTS 1024
+
+static bool do_pfor(int argc, char *argv[])
+{
+    int parts = 4;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 3 && (!get_int(argv[2], &parts) || parts < 1 ||
+                      parts > PFOR_MAX_PARTS)) {
+        report(1, "Invalid number of parts '%s' (1-%d)", argv[2],
+               PFOR_MAX_PARTS);
+        return false;
+    }
+
+    void (*fn)(element_t *, void *);
+    int (*conv)(int) = NULL;
+    if (!strcmp(argv[1], "upper")) {
+        fn = pfor_upper;
+        conv = toupper;
+    } else if (!strcmp(argv[1], "lower")) {
+        fn = pfor_lower;
+        conv = tolower;
+    } else if (!strcmp(argv[1], "hash")) {
+        fn = pfor_hash;
+    } else if (!strcmp(argv[1], "copy")) {
+        fn = pfor_copy;
+        conv = pfor_same;
+    } else {
+        report(1, "Unknown operation '%s' (upper, lower, hash or copy)",
+               argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling pfor on null queue");
+        return false;
+    }
+    error_check();
+
+    // Compute the expected outcome serially
+    size_t n = current->size;
+    char **expected = malloc(sizeof(char *) * (n ? n : 1));
+    struct list_head **pieces = calloc(parts, sizeof(struct list_head *));
+    if (!expected || !pieces) {
+        free(expected);
+        free(pieces);
+        report(1, "Error: Failed to allocate memory");
+        return false;
+    }
+    uint64_t want = 0, got = 0;
+    size_t cnt = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (cnt == n)
+            break;
+        if (!conv) {
+            want ^= hash_string(item->value);
+            expected[cnt++] = NULL;
+            continue;
+        }
+        expected[cnt] = strdup(item->value);
+        if (expected[cnt])
+            for (char *c = expected[cnt]; *c; c++)
+                *c = conv(*c);
+        cnt++;
+    }
+
+    // Whatever the threads allocate must be freed by the time they are done
+    size_t blocks = allocation_check();
+    bool ok = true;
+    if (exception_setup(true)) {
+        for (int i = 0; ok && i < parts; i++) {
+            pieces[i] = q_new();
+            ok = pieces[i];
+        }
+        if (!ok) {
+            report(1, "ERROR: Failed to create queues for pieces");
+        } else if (!q_split(current->q, parts, pieces)) {
+            report(1, "ERROR: Failed to split queue");
+            ok = false;
+        } else {
+            q_parallel_for_each(pieces, parts, fn, &got);
+            q_concat(current->q, parts, pieces);
+        }
+        for (int i = 0; i < parts; i++)
+            q_free(pieces[i]);
+    }
+    exception_cancel();
+
+    if (ok) {
+        cnt = 0;
+        list_for_each_entry(item, current->q, list) {
+            if (cnt == n)
+                break;
+            if (conv && expected[cnt] && strcmp(item->value, expected[cnt])) {
+                report(1, "ERROR: Element %zu is %s, but expected %s", cnt,
+                       item->value, expected[cnt]);
+                ok = false;
+                break;
+            }
+            cnt++;
+        }
+        if (ok && cnt != n) {
+            report(1, "ERROR: Queue has %zu elements, but expected %zu", cnt,
+                   n);
+            ok = false;
+        }
+        if (ok && allocation_check() != blocks) {
+            report(1, "ERROR: %zu blocks allocated, but expected %zu",
+                   allocation_check(), blocks);
+            ok = false;
+        }
+        if (ok && !conv) {
+            if (got != want) {
+                report(1,
+                       "ERROR: Hash is %016" PRIx64
+                       ", but expected %016" PRIx64,
+                       got, want);
+                ok = false;
+            } else {
+                report(2, "Hash = %016" PRIx64, got);
+            }
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+        free(expected[i]);
+    free(expected);
+    free(pieces);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Task of tpsum, hashing a range of elements by splitting it in two until it
+ * is no longer than grain
+ */
+struct tpsum_task {
+    struct tp_task task;
+    element_t **e;
+    size_t n;
+    size_t grain;
+    uint64_t sum;
+    size_t tasks;
+};
+
+static void tpsum_run(struct tp_task *task)
+{
+    struct tpsum_task *s = container_of(task, struct tpsum_task, task);
+    s->sum = 0;
+    s->tasks = 1;
+    if (s->n <= s->grain) {
+        for (size_t i = 0; i < s->n; i++)
+            s->sum += hash_string(s->e[i]->value);
+        return;
+    }
+
+    struct tpsum_task half[2] = {
+        {.e = s->e, .n = s->n / 2, .grain = s->grain},
+        {.e = s->e + s->n / 2, .n = s->n - s->n / 2, .grain = s->grain},
+    };
+    tp_group_t g = TP_GROUP_INIT;
+    tp_spawn(&g, &half[0].task, tpsum_run);
+    tp_spawn(&g, &half[1].task, tpsum_run);
+    tp_wait(&g);
+    s->sum = half[0].sum + half[1].sum;
+    s->tasks += half[0].tasks + half[1].tasks;
+}
+
+static bool do_tpsum(int argc, char *argv[])
+{
+    int threads = 0;
+    size_t grain = 64;
+    if (argc > 3) {
+        report(1, "%s takes 0-2 arguments", argv[0]);
+        return false;
+    }
+    if (argc > 1 && (!get_int(argv[1], &threads) || threads < 1 ||
+                     threads > TP_MAX_THREADS)) {
+        report(1, "Invalid number of threads '%s' (1-%d)", argv[1],
+               TP_MAX_THREADS);
+        return false;
+    }
+    if (argc > 2 && (!get_size(argv[2], &grain) || !grain)) {
+        report(1, "Invalid grain '%s'", argv[2]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling tpsum on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t n = current->size;
+    element_t **e = malloc(sizeof(element_t *) * (n ? n : 1));
+    if (!e) {
+        report(1, "Error: Failed to allocate memory");
+        return false;
+    }
+    size_t cnt = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (cnt == n)
+            break;
+        e[cnt++] = item;
+    }
+
+    bool ok = true;
+    struct tpsum_task root = {.e = e, .n = cnt, .grain = grain};
+    double t[2];
+    uint64_t want = 0;
+    if (exception_setup(true)) {
+        if (threads)
+            tp_reserve(threads);
+        t[0] = now_ns();
+        for (size_t i = 0; i < cnt; i++)
+            want += hash_string(e[i]->value);
+        t[0] = now_ns() - t[0];
+
+        t[1] = now_ns();
+        tp_group_t g = TP_GROUP_INIT;
+        tp_spawn(&g, &root.task, tpsum_run);
+        tp_wait(&g);
+        t[1] = now_ns() - t[1];
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+    free(e);
+
+    if (ok && root.sum != want) {
+        report(1, "ERROR: Hash is %016" PRIx64 ", but expected %016" PRIx64,
+               root.sum, want);
+        ok = false;
+    } else if (ok) {
+        report(1,
+               "tpsum: %zu elements in %zu tasks on %d threads, serial %.3f "
+               "ms, pool %.3f ms",
+               cnt, root.tasks, tp_threads(), t[0] / 1e6, t[1] / 1e6);
+    }
+    return ok && !error_check();
+}
+
+/* Order independent hash of the strings of a queue */
+static uint64_t queue_sum(struct list_head *head, size_t *cnt)
+{
+    uint64_t sum = 0;
+    element_t *item;
+    *cnt = 0;
+    list_for_each_entry(item, head, list) {
+        sum += hash_string(item->value);
+        (*cnt)++;
+    }
+    return sum;
+}
+
+static bool do_shard(int argc, char *argv[])
+{
+    int shards;
+    sq_route_t route = SQ_ROUND_ROBIN;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &shards) || shards < 1 || shards > SQ_MAX_SHARDS) {
+        report(1, "Invalid number of shards '%s' (1-%d)", argv[1],
+               SQ_MAX_SHARDS);
+        return false;
+    }
+    if (argc == 3) {
+        if (strcmp(argv[2], "hash")) {
+            report(1, "Unknown routing '%s' (hash)", argv[2]);
+            return false;
+        }
+        route = SQ_HASH;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling shard on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t n, cnt;
+    uint64_t sum = queue_sum(current->q, &n);
+    bool ok = true;
+    squeue_t *sq = NULL;
+    struct list_head *tmp = NULL;
+    if (exception_setup(true)) {
+        sq = sq_new(shards, route);
+        tmp = q_new();
+        if (!sq || !tmp) {
+            report(1, "ERROR: Failed to create sharded queue");
+            ok = false;
+        }
+    }
+    exception_cancel();
+
+    // Push one element at a time, pop half of them back with every shard as
+    // home in turn, so that emptied shards steal from the others, then sort
+    set_noallocate_mode(true);
+    if (ok && exception_setup(true)) {
+        while (sq_push(sq, current->q, 1))
+            ;
+        if (sq_size(sq) != n) {
+            report(1, "ERROR: Sharded queue holds %zu elements, expected %zu",
+                   sq_size(sq), n);
+            ok = false;
+        }
+        for (int i = 0; i < sq->n; i++)
+            report(3, "shard %d: %zu elements", i, sq->shard[i]->size);
+
+        for (cnt = 0; ok && cnt < n / 2; cnt++) {
+            if (!sq_pop(sq, cnt % shards, tmp, 1)) {
+                report(1, "ERROR: Popped %zu elements, expected %zu", cnt,
+                       n / 2);
+                ok = false;
+            }
+        }
+        while (sq_push(sq, tmp, 1))
+            ;
+        // Spilling to disk frees the strings and reads them back, as in sort
+        set_noallocate_mode(!(spill > 0 && n > (size_t) spill));
+        cnt = sq_sort(sq, current->q, descend);
+        if (ok && (cnt != n || sq_size(sq))) {
+            report(1, "ERROR: Sorted %zu elements, expected %zu", cnt, n);
+            ok = false;
+        }
+    }
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    // Whatever is left goes back to queue before checking it
+    if (sq)
+        sq_drain(sq, current->q);
+    if (tmp)
+        q_concat(current->q, 1, &tmp);
+    sq_free(sq);
+    q_free(tmp);
+
+    if (queue_sum(current->q, &cnt) != sum || cnt != n) {
+        report(1, "ERROR: Sharding changed the contents of the queue");
+        ok = false;
+    }
+    element_t *item, *prev = NULL;
+    list_for_each_entry(item, current->q, list) {
+        if (!ok)
+            break;
+        int cmp = prev ? strcmp(prev->value, item->value) : 0;
+        if (descend ? cmp < 0 : cmp > 0) {
+            report(1, "ERROR: Not sorted in %s order",
+                   descend ? "descending" : "ascending");
+            ok = false;
+        }
+        prev = item;
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+#define SQ_BENCH_MAX_THREADS 64
+
+/* Thread of the sqbench command, pushing or popping one element at a time */
+struct sq_bench {
+    squeue_t *sq;
+    struct list_head *mine;
+    int home;
+    bool push;
+    const int *go;
+    pthread_t tid;
+};
+
+static void *sq_bench_worker(void *data)
+{
+    struct sq_bench *b = data;
+    while (!__atomic_load_n(b->go, __ATOMIC_ACQUIRE))
+        sched_yield();
+    if (b->push) {
+        while (sq_push(b->sq, b->mine, 1))
+            ;
+    } else {
+        while (sq_pop(b->sq, b->home, b->mine, 1))
+            ;
+    }
+    return NULL;
+}
+
+/* Time the threads pushing their queues into sq, or popping it back */
+static double sq_bench_run(squeue_t *sq,
+                           struct sq_bench *b,
+                           int threads,
+                           bool push)
+{
+    int go = 0;
+    int started = 0;
+    // Workers inherit the signal mask, and leave the harness to this thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (int i = 0; i < threads; i++) {
+        b[i] = (struct sq_bench){.sq = sq,
+                                 .mine = b[i].mine,
+                                 .home = i % sq->n,
+                                 .push = push,
+                                 .go = &go};
+        // The calling thread works for the threads that cannot be started
+        if (!pthread_create(&b[i].tid, NULL, sq_bench_worker, &b[i]))
+            started = i + 1;
+        else
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    double t = now_ns();
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    for (int i = started; i < threads; i++)
+        sq_bench_worker(&b[i]);
+    for (int i = 0; i < started; i++)
+        pthread_join(b[i].tid, NULL);
+    return now_ns() - t;
+}
+
+static bool do_sqbench(int argc, char *argv[])
+{
+    size_t n;
+    int shards = 16;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_size(argv[1], &n) || !n) {
+        report(1, "Invalid number of elements '%s'", argv[1]);
+        return false;
+    }
+    if (argc == 3 && (!get_int(argv[2], &shards) || shards < 1 ||
+                      shards > SQ_MAX_SHARDS)) {
+        report(1, "Invalid number of shards '%s' (1-%d)", argv[2],
+               SQ_MAX_SHARDS);
+        return false;
+    }
+    error_check();
+
+    // Elements are made up front, so that only the queues themselves are timed
+    struct sq_bench b[SQ_BENCH_MAX_THREADS];
+    struct list_head *pool = NULL;
+    bool ok = true;
+    memset(b, 0, sizeof(b));
+    if (n > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    // Making the elements is not what is timed, and may take longer than the
+    // time limit for large n, which must not cut it short
+    if (exception_setup(false)) {
+        char randstr_buf[MAX_RANDSTR_LEN];
+        pool = q_new();
+        for (size_t i = 0; pool && ok && i < n; i++) {
+            fill_rand_string(randstr_buf, sizeof(randstr_buf));
+            ok = q_insert_tail(pool, randstr_buf);
+        }
+        for (int i = 0; ok && i < SQ_BENCH_MAX_THREADS; i++)
+            ok = (b[i].mine = q_new());
+        if (!pool || !ok) {
+            report(1, "ERROR: Failed to allocate elements");
+            ok = false;
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+    size_t cnt;
+    uint64_t sum = ok ? queue_sum(pool, &cnt) : 0;
+
+    set_noallocate_mode(true);
+    for (int threads = 1; ok && threads <= SQ_BENCH_MAX_THREADS;
+         threads *= 2) {
+        double ns[2][2];
+        for (int c = 0; ok && c < 2; c++) {
+            squeue_t *sq = NULL;
+            set_noallocate_mode(false);
+            if (exception_setup(true))
+                sq = sq_new(c ? shards : 1, SQ_ROUND_ROBIN);
+            exception_cancel();
+            set_noallocate_mode(true);
+            if (!sq) {
+                report(1, "ERROR: Failed to create sharded queue");
+                ok = false;
+                break;
+            }
+            for (int i = 0; i < threads; i++)
+                q_move_n(pool, n / threads + ((size_t) i < n % threads),
+                         b[i].mine);
+            // The workers must be joined before leaving, which the alarm
+            // would prevent; they stop on their own once out of elements
+            if (exception_setup(false)) {
+                ns[c][0] = sq_bench_run(sq, b, threads, true);
+                if (sq_size(sq) != n) {
+                    report(1, "ERROR: Pushed %zu elements, expected %zu",
+                           sq_size(sq), n);
+                    ok = false;
+                }
+                ns[c][1] = sq_bench_run(sq, b, threads, false);
+                if (sq_size(sq)) {
+                    report(1, "ERROR: %zu elements left after popping",
+                           sq_size(sq));
+                    ok = false;
+                }
+            } else {
+                ok = false;
+            }
+            exception_cancel();
+            sq_drain(sq, pool);
+            for (int i = 0; i < threads; i++)
+                q_concat(pool, 1, &b[i].mine);
+            set_noallocate_mode(false);
+            sq_free(sq);
+            set_noallocate_mode(true);
+        }
+        if (ok) {
+            report(1,
+                   "threads %2d: push %7.2f vs %7.2f, pop %7.2f vs %7.2f "
+                   "Mops/s (1 lock vs %d shards)",
+                   threads, n * 1e3 / ns[0][0], n * 1e3 / ns[1][0],
+                   n * 1e3 / ns[0][1], n * 1e3 / ns[1][1], shards);
+        }
+    }
+    set_noallocate_mode(false);
+
+    if (pool && queue_sum(pool, &cnt) != sum) {
+        report(1, "ERROR: Benchmark changed the elements");
+        ok = false;
+    }
+    q_free(pool);
+    for (int i = 0; i < SQ_BENCH_MAX_THREADS; i++)
+        q_free(b[i].mine);
+    set_cautious_mode(true);
+    return ok && !error_check();
+}
+
+#define RCU_BENCH_LEN 1024
+#define RCU_BENCH_MAX_READERS 16
+#define RCU_BENCH_MAX_OPS 200000
+
+/* Thread of the rcubench command, walking the queue over and over, either in
+ * epochs or under the lock of the writer
+ */
+struct rcu_bench {
+    struct list_head *q;
+    ep_domain_t *ep;
+    pthread_mutex_t *lock;
+    const int *stop;
+    size_t nodes;
+    uint64_t sum;
+    pthread_t tid;
+};
+
+static void *rcu_bench_reader(void *data)
+{
+    struct rcu_bench *r = data;
+    int slot = r->ep ? ep_register(r->ep) : -1;
+    while (!__atomic_load_n(r->stop, __ATOMIC_ACQUIRE)) {
+        if (r->ep)
+            ep_enter(r->ep, slot);
+        else
+            pthread_mutex_lock(r->lock);
+        for (const struct list_head *node = ep_list_next(r->q); node != r->q;
+             node = ep_list_next(node)) {
+            r->sum += (unsigned char) list_entry(node, element_t, list)
+                          ->value[0];
+            r->nodes++;
+        }
+        if (r->ep)
+            ep_exit(r->ep, slot);
+        else
+            pthread_mutex_unlock(r->lock);
+    }
+    if (r->ep)
+        ep_unregister(r->ep, slot);
+    return NULL;
+}
+
+/* Insert at the tail and remove from the head, keeping the string now and
+ * then, or the middle of queue ops times, taking lock around every operation
+ * unless it is NULL. held tells whether the lock is taken, should an exception
+ * leave in between.
+ */
+static void rcu_bench_write(struct list_head *q,
+                            pthread_mutex_t *lock,
+                            volatile bool *held,
+                            char (*strs)[MAX_RANDSTR_LEN],
+                            size_t ops)
+{
+    for (size_t i = 0; i < ops; i++) {
+        if (lock) {
+            pthread_mutex_lock(lock);
+            *held = true;
+        }
+        q_insert_tail(q, strs[i % RCU_BENCH_LEN]);
+        if (i % 16 == 8)
+            q_release_value(q_pop_head_owned(q));
+        else if (i % 16)
+            q_retire_element(q, q_remove_head(q, NULL, 0));
+        else
+            q_delete_mid(q);
+        if (lock) {
+            *held = false;
+            pthread_mutex_unlock(lock);
+        }
+    }
+}
+
+static bool do_rcubench(int argc, char *argv[])
+{
+    size_t ops;
+    int max_readers = RCU_BENCH_MAX_READERS;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_size(argv[1], &ops) || !ops || ops > RCU_BENCH_MAX_OPS) {
+        report(1, "Invalid number of operations '%s' (1-%d)", argv[1],
+               RCU_BENCH_MAX_OPS);
+        return false;
+    }
+    if (argc == 3 && (!get_int(argv[2], &max_readers) || max_readers < 0 ||
+                      max_readers > RCU_BENCH_MAX_READERS)) {
+        report(1, "Invalid number of readers '%s' (0-%d)", argv[2],
+               RCU_BENCH_MAX_READERS);
+        return false;
+    }
+    error_check();
+
+    static char strs[RCU_BENCH_LEN][MAX_RANDSTR_LEN];
+    static ep_domain_t ep;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    struct list_head *q = NULL;
+    bool ok = true;
+    set_cautious_mode(false);
+    if (exception_setup(true)) {
+        q = q_new();
+        for (size_t i = 0; q && ok && i < RCU_BENCH_LEN; i++) {
+            fill_rand_string(strs[i], MAX_RANDSTR_LEN);
+            ok = q_insert_tail(q, strs[i]);
+        }
+        if (!q || !ok) {
+            report(1, "ERROR: Failed to allocate elements");
+            ok = false;
+        }
+    }
+    exception_cancel();
+
+    for (int readers = 0; ok && readers <= max_readers;
+         readers = readers ? 2 * readers : 1) {
+        double ns[2];
+        size_t nodes[2] = {0, 0};
+        for (int c = 0; ok && c < 2; c++) {
+            ep_init(&ep);
+            q_set_epoch(q, c ? &ep : NULL);
+            // Readers inherit the signal mask, and must leave the alarm of
+            // the harness to the writer
+            struct rcu_bench r[RCU_BENCH_MAX_READERS];
+            int stop = 0;
+            int started = 0;
+            sigset_t all, old;
+            sigfillset(&all);
+            pthread_sigmask(SIG_BLOCK, &all, &old);
+            for (; started < readers; started++) {
+                r[started] = (struct rcu_bench){.q = q,
+                                                .ep = c ? &ep : NULL,
+                                                .lock = &lock,
+                                                .stop = &stop};
+                if (pthread_create(&r[started].tid, NULL, rcu_bench_reader,
+                                   &r[started]))
+                    break;
+            }
+            pthread_sigmask(SIG_SETMASK, &old, NULL);
+            if (started < readers) {
+                report(1, "ERROR: Could only start %d readers", started);
+                ok = false;
+            }
+
+            // The readers run until they are told to stop, which the alarm
+            // cannot do, so the writer runs without a time limit, its number
+            // of operations being bounded instead
+            volatile bool held = false;
+            double t = now_ns();
+            if (ok && exception_setup(false))
+                rcu_bench_write(q, c ? NULL : &lock, &held, strs, ops);
+            else
+                ok = false;
+            exception_cancel();
+            ns[c] = now_ns() - t;
+            if (held)
+                pthread_mutex_unlock(&lock);
+
+            __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+            for (int i = 0; i < started; i++) {
+                pthread_join(r[i].tid, NULL);
+                nodes[c] += r[i].nodes;
+            }
+            ep_barrier(&ep);
+            q_set_epoch(q, NULL);
+            if (ok && q_size(q) != RCU_BENCH_LEN) {
+                report(1, "ERROR: Queue has %zu elements, expected %d",
+                       q_size(q), RCU_BENCH_LEN);
+                ok = false;
+            }
+        }
+        if (ok) {
+            report(1,
+                   "readers %2d: writer %7.2f vs %7.2f Mops/s, readers "
+                   "%8.2f vs %8.2f Mnodes/s (mutex vs epoch)",
+                   readers, ops * 1e3 / ns[0], ops * 1e3 / ns[1],
+                   nodes[0] * 1e3 / ns[0], nodes[1] * 1e3 / ns[1]);
+        }
+    }
+
+    q_free(q);
+    set_cautious_mode(true);
+    return ok && !error_check();
+}
+
+/* Check a shared queue against the queue, through two handles of it as if
+ * from two processes
+ */
+static bool do_shmq(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    if (!current || !current->q) {
+        report(3, "Warning: Calling shmq on null queue");
+        return false;
+    }
+    if (current->size >= UINT32_MAX) {
+        report(1, "Queue is too large for a shared queue");
+        return false;
+    }
+    error_check();
+
+    size_t n = current->size;
+    uint32_t max_len = 1;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        size_t len = strlen(item->value);
+        if (len > MAXSTRING) {
+            report(1, "String of %zu bytes is too long for shmq", len);
+            return false;
+        }
+        if (len > max_len)
+            max_len = len;
+    }
+
+    char name[64], buf[MAXSTRING + 2];
+    snprintf(name, sizeof(name), "/lab0-qtest-%d", (int) getpid());
+    shq_unlink(name);
+    shqueue_t *a = NULL, *b = NULL;
+    bool ok = true;
+    if (exception_setup(true)) {
+        // Room for the two strings inserted at head in the end
+        a = shq_create(name, n > 2 ? n : 2, max_len);
+        b = a ? shq_open(name) : NULL;
+        if (!a || !b) {
+            report(1, "ERROR: Failed to create shared queue %s", name);
+            ok = false;
+        }
+
+        // Fill through one handle, drain from both ends through either
+        list_for_each_entry(item, current->q, list) {
+            if (ok && !shq_insert_tail(a, item->value)) {
+                report(1, "ERROR: Failed to insert %s", item->value);
+                ok = false;
+            }
+        }
+        if (ok && shq_size(b) != n) {
+            report(1, "ERROR: Shared queue holds %u elements, expected %zu",
+                   shq_size(b), n);
+            ok = false;
+        }
+        if (ok && n >= 2 && shq_insert_head(b, "full")) {
+            report(1, "ERROR: Inserted into a full shared queue");
+            ok = false;
+        }
+        struct list_head *fwd = current->q->next, *bwd = current->q->prev;
+        for (size_t i = 0; ok && i < n; i++) {
+            bool tail = i & 1;
+            struct list_head *want = tail ? bwd : fwd;
+            bool got = tail ? shq_remove_tail(a, buf, sizeof(buf))
+                            : shq_remove_head(b, buf, sizeof(buf));
+            const char *s = list_entry(want, element_t, list)->value;
+            if (!got || strcmp(buf, s)) {
+                report(1, "ERROR: Removed %s, expected %s", got ? buf : "NULL",
+                       s);
+                ok = false;
+            }
+            if (tail)
+                bwd = bwd->prev;
+            else
+                fwd = fwd->next;
+        }
+        if (ok && (shq_remove_head(a, buf, sizeof(buf)) || shq_size(a))) {
+            report(1, "ERROR: Shared queue is not empty after removals");
+            ok = false;
+        }
+
+        // Strings longer than the slots are turned down
+        memset(buf, 'x', max_len + 1);
+        buf[max_len + 1] = '\0';
+        if (ok && shq_insert_tail(a, buf)) {
+            report(1, "ERROR: Inserted a string longer than %u bytes",
+                   max_len);
+            ok = false;
+        }
+        if (ok && (!shq_insert_head(a, "b") || !shq_insert_head(b, "a") ||
+                   !shq_remove_tail(b, buf, sizeof(buf)) || strcmp(buf, "b"))) {
+            report(1, "ERROR: Insertion at head went wrong");
+            ok = false;
+        }
+    }
+    exception_cancel();
+    shq_close(a);
+    shq_close(b);
+    shq_unlink(name);
+
+    if (ok)
+        report(2, "Moved %zu elements through shared queue %s", n, name);
+    return ok && !error_check();
+}
+
+#define SHM_BENCH_CAP 4096
+
+/* Producer process of shmbench, sending the numbers below n as strings */
+static void shm_bench_child(const char *name, int fd, size_t n, pid_t parent)
+{
+    char buf[32];
+    if (fd >= 0) {
+        FILE *f = fdopen(fd, "w");
+        for (size_t i = 0; f && i < n; i++)
+            fprintf(f, "%zu\n", i);
+        _exit(f && !fclose(f) ? 0 : 1);
+    }
+
+    shqueue_t *q = shq_open(name);
+    for (size_t i = 0; q && i < n; i++) {
+        snprintf(buf, sizeof(buf), "%zu", i);
+        while (!shq_insert_tail(q, buf)) {
+            if (getppid() != parent)
+                _exit(1);
+            sched_yield();
+        }
+    }
+    _exit(q ? 0 : 1);
+}
+
+static bool do_shmbench(int argc, char *argv[])
+{
+    size_t n;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_size(argv[1], &n) || !n) {
+        report(1, "Invalid number of messages '%s'", argv[1]);
+        return false;
+    }
+    error_check();
+
+    char name[64], buf[32];
+    snprintf(name, sizeof(name), "/lab0-qtest-%d", (int) getpid());
+    shq_unlink(name);
+    uint64_t want = 0;
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%zu", i);
+        want += hash_string(buf);
+    }
+
+    // Same messages through a shared queue, then through a pipe into a queue
+    double ns[2] = {0};
+    uint64_t sum[2] = {0};
+    size_t cnt[2] = {0};
+    bool ok = true;
+    for (int m = 0; ok && m < 2; m++) {
+        shqueue_t *q = NULL;
+        struct list_head *tmp = NULL;
+        int fds[2] = {-1, -1};
+        if (!m) {
+            q = shq_create(name, SHM_BENCH_CAP, sizeof(buf) - 1);
+            ok = q;
+        } else {
+            tmp = q_new();
+            ok = tmp && !pipe(fds);
+        }
+        pid_t pid = ok ? fork() : -1;
+        if (!pid)
+            shm_bench_child(name, fds[1], n, getppid());
+        if (fds[1] >= 0)
+            close(fds[1]);
+        if (pid < 0) {
+            report(1, "ERROR: Failed to start producer");
+            ok = false;
+        }
+
+        FILE *f = fds[0] >= 0 ? fdopen(fds[0], "r") : NULL;
+        if (n > BIG_LIST_SIZE)
+            set_cautious_mode(false);
+        if (ok && exception_setup(true)) {
+            double t = now_ns();
+            if (q) {
+                while (cnt[m] < n) {
+                    if (!shq_remove_head(q, buf, sizeof(buf))) {
+                        sched_yield();
+                        continue;
+                    }
+                    sum[m] += hash_string(buf);
+                    cnt[m]++;
+                }
+            } else {
+                while (f && fgets(buf, sizeof(buf), f)) {
+                    buf[strcspn(buf, "\n")] = '\0';
+                    if (!q_insert_tail(tmp, buf))
+                        break;
+                    cnt[m]++;
+                }
+            }
+            ns[m] = now_ns() - t;
+        } else {
+            ok = false;
+        }
+        exception_cancel();
+
+        int status = 0;
+        if (pid > 0) {
+            if (!ok || cnt[m] < n)
+                kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        }
+        if (ok && (!WIFEXITED(status) || WEXITSTATUS(status))) {
+            report(1, "ERROR: Producer failed");
+            ok = false;
+        }
+        if (tmp)
+            sum[m] = queue_sum(tmp, &cnt[m]);
+        if (ok && (cnt[m] != n || sum[m] != want)) {
+            report(1, "ERROR: Received %zu messages, expected %zu", cnt[m], n);
+            ok = false;
+        }
+        if (f)
+            fclose(f);
+        else if (fds[0] >= 0)
+            close(fds[0]);
+        q_free(tmp);
+        set_cautious_mode(true);
+        shq_close(q);
+        shq_unlink(name);
+    }
+
+    if (ok) {
+        report(1,
+               "shared queue %.2f vs pipe and insert %.2f Mmsgs/s "
+               "(%zu messages)",
+               n * 1e3 / ns[0], n * 1e3 / ns[1], n);
+    }
+    return ok && !error_check();
+}
+
+#define TRAVERSE_MAX_CURSORS 64
+
+/* Time several ways of walking the queue and reading the first byte of every
+ * string. Nodes only miss the cache when the queue is large and its order is
+ * unrelated to the allocation order, e.g. random strings after a sort.
+ */
+static bool do_traverse(int argc, char *argv[])
+{
+    int ncur = 8;
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 2 && (!get_int(argv[1], &ncur) || ncur < 1 ||
+                      ncur > TRAVERSE_MAX_CURSORS)) {
+        report(1, "Invalid number of cursors '%s' (1-%d)", argv[1],
+               TRAVERSE_MAX_CURSORS);
+        return false;
+    }
+
+    if (!current || !current->q || !current->size) {
+        report(3, "Warning: Calling traverse on null or empty queue");
+        return false;
+    }
+    error_check();
+
+    struct list_head *head = current->q;
+    size_t n = current->size;
+    if ((size_t) ncur > n)
+        ncur = n;
+
+    // Cut the queue into segments with an untimed walk
+    struct list_head *cur[TRAVERSE_MAX_CURSORS], *end[TRAVERSE_MAX_CURSORS];
+    struct list_head *node;
+    int i = 0;
+    size_t cnt = 0;
+    list_for_each(node, head) {
+        if (i < ncur && cnt == n * i / ncur)
+            cur[i++] = node;
+        cnt++;
+    }
+    for (i = 0; i < ncur; i++)
+        end[i] = i + 1 < ncur ? cur[i + 1] : head;
+
+    unsigned sink = 0;
+    size_t counted[4] = {0};
+    double ns[4];
+    element_t *e;
+    bool ok = true;
+
+    if (exception_setup(true)) {
+        double t = now_ns();
+        list_for_each_entry(e, head, list) {
+            sink += e->value[0];
+            counted[0]++;
+        }
+        ns[0] = now_ns() - t;
+
+        t = now_ns();
+        list_for_each_entry_prefetch(e, head, list) {
+            sink += e->value[0];
+            counted[1]++;
+        }
+        ns[1] = now_ns() - t;
+
+        t = now_ns();
+        counted[2] = q_size(head);
+        ns[2] = now_ns() - t;
+
+        t = now_ns();
+        list_for_each_interleaved(node, cur, end, ncur, i) {
+            sink += list_entry(node, element_t, list)->value[0];
+            counted[3]++;
+        }
+        ns[3] = now_ns() - t;
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+
+    for (i = 0; ok && i < 4; i++) {
+        if (counted[i] != n) {
+            report(1, "ERROR: Walk %d visited %zu nodes, but expected %zu", i,
+                   counted[i], n);
+            ok = false;
+        }
+    }
+    if (ok) {
+        report(1,
+               "ns/node: plain %.2f, prefetch %.2f, two-ended q_size %.2f, "
+               "%d cursors %.2f (checksum %u)",
+               ns[0] / n, ns[1] / n, ns[2] / n, ncur, ns[3] / n, sink);
+    }
+
+    return ok && !error_check();
+}
+
+/* Compare the arena queue with the expected strings after the given step */
+static bool arena_check(const iqueue_t *iq,
+                        char **model,
+                        size_t n,
+                        const char *step)
+{
+    if (iq_size(iq) != n) {
+        report(1, "ERROR: Arena queue has %u elements after %s, expected %zu",
+               iq_size(iq), step, n);
+        return false;
+    }
+    size_t i = 0;
+    uint32_t node;
+    ilist_for_each(iq->link, node, IQ_HEAD) {
+        if (strcmp(iq_value(iq, node), model[i])) {
+            report(1, "ERROR: Element %zu is %s after %s, expected %s", i,
+                   iq_value(iq, node), step, model[i]);
+            return false;
+        }
+        i++;
+    }
+    report(2, "arena: %s ok, %zu elements", step, n);
+    return true;
+}
+
+static int cmp_str_asc(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static int cmp_str_desc(const void *a, const void *b)
+{
+    return -strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static void model_reverse(char **m, size_t lo, size_t hi)
+{
+    for (; lo + 1 < hi; lo++, hi--) {
+        char *tmp = m[lo];
+        m[lo] = m[hi - 1];
+        m[hi - 1] = tmp;
+    }
+}
+
+/* Run the queue operations on an arena-backed copy of the queue, check every
+ * step against a plain array and compare the cost of a traversal.
+ */
+static bool do_arena(int argc, char *argv[])
+{
+    int k = 3;
+    if (argc != 1 && argc != 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+    if (argc == 2 && (!get_int(argv[1], &k) || k < 1)) {
+        report(1, "Invalid number of K (at least 1)");
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling arena on null queue");
+        return false;
+    }
+    // Up to three copies of the queue live in the arena at once
+    if (current->size > (UINT32_MAX - 1) / 3) {
+        report(1, "ERROR: Queue of %zu elements is too large for the arena",
+               current->size);
+        return false;
+    }
+    error_check();
+
+    size_t size = current->size, n = 0;
+    char **orig = malloc((size + 1) * sizeof(char *));
+    char **m = malloc((3 * size + 1) * sizeof(char *));
+    if (!orig || !m) {
+        free(orig);
+        free(m);
+        report(1, "Error: Failed to allocate memory");
+        return false;
+    }
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (n == size)
+            break;
+        orig[n++] = item->value;
+    }
+    memcpy(m, orig, n * sizeof(char *));
+
+    bool ok = true;
+    iqueue_t *iq = NULL;
+    char buf[MAXSTRING];
+    if (exception_setup(true)) {
+        iq = iq_new();
+        for (size_t i = 0; iq && ok && i < n; i++)
+            ok = iq_insert_tail(iq, orig[i]);
+        if (!iq || !ok) {
+            report(1, "ERROR: Failed to build arena queue");
+            ok = false;
+        }
+        ok = ok && arena_check(iq, m, n, "insert_tail");
+
+        if (ok) {
+            double t = now_ns();
+            unsigned sink = 0;
+            list_for_each_entry(item, current->q, list)
+                sink += item->value[0];
+            double ns_list = now_ns() - t;
+            t = now_ns();
+            uint32_t node;
+            ilist_for_each(iq->link, node, IQ_HEAD)
+                sink += iq_value(iq, node)[0];
+            double ns_arena = now_ns() - t;
+            report(1,
+                   "arena: %zu vs %zu bytes of links and value per node, "
+                   "walk %.2f vs %.2f ns/node (checksum %u)",
+                   sizeof(struct ilist_head) + sizeof(uint32_t),
+                   sizeof(struct list_head) + sizeof(char *),
+                   n ? ns_arena / n : 0.0, n ? ns_list / n : 0.0, sink);
+        }
+
+        if (ok) {
+            iq_reverse(iq);
+            model_reverse(m, 0, n);
+            ok = arena_check(iq, m, n, "reverse");
+        }
+        if (ok) {
+            iq_reverseK(iq, k);
+            for (size_t i = 0; k > 1 && i + k <= n; i += k)
+                model_reverse(m, i, i + k);
+            ok = arena_check(iq, m, n, "reverseK");
+        }
+        if (ok) {
+            iq_swap(iq);
+            for (size_t i = 0; i + 1 < n; i += 2)
+                model_reverse(m, i, i + 2);
+            ok = arena_check(iq, m, n, "swap");
+        }
+        if (ok && n) {
+            iq_delete_mid(iq);
+            memmove(m + n / 2, m + n / 2 + 1, (n - n / 2 - 1) * sizeof(char *));
+            ok = arena_check(iq, m, --n, "dm");
+        }
+        if (ok && n) {
+            iq_remove_head(iq, buf, sizeof(buf));
+            if (strcmp(buf, m[0])) {
+                report(1, "ERROR: Removed %s from head, expected %s", buf,
+                       m[0]);
+                ok = false;
+            }
+            memmove(m, m + 1, --n * sizeof(char *));
+            ok = ok && arena_check(iq, m, n, "rh");
+        }
+        if (ok && n) {
+            iq_remove_tail(iq, buf, sizeof(buf));
+            if (strcmp(buf, m[n - 1])) {
+                report(1, "ERROR: Removed %s from tail, expected %s", buf,
+                       m[n - 1]);
+                ok = false;
+            }
+            ok = ok && arena_check(iq, m, --n, "rt");
+        }
+        if (ok) {
+            iq_sort(iq, true);
+            qsort(m, n, sizeof(char *), cmp_str_desc);
+            ok = arena_check(iq, m, n, "sort descending");
+        }
+        if (ok) {
+            iq_sort(iq, false);
+            qsort(m, n, sizeof(char *), cmp_str_asc);
+            ok = arena_check(iq, m, n, "sort ascending");
+        }
+        if (ok) {
+            iq_delete_dup(iq);
+            size_t j = 0;
+            for (size_t i = 0; i < n;) {
+                size_t r = i + 1;
+                while (r < n && !strcmp(m[r], m[i]))
+                    r++;
+                if (r == i + 1)
+                    m[j++] = m[i];
+                i = r;
+            }
+            n = j;
+            ok = arena_check(iq, m, n, "dedup");
+        }
+        for (int pass = 0; ok && pass < 2; pass++) {
+            // Reuse the released slots and strings with the original queue
+            for (size_t i = 0; ok && i < size; i++)
+                ok = iq_insert_tail(iq, orig[i]);
+            if (!ok)
+                report(1, "ERROR: Failed to insert into arena queue");
+            memcpy(m + n, orig, size * sizeof(char *));
+            n += size;
+            if (ok) {
+                uint32_t left = pass ? iq_descend(iq) : iq_ascend(iq);
+                n = model_monotonic(m, n, pass);
+                ok = arena_check(iq, m, n, pass ? "descend" : "ascend");
+                if (ok && left != n) {
+                    report(1, "ERROR: Returned %u, but %zu elements are left",
+                           left, n);
+                    ok = false;
+                }
+            }
+        }
+    }
+    exception_cancel();
+
+    iq_free(iq);
+    free(orig);
+    free(m);
+    return ok && !error_check();
+}
+
+/* Append n keys of a hierarchy to the current queue, shaped like the object
+ * names of a multi-tenant store: region/tenant/kind/date/id
+ */
+static bool do_keys(int argc, char *argv[])
+{
+    static const char *const region[] = {"ap-south-1", "eu-central-1",
+                                         "eu-west-1", "us-east-1",
+                                         "us-west-2"};
+    static const char *const kind[] = {"events", "invoices", "orders",
+                                       "sessions", "users"};
+    size_t n = 1;
+    if (argc > 2 || (argc == 2 && (!get_size(argv[1], &n) || !n))) {
+        report(1, "%s takes an optional number of keys", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling keys on null queue");
+        return false;
+    }
+    error_check();
+
+    if (current->size + n > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    bool ok = true;
+    if (exception_setup(true)) {
+        char key[MAXSTRING];
+        for (size_t i = 0; ok && i < n; i++) {
+            snprintf(key, sizeof(key), "%s/tenant-%04d/%s/2024-%02d-%02d/%08d",
+                     region[rand() % 5], rand() % 500, kind[rand() % 5],
+                     1 + rand() % 12, 1 + rand() % 28, rand() % 100000000);
+            ok = q_insert_tail(current->q, key);
+            if (ok)
+                current->size++;
+            else
+                report(1, "ERROR: Failed to insert key %s", key);
+        }
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Print the strings of a front-coded queue the way q_show() does */
+static void fcq_show(int vlevel, const fcqueue_t *fq)
+{
+    if (verblevel < vlevel)
+        return;
+    fcq_iter_t it;
+    if (!fcq_iter_init(&it, fq))
+        return;
+    report_noreturn(vlevel, "fc = [");
+    const char *s;
+    size_t cnt = 0;
+    while (cnt < BIG_LIST_SIZE && (s = fcq_iter_next(&it)))
+        report_noreturn(vlevel, cnt++ ? " %s" : "%s", s);
+    report(vlevel, fq->size > BIG_LIST_SIZE ? " ... ]" : "]");
+    fcq_iter_end(&it);
+}
+
+/* Check the strings of a front-coded queue against the sorted model */
+static bool fcq_check(const fcqueue_t *fq, char **m, size_t n)
+{
+    fcq_iter_t it;
+    if (!fcq_iter_init(&it, fq)) {
+        report(1, "Error: Failed to allocate memory");
+        return false;
+    }
+    bool ok = fq->size == n;
+    size_t i = 0;
+    const char *s;
+    while (ok && (s = fcq_iter_next(&it))) {
+        if (i == n || strcmp(s, m[i])) {
+            report(1, "ERROR: Decoded %s at position %zu, but expected %s", s,
+                   i, i < n ? m[i] : "the end");
+            ok = false;
+        }
+        i++;
+    }
+    if (ok && i != n) {
+        report(1, "ERROR: Decoded %zu strings, but expected %zu", i, n);
+        ok = false;
+    }
+    fcq_iter_end(&it);
+    return ok;
+}
+
+/* Compress a sorted copy of the current queue by front coding, compare its
+ * memory and the cost of a walk with a plain sorted queue, then empty it from
+ * the head, checking every string against a sorted array.
+ */
+static bool do_frontcode(int argc, char *argv[])
+{
+    size_t block = 16;
+    if (argc > 2 || (argc == 2 && (!get_size(argv[1], &block) || !block))) {
+        report(1, "%s takes an optional number of strings per block",
+               argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling frontcode on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t size = current->size, n = 0;
+    char **m = malloc((size + 1) * sizeof(char *));
+    if (!m) {
+        report(1, "Error: Failed to allocate memory");
+        return false;
+    }
+    size_t plain = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list) {
+        if (n == size)
+            break;
+        m[n++] = item->value;
+        plain += sizeof(element_t) + strlen(item->value) + 1;
+    }
+    qsort(m, n, sizeof(char *), cmp_value);
+
+    if (n > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    bool ok = true, done = false;
+    struct list_head *copy = NULL;
+    fcqueue_t *fq = NULL;
+    char buf[MAXSTRING];
+    if (exception_setup(true)) {
+        copy = q_new();
+        ok = copy;
+        list_for_each_entry(item, current->q, list) {
+            if (!ok || !(ok = q_insert_tail(copy, item->value)))
+                break;
+        }
+        if (ok) {
+            q_sort(copy, descend);
+            double t = now_ns();
+            uint64_t sum_list = 0, sum_fc = 0;
+            list_for_each_entry(item, copy, list)
+                sum_list ^= hash_string(item->value);
+            double ns_list = now_ns() - t;
+
+            fq = fcq_from_sorted(copy, descend, block);
+            ok = fq && list_empty(copy);
+            fcq_iter_t it;
+            if (ok && fcq_iter_init(&it, fq)) {
+                const char *s;
+                t = now_ns();
+                while ((s = fcq_iter_next(&it)))
+                    sum_fc ^= hash_string(s);
+                double ns_fc = now_ns() - t;
+                fcq_iter_end(&it);
+                report(1,
+                       "frontcode: %zu vs %zu bytes (%.1f%%), walk %.2f vs "
+                       "%.2f ns/string (checksum %s)",
+                       fq->bytes, plain, plain ? 100.0 * fq->bytes / plain : 0,
+                       n ? ns_fc / n : 0.0, n ? ns_list / n : 0.0,
+                       sum_fc == sum_list ? "ok" : "MISMATCH");
+                ok = sum_fc == sum_list;
+            } else {
+                report(1, "ERROR: Failed to build front-coded queue");
+                ok = false;
+            }
+        }
+        ok = ok && fcq_check(fq, m, n);
+        if (ok)
+            fcq_show(3, fq);
+
+        // Empty it from the head, checking what is left now and then
+        size_t step = n / 16 + 1;
+        for (size_t i = 0; ok && i < n; i++) {
+            if (!fcq_remove_head(fq, buf, sizeof(buf)) || strcmp(buf, m[i])) {
+                report(1, "ERROR: Removed %s at position %zu, but expected %s",
+                       buf, i, m[i]);
+                ok = false;
+            } else if (i % step == 0 || n - i < 3) {
+                ok = fcq_check(fq, m + i + 1, n - i - 1);
+            }
+        }
+        if (ok && (fq->size || fcq_remove_head(fq, buf, sizeof(buf)))) {
+            report(1, "ERROR: Front-coded queue is not empty");
+            ok = false;
+        }
+        done = true;
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+
+    // Both may be half-way through an operation after an exception
+    if (done) {
+        fcq_free(fq);
+        q_free(copy);
+    }
+    set_cautious_mode(true);
+    free(m);
+    return ok && !error_check();
+}
+
+/* Order-sensitive fingerprint of the strings of the current queue */
+static uint64_t queue_fingerprint(size_t *cnt)
+{
+    uint64_t h = 0;
+    element_t *item;
+    *cnt = 0;
+    list_for_each_entry(item, current->q, list) {
+        h = (h ^ hash_string(item->value)) * 0x100000001b3ULL;
+        (*cnt)++;
+    }
+    return h;
+}
+
+static bool do_compact(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
 
     if (!current || !current->q) {
-        report(3, "Warning: Calling descend on null queue");
+        report(3, "Warning: Calling compact on null queue");
         return false;
     }
     error_check();
 
+    size_t cnt_before, cnt_after;
+    uint64_t before = queue_fingerprint(&cnt_before);
 
-    int cnt = q_size(current->q);
-    if (!cnt)
-        report(3, "Warning: Calling descend on empty queue");
-    else if (cnt < 2)
-        report(3, "Warning: Calling descend on single node");
-    error_check();
-
+    if (current->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    bool ok = false;
+    double t = now_ns();
     if (exception_setup(true))
-        current->size = q_descend(current->q);
-    set_noallocate_mode(false);
+        ok = q_compact(current->q);
+    exception_cancel();
+    t = now_ns() - t;
+    set_cautious_mode(true);
 
-    bool ok = true;
+    if (!ok)
+        report(1, "Compaction failed, queue is partially compacted");
+    else
+        report(2, "Compacted %zu elements in %.2f ms", current->size, t / 1e6);
 
-    cnt = current->size;
-    if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
-                report(1,
-                       "ERROR: At least one node violated the ordering rule");
-                ok = false;
-                break;
-            }
-        }
+    if (queue_fingerprint(&cnt_after) != before || cnt_after != cnt_before) {
+        report(1, "ERROR: Compaction changed the contents of the queue");
+        ok = false;
     }
 
     q_show(3);
     return ok && !error_check();
 }
 
-static bool do_reverseK(int argc, char *argv[])
+/* Count the lines of a file, add their hashes to sum and count the lines out
+ * of order. Return false if the file cannot be opened.
+ */
+static bool file_lines(const char *path,
+                       size_t *lines,
+                       uint64_t *sum,
+                       size_t *unsorted)
+{
+    FILE *in = fopen(path, "r");
+    if (!in)
+        return false;
+    char line[2][MAXSTRING + 2];
+    size_t n = 0;
+    *unsorted = 0;
+    while (fgets(line[n & 1], sizeof(line[0]), in)) {
+        char *s = line[n & 1];
+        s[strcspn(s, "\n")] = '\0';
+        *sum += hash_string(s);
+        if (n) {
+            int cmp = strcmp(line[(n - 1) & 1], s);
+            if (descend ? cmp < 0 : cmp > 0)
+                (*unsorted)++;
+        }
+        n++;
+    }
+    fclose(in);
+    *lines = n;
+    return true;
+}
+
+static bool do_sortto(int argc, char *argv[])
 {
-    int k = 0;
+    if (argc != 2) {
+        report(1, "%s needs a file name", argv[0]);
+        return false;
+    }
 
     if (!current || !current->q) {
-        report(3, "Warning: Calling reverseK on null queue");
+        report(3, "Warning: Calling sortto on null queue");
         return false;
     }
     error_check();
 
-    if (argc == 2) {
-        if (!get_int(argv[1], &k) || k < 1) {
-            report(1, "Invalid number of K (at least 1)");
-            return false;
-        }
-    } else {
-        report(1, "Invalid number of arguments for reverseK");
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        report(1, "ERROR: Could not open '%s' for writing", argv[1]);
         return false;
     }
 
-    set_noallocate_mode(true);
+    // The file must hold the same strings, so their hashes must cancel out
+    size_t cnt = current->size;
+    uint64_t sum = 0;
+    element_t *item;
+    list_for_each_entry(item, current->q, list)
+        sum -= hash_string(item->value);
+
+    if (current->size > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    bool ok = false;
+    double t = now_ns();
     if (exception_setup(true))
-        q_reverseK(current->q, k);
+        ok = q_sort_external(current->q, descend, spill > 0 ? spill : cnt,
+                             out);
     exception_cancel();
+    t = now_ns() - t;
+    set_cautious_mode(true);
+    ok = !fclose(out) && ok;
+    current->size = q_size(current->q);
+
+    if (!ok) {
+        report(1, "ERROR: Failed to write the strings to '%s'", argv[1]);
+        return false;
+    }
+    report(2, "Wrote %zu strings to '%s' in %.2f ms", cnt, argv[1], t / 1e6);
+
+    size_t lines, unsorted;
+    if (!file_lines(argv[1], &lines, &sum, &unsorted)) {
+        report(1, "ERROR: Could not open '%s' for reading", argv[1]);
+        return false;
+    }
+    if (unsorted) {
+        report(1, "ERROR: '%s' is not sorted", argv[1]);
+        ok = false;
+    } else if (lines != cnt || sum) {
+        report(1, "ERROR: '%s' does not hold the strings of the queue",
+               argv[1]);
+        ok = false;
+    }
 
-    set_noallocate_mode(false);
     q_show(3);
-    return !error_check();
+    return ok && !error_check();
 }
 
-static bool do_merge(int argc, char *argv[])
+static bool do_mergefiles(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    const char *out_path = NULL;
+    int first = 1;
+    if (argc > 2 && !strcmp(argv[1], "-o")) {
+        out_path = argv[2];
+        first = 3;
+    }
+    if (first >= argc) {
+        report(1, "%s needs [-o file] and at least one file", argv[0]);
         return false;
     }
 
-    if (!current || !current->q) {
-        report(3, "Warning: Calling merge on null queue");
+    if (!out_path && (!current || !current->q)) {
+        report(3, "Warning: Calling mergefiles on null queue");
         return false;
     }
     error_check();
 
-    int len = 0;
-    set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        len = q_merge(&chain.head, descend);
+    // The output must hold the strings of the inputs, so their hashes must
+    // cancel out
+    uint64_t sum = 0;
+    size_t lines = 0, unsorted = 0;
+    for (int i = first; i < argc; i++) {
+        uint64_t file_sum = 0;
+        size_t n, bad;
+        if (!file_lines(argv[i], &n, &file_sum, &bad)) {
+            report(1, "ERROR: Could not open '%s' for reading", argv[i]);
+            return false;
+        }
+        if (bad)
+            report(1, "Warning: '%s' is not sorted", argv[i]);
+        sum -= file_sum;
+        lines += n;
+        unsorted += bad;
+    }
+
+    FILE *out = NULL;
+    if (out_path && !(out = fopen(out_path, "w"))) {
+        report(1, "ERROR: Could not open '%s' for writing", out_path);
+        return false;
+    }
+    struct list_head *last = out ? NULL : current->q->prev;
+
+    if (lines > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    size_t cnt = 0;
+    bool ok = false;
+    double t = now_ns();
+    if (exception_setup(true))
+        ok = fm_merge((const char *const *) argv + first, argc - first,
+                      descend, out ? NULL : current->q, out, &cnt);
     exception_cancel();
-    set_noallocate_mode(false);
+    t = now_ns() - t;
+    set_cautious_mode(true);
+    if (out)
+        ok = !fclose(out) && ok;
+    else
+        current->size = q_size(current->q);
+
+    if (!ok) {
+        report(1, "ERROR: Failed to merge the files");
+        q_show(3);
+        return false;
+    }
+    report(2, "Merged %zu strings from %d files in %.2f ms", cnt, argc - first,
+           t / 1e6);
+
+    size_t bad = 0;
+    if (out) {
+        size_t n = 0;
+        if (!file_lines(out_path, &n, &sum, &bad)) {
+            report(1, "ERROR: Could not open '%s' for reading", out_path);
+            ok = false;
+        } else if (n != lines) {
+            report(1, "ERROR: '%s' holds %zu strings instead of %zu", out_path,
+                   n, lines);
+            ok = false;
+        }
+    } else {
+        const char *prev = NULL;
+        for (struct list_head *p = last->next; p != current->q; p = p->next) {
+            const char *s = list_entry(p, element_t, list)->value;
+            sum += hash_string(s);
+            if (prev) {
+                int cmp = strcmp(prev, s);
+                if (descend ? cmp < 0 : cmp > 0)
+                    bad++;
+            }
+            prev = s;
+        }
+    }
+    if (ok && (cnt != lines || sum)) {
+        report(1, "ERROR: The strings merged differ from those of the files");
+        ok = false;
+    }
+    if (ok && bad && !unsorted) {
+        report(1, "ERROR: Merging sorted files gave unsorted strings");
+        ok = false;
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
 
+/* Free the queues merged into the first one, holding len elements now */
+static void collapse_chain(size_t len)
+{
     if (q_size(&chain.head) > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
@@ -878,6 +3909,29 @@ static bool do_merge(int argc, char *argv[])
         chain.head.prev = &current->chain;
         current->chain.next = &chain.head;
     }
+}
+
+static bool do_merge(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling merge on null queue");
+        return false;
+    }
+    error_check();
+
+    size_t len = 0;
+    set_noallocate_mode(true);
+    if (current && exception_setup(true))
+        len = q_merge(&chain.head, descend);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    collapse_chain(len);
 
     bool ok = true;
     if (current && current->size) {
@@ -913,26 +3967,278 @@ static bool do_merge(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Integers the generic path of the _by operations compares through function
+ * pointers, as the numeric order built in does inline
+ */
+static void order_key_gnum(q_key_t *k, const char *s, void *arg)
+{
+    k->num = strtoll(s, NULL, 10);
+}
+
+static int order_cmp_gnum(const q_key_t *a, const q_key_t *b, void *arg)
+{
+    return (a->num > b->num) - (a->num < b->num);
+}
+
+static const q_order_t order_gnum = {order_key_gnum, order_cmp_gnum, NULL};
+
+/* Orders of the by command, NULL standing for strcmp() */
+static const struct {
+    const char *name;
+    const q_order_t *ord;
+} by_orders[] = {
+    {"str", NULL},
+    {"num", &q_order_numeric},
+    {"len", &q_order_length},
+    {"fold", &q_order_casefold},
+    {"gnum", &order_gnum},
+};
+
+/* Order the models of the by command are checked in */
+static const q_order_t *by_order;
+
+static int by_cmp(const char *a, const char *b)
+{
+    if (!by_order)
+        return strcmp(a, b);
+    q_key_t ka = {.str = a}, kb = {.str = b};
+    if (by_order->key) {
+        by_order->key(&ka, a, by_order->arg);
+        by_order->key(&kb, b, by_order->arg);
+    }
+    return by_order->cmp(&ka, &kb, by_order->arg);
+}
+
+/* Element and its position in the queues before the operation */
+struct by_item {
+    element_t *e;
+    size_t pos;
+};
+
+/* Stable order of the by command, honouring descend */
+static int by_item_cmp(const void *a, const void *b)
+{
+    const struct by_item *x = a, *y = b;
+    int cmp = by_cmp(x->e->value, y->e->value);
+    if (cmp)
+        return descend ? -cmp : cmp;
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+/* Insert random integers of up to 9 digits, a quarter of them negative */
+static bool do_nums(int argc, char *argv[])
+{
+    size_t n = 1;
+    if (argc > 2 || (argc == 2 && (!get_size(argv[1], &n) || !n))) {
+        report(1, "%s takes an optional number of integers", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling nums on null queue");
+        return false;
+    }
+    error_check();
+
+    if (current->size + n > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    bool ok = true;
+    if (exception_setup(true)) {
+        char num[16];
+        for (size_t i = 0; ok && i < n; i++) {
+            int mod = 10;
+            for (int digits = rand() % 9; digits > 0; digits--)
+                mod *= 10;
+            snprintf(num, sizeof(num), "%s%d", rand() % 4 ? "" : "-",
+                     rand() % mod);
+            ok = q_insert_tail(current->q, num);
+            if (ok)
+                current->size++;
+            else
+                report(1, "ERROR: Failed to insert integer %s", num);
+        }
+    }
+    exception_cancel();
+    set_cautious_mode(true);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Run sort, merge, ascend, descend or dedup in the order given by name, and
+ * check the elements left, in order, against a model
+ */
+static bool do_by(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs an order and an operation", argv[0]);
+        return false;
+    }
+    const q_order_t *ord = NULL;
+    size_t o = 0, norders = sizeof(by_orders) / sizeof(by_orders[0]);
+    while (o < norders && strcmp(argv[1], by_orders[o].name))
+        o++;
+    if (o == norders) {
+        report(1, "Unknown order '%s' (str, num, len, fold or gnum)", argv[1]);
+        return false;
+    }
+    ord = by_orders[o].ord;
+    const char *op = argv[2];
+    bool merge = !strcmp(op, "merge");
+    if (!merge && strcmp(op, "sort") && strcmp(op, "ascend") &&
+        strcmp(op, "descend") && strcmp(op, "dedup")) {
+        report(1, "Unknown operation '%s'", op);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling by on null queue");
+        return false;
+    }
+    error_check();
+
+    // Elements of the queues taking part, in order
+    size_t cnt = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry(ctx, &chain.head, chain) {
+        if (merge || ctx == current)
+            cnt += q_size(ctx->q);
+    }
+    struct by_item *m = malloc(sizeof(struct by_item) * (cnt ? cnt : 1));
+    if (!m) {
+        report(1, "Error: Failed to allocate memory");
+        return false;
+    }
+    by_order = ord;
+    size_t n = 0;
+    bool sorted = true;
+    list_for_each_entry(ctx, &chain.head, chain) {
+        if (!merge && ctx != current)
+            continue;
+        element_t *item;
+        list_for_each_entry(item, ctx->q, list) {
+            m[n].e = item;
+            m[n].pos = n;
+            if (merge && &item->list != ctx->q->next) {
+                int cmp = by_cmp(m[n - 1].e->value, item->value);
+                sorted &= descend ? cmp >= 0 : cmp <= 0;
+            }
+            n++;
+        }
+    }
+    if (merge && !sorted)
+        report(1, "Warning: Merging queues not sorted in this order");
+
+    // The model: a stable sort, or the elements the operation keeps
+    if (merge || !strcmp(op, "sort")) {
+        qsort(m, n, sizeof(struct by_item), by_item_cmp);
+    } else if (!strcmp(op, "dedup")) {
+        size_t keep = 0;
+        for (size_t i = 0, j; i < n; i = j) {
+            for (j = i + 1; j < n && !by_cmp(m[i].e->value, m[j].e->value);)
+                j++;
+            if (j == i + 1)
+                m[keep++] = m[i];
+        }
+        n = keep;
+    } else {
+        bool down = !strcmp(op, "descend");
+        size_t keep = n;
+        for (size_t i = n; i-- > 0;) {
+            int cmp = keep == n ? 0 : by_cmp(m[i].e->value, m[keep].e->value);
+            if (!(down ? cmp < 0 : cmp > 0))
+                m[--keep] = m[i];
+        }
+        memmove(m, m + keep, (n - keep) * sizeof(struct by_item));
+        n -= keep;
+    }
+
+    if (cnt > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    bool ok = true;
+    size_t left = 0;
+    double t = now_ns();
+    if (exception_setup(true)) {
+        if (merge)
+            left = q_merge_by(&chain.head, descend, ord);
+        else if (!strcmp(op, "sort"))
+            q_sort_by(current->q, descend, ord);
+        else if (!strcmp(op, "ascend"))
+            left = q_ascend_by(current->q, ord);
+        else if (!strcmp(op, "descend"))
+            left = q_descend_by(current->q, ord);
+        else
+            ok = q_delete_dup_by(current->q, ord) || !cnt;
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+    t = now_ns() - t;
+    set_cautious_mode(true);
+    by_order = NULL;
+
+    if (merge) {
+        collapse_chain(left);
+    } else {
+        current->size = q_size(current->q);
+        if (!ok)
+            report(1, "ERROR: %s by %s failed", op, argv[1]);
+        else if (strcmp(op, "sort") && strcmp(op, "dedup") && left != n)
+            report(1, "ERROR: %s returned %zu, but %zu elements are left", op,
+                   left, n);
+        ok = ok && (!strcmp(op, "sort") || !strcmp(op, "dedup") || left == n);
+    }
+
+    // Queues merged out of order end up in no order the model can tell
+    if (ok && merge && !sorted && current->size != n) {
+        report(1, "ERROR: Merged %zu elements out of %zu", current->size, n);
+        ok = false;
+    } else if (ok && (!merge || sorted)) {
+        size_t i = 0;
+        element_t *item;
+        list_for_each_entry(item, current->q, list) {
+            if (i == n || item != m[i].e)
+                break;
+            i++;
+        }
+        if (i != n || &item->list != current->q) {
+            report(1, "ERROR: Element at position %zu is not the expected one",
+                   i);
+            ok = false;
+        }
+    }
+    if (ok)
+        report(1, "%s by %s: %zu elements in %.2f ms", op, argv[1], n,
+               t / 1e6);
+    free(m);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool is_circular()
 {
+    // Check both directions in the same loop, so that the two walks overlap
+    // their cache misses instead of paying for them one after the other
     struct list_head *cur = current->q->next;
     struct list_head *fast = (cur) ? cur->next : NULL;
-    while (cur != current->q) {
-        if (!cur || !fast || !fast->next)
-            return false;
-        if (cur == fast)
-            return false;
-        cur = cur->next;
-        fast = fast->next->next;
-    }
-
-    cur = current->q->prev;
-    fast = (cur) ? cur->prev : NULL;
-    while (cur != current->q) {
-        if (!cur || !fast || !fast->prev)
-            return false;
-        cur = cur->prev;
-        fast = fast->prev->prev;
+    struct list_head *rcur = current->q->prev;
+    struct list_head *rfast = (rcur) ? rcur->prev : NULL;
+    while (cur != current->q || rcur != current->q) {
+        if (cur != current->q) {
+            if (!cur || !fast || !fast->next)
+                return false;
+            if (cur == fast)
+                return false;
+            cur = cur->next;
+            fast = fast->next->next;
+        }
+        if (rcur != current->q) {
+            if (!rcur || !rfast || !rfast->prev)
+                return false;
+            rcur = rcur->prev;
+            rfast = rfast->prev->prev;
+        }
     }
     return true;
 }
@@ -943,7 +4249,7 @@ static bool q_show(int vlevel)
     if (verblevel < vlevel)
         return true;
 
-    int cnt = 0;
+    size_t cnt = 0;
     if (!current || !current->q) {
         report(vlevel, "l = NULL");
         return true;
@@ -989,7 +4295,7 @@ static bool q_show(int vlevel)
             report(vlevel, " ... ]");
     } else {
         report(vlevel, " ... ]");
-        report(vlevel, "ERROR:  Queue has more than %d elements",
+        report(vlevel, "ERROR:  Queue has more than %zu elements",
                current->size);
         ok = false;
     }
@@ -1056,6 +4362,12 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+static void set_spill(int oldval)
+{
+    (void) oldval;
+    q_sort_set_spill(spill > 0 ? spill : 0);
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1078,32 +4390,161 @@ static void console_init()
         rt,
         "Remove from tail of queue. Optionally compare to expected value str",
         "[str]");
+    ADD_COMMAND(peek,
+                "Show the string at end (head or tail, default: head) of "
+                "queue without copying it. Optionally compare to expected "
+                "value str",
+                "[end] [str]");
+    ADD_COMMAND(pop,
+                "Remove from end (head or tail, default: head) of queue, "
+                "taking its string without copying. Optionally compare to "
+                "expected value str",
+                "[end] [str]");
+    ADD_COMMAND(move,
+                "Move the first n elements of queue to the end of queue id",
+                "n id");
+    ADD_COMMAND(splice,
+                "Move elements a to b of queue in front of element pos of "
+                "queue id (default: at its end)",
+                "a b id [pos]");
     ADD_COMMAND(reverse, "Reverse queue", "");
-    ADD_COMMAND(sort, "Sort queue in ascending/descending order", "");
+    ADD_COMMAND(sort,
+                "Sort queue in ascending/descending order, in the background "
+                "with &",
+                "[&]");
+    ADD_COMMAND(wait, "Wait for the background sort to finish", "");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
+    ADD_COMMAND(by,
+                "Sort, merge, ascend, descend or dedup in order str, num, "
+                "len, fold or gnum (num through function pointers)",
+                "order op");
+    ADD_COMMAND(nums, "Insert n random integers at tail (default: n == 1)",
+                "[n]");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(ascend,
                 "Remove every node which has a node with a strictly less "
-                "value anywhere to the right side of it",
-                "");
+                "value anywhere to the right side of it, or copy the others "
+                "to a new queue or visit them",
+                "[copy|each]");
     ADD_COMMAND(descend,
                 "Remove every node which has a node with a strictly greater "
-                "value anywhere to the right side of it",
+                "value anywhere to the right side of it, or copy the others "
+                "to a new queue or visit them",
+                "[copy|each]");
+    ADD_COMMAND(reverseK,
+                "Reverse the nodes of the queue 'K' at a time, locating W "
+                "groups per step if given",
+                "[K] [W]");
+    ADD_COMMAND(topk,
+                "Move the K smallest/largest nodes in order to the front of "
+                "queue",
+                "K");
+    ADD_COMMAND(kth, "Find the node of rank K in ascending/descending order",
+                "K");
+    ADD_COMMAND(index, "Attach a hash index on strings to queue", "");
+    ADD_COMMAND(contains,
+                "Check n times whether queue contains str (default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(keys,
+                "Insert n hierarchical keys at tail of queue (default: n == "
+                "1)",
+                "[n]");
+    ADD_COMMAND(frontcode,
+                "Compress a sorted copy of queue by front coding in blocks of "
+                "n strings and compare it with the plain queue (default: n "
+                "== 16)",
+                "[n]");
+    ADD_COMMAND(filter, "Attach a membership filter on strings to queue",
+                "");
+    ADD_COMMAND(maybe,
+                "Check n times whether queue may contain str (default: n == "
+                "1)",
+                "str [n]");
+    ADD_COMMAND(fprate,
+                "Look up n random strings through the filter of queue and "
+                "count the false positives (default: n == 10000)",
+                "[n]");
+    ADD_COMMAND(defer,
+                "Defer freeing deleted nodes until limit of them are waiting "
+                "(default: until reap, 0 frees them at once)",
+                "[limit]");
+    ADD_COMMAND(reap, "Free the nodes deleted from queue so far", "");
+    ADD_COMMAND(deferbench,
+                "Time dedup and descend on n strings, freeing deleted nodes "
+                "at once against deferring them",
+                "n");
+    ADD_COMMAND(count, "Count the nodes holding str", "str");
+    ADD_COMMAND(delval, "Delete all nodes holding str", "str");
+    ADD_COMMAND(pq_insert,
+                "Insert string str into priority queue n times. Generate "
+                "random string(s) if str equals RAND. (default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(pq_pop,
+                "Remove n smallest strings from priority queue (default: n "
+                "== 1)",
+                "[n]");
+    ADD_COMMAND(pq_meld, "Move all nodes of queue into priority queue", "");
+    ADD_COMMAND(shard,
+                "Move queue through a sharded queue with n shards, round-robin "
+                "or by hash, and sort it back",
+                "n [hash]");
+    ADD_COMMAND(sqbench,
+                "Time pushes and pops of n elements by 1 to 64 threads, one "
+                "lock against sharded (default: 16 shards)",
+                "n [shards]");
+    ADD_COMMAND(rcubench,
+                "Time n (at most 200000) inserts and removals by a writer "
+                "while 0 to readers threads (default: 16) walk the queue, "
+                "mutex against epochs",
+                "n [readers]");
+    ADD_COMMAND(shmq,
+                "Move queue through a shared memory queue and check it", "");
+    ADD_COMMAND(shmbench,
+                "Time n messages from another process, through a shared "
+                "memory queue against a pipe",
+                "n");
+    ADD_COMMAND(pfor,
+                "Split queue into parts (default: 4) and apply op (upper, "
+                "lower, hash or copy) to the pieces on multiple threads",
+                "op [parts]");
+    ADD_COMMAND(tpsum,
+                "Hash queue by splitting it in halves down to grain elements "
+                "(default: 64), as tasks of the pool grown to n threads",
+                "[n] [grain]");
+    ADD_COMMAND(traverse,
+                "Measure ns/node of plain, prefetching, two-ended and "
+                "interleaved walks with n cursors (default: 8)",
+                "[n]");
+    ADD_COMMAND(compact, "Reallocate nodes and strings of queue in list order",
                 "");
-    ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
+    ADD_COMMAND(sortto,
+                "Sort queue through runs on disk into file, emptying queue",
+                "file");
+    ADD_COMMAND(mergefiles,
+                "Merge sorted files of strings, one per line, at the tail of "
+                "queue, or into file f with -o",
+                "[-o f] files");
+    ADD_COMMAND(arena,
+                "Check queue operations on an arena-backed copy of queue with "
+                "32-bit links, using K for reverseK (default: 3)",
                 "[K]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("timeout", &time_limit,
+              "Seconds each queue operation may take (0: no limit)", NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("spill", &spill,
+              "Sort queues longer than this through runs on disk (0: never)",
+              set_spill);
 }
 
 /* Signal handlers */
@@ -1129,14 +4570,19 @@ static void q_init()
 {
     fail_count = 0;
     INIT_LIST_HEAD(&chain.head);
+    pq_init(&pq);
     signal(SIGSEGV, sigsegv_handler);
     signal(SIGALRM, sigalrm_handler);
 }
 
 static bool q_quit(int argc, char *argv[])
 {
+    // A sort left running in the background is simply dropped
+    bool ok = !bg_sort.failed;
+    bg_sort.ctx = NULL;
+
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
+    if ((current && current->size > BIG_LIST_SIZE) || pq.size > BIG_LIST_SIZE)
         set_cautious_mode(false);
 
     if (exception_setup(true)) {
@@ -1148,6 +4594,7 @@ static bool q_quit(int argc, char *argv[])
             free(qctx);
             chain.size--;
         }
+        pq_free(&pq);
     }
 
     exception_cancel();
@@ -1160,7 +4607,7 @@ static bool q_quit(int argc, char *argv[])
         return false;
     }
 
-    return true;
+    return ok;
 }
 
 static void usage(char *cmd)
@@ -1436,6 +4883,8 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(q_quit);
+    set_idle_helper(bg_sort_slice);
+    set_pre_cmd_helper(bg_sort_sync);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
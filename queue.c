@@ -1,8 +1,13 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h> /* strcasecmp */
 
+#include "hash.h"
+#include "losertree.h"
 #include "queue.h"
+#include "tpool.h"
 
 /* Convert a list_head pointer to its containing element_t pointer */
 static element_t *list_to_element(struct list_head *pos)
@@ -12,55 +17,564 @@ static element_t *list_to_element(struct list_head *pos)
     return (element_t *) ((char *) pos - offsetof(element_t, list));
 }
 
-static void merge_two(struct list_head *ha, struct list_head *hb, bool descend)
+/* Order known to hold for every pair of adjacent elements in a queue */
+#define Q_ASCEND (1U << 0)
+#define Q_DESCEND (1U << 1)
+#define Q_ORDERED (Q_ASCEND | Q_DESCEND)
+
+struct qfilter;
+
+/* Queue header handed out by q_new(). The list head must stay the first
+ * member, since callers only ever see a pointer to it. @buckets is NULL until
+ * q_index() attaches a hash index with 2^@hash_bits buckets to the queue, and
+ * @filter is NULL until q_filter() attaches a membership filter. @ep is NULL
+ * unless q_set_epoch() lets readers in, in which case deleted elements are
+ * retired to it rather than freed. Otherwise, if @grave_limit is not 0, they
+ * are pushed onto @grave, which is freed as a whole once it holds
+ * @grave_limit of them.
+ */
+typedef struct {
+    struct list_head head;
+    unsigned int flags;
+    struct hlist_head *buckets;
+    unsigned int hash_bits;
+    size_t hashed;
+    struct qfilter *filter;
+    ep_domain_t *ep;
+    struct ep_node *grave;
+    size_t buried;
+    size_t grave_limit;
+} queue_head_t;
+
+/* Convert a queue head returned by q_new() to its queue_head_t */
+static inline queue_head_t *to_qhead(struct list_head *head)
 {
-    struct list_head *a, *b, *c;
-    a = ha->next;
-    b = hb->next;
-    c = ha;
+    return container_of(head, queue_head_t, head);
+}
 
-    // Merge two sorted queeus into ha
-    while (a != ha && b != hb) {
-        const element_t *ae = list_to_element(a);
-        const element_t *be = list_to_element(b);
-        // Compare based on ascend/descend order
-        bool de = descend ? strcmp(ae->value, be->value) >= 0
-                          : strcmp(ae->value, be->value) <= 0;
-        if (de) {
-            c->next = a;
-            a->prev = c;
-            a = a->next;
-        } else {
-            c->next = b;
-            b->prev = c;
-            b = b->next;
-        }
-        c = c->next;
-    }
-    // Link remaining nodes
-    if (a == ha) {
-        c->next = b;
-        b->prev = c;
-        hb->prev->next = ha;
-        ha->prev = hb->prev;
-    } else {
-        c->next = a;
-        a->prev = c;
+#define INDEX_MIN_BITS 4
+#define INDEX_MAX_BITS 28
+
+/* Bucket of the hash index where string s goes */
+static inline struct hlist_head *index_bucket(const queue_head_t *q,
+                                              const char *s)
+{
+    uint64_t h = hash_string(s) * 0x61C8864680B583EBULL;
+    return &q->buckets[h >> (64 - q->hash_bits)];
+}
+
+/* Link an element into the hash index without ever resizing it */
+static inline void index_link(queue_head_t *q, element_t *e)
+{
+    hlist_add_head(&e->hash, index_bucket(q, e->value));
+    q->hashed++;
+}
+
+/* Relink every element of queue into its current buckets */
+static void index_rehash(queue_head_t *q)
+{
+    for (size_t i = 0; i < (size_t) 1 << q->hash_bits; i++)
+        INIT_HLIST_HEAD(&q->buckets[i]);
+    q->hashed = 0;
+
+    element_t *e;
+    list_for_each_entry_prefetch(e, &q->head, list)
+        index_link(q, e);
+}
+
+/* Rebuild the hash index of queue with 2^bits buckets */
+static bool index_resize(queue_head_t *q, unsigned int bits)
+{
+    struct hlist_head *buckets = malloc(sizeof(struct hlist_head) << bits);
+    if (!buckets)
+        return false;
+    for (size_t i = 0; i < (size_t) 1 << bits; i++)
+        INIT_HLIST_HEAD(&buckets[i]);
+    free(q->buckets);
+    q->buckets = buckets;
+    q->hash_bits = bits;
+    index_rehash(q);
+    return true;
+}
+
+/* Blocked Bloom filter: every string sets FILTER_K bits of a single block,
+ * which is one cache line, so that a lookup touches one line of memory. The
+ * filter is built for twice the size of the queue at FILTER_BITS bits per
+ * element, and gets rebuilt on the next lookup once it is full, once more than
+ * half the strings it holds have left, or once elements have come in without
+ * being added to it.
+ */
+#define FILTER_WORDS 8
+#define FILTER_K 6
+#define FILTER_BITS 8
+
+struct qfilter {
+    uint64_t (*block)[FILTER_WORDS];
+    void *mem;      /* allocation @block is aligned in */
+    size_t nblocks;
+    size_t added;   /* strings set since the filter was built */
+    size_t removed; /* elements gone since */
+    bool stale;     /* some element may be missing from the filter */
+};
+
+/* Number of strings a filter holds before it needs to grow */
+static inline size_t filter_capacity(const struct qfilter *f)
+{
+    return f->nblocks * FILTER_WORDS * 64 / FILTER_BITS;
+}
+
+/* Find the block of a string and the bits it sets there, packed 9 at a time */
+static inline const uint64_t *filter_probe(const struct qfilter *f,
+                                           const char *s,
+                                           uint64_t *bits)
+{
+    uint64_t h = hash_string(s);
+    *bits = (h ^ (h >> 31)) * 0x9E3779B97F4A7C15ULL;
+    return f->block[((h >> 32) * f->nblocks) >> 32];
+}
+
+static void filter_set(struct qfilter *f, const char *s)
+{
+    uint64_t bits;
+    uint64_t *b = (uint64_t *) filter_probe(f, s, &bits);
+    for (int i = 0; i < FILTER_K; i++, bits >>= 9)
+        b[(bits >> 6) & 7] |= 1ULL << (bits & 63);
+    f->added++;
+}
+
+static bool filter_test(const struct qfilter *f, const char *s)
+{
+    uint64_t bits;
+    const uint64_t *b = filter_probe(f, s, &bits);
+    for (int i = 0; i < FILTER_K; i++, bits >>= 9) {
+        if (!(b[(bits >> 6) & 7] & (1ULL << (bits & 63))))
+            return false;
+    }
+    return true;
+}
+
+/* Clear the filter of queue and set the strings of every element, growing or
+ * shrinking it to twice the size of the queue on the way
+ */
+static bool filter_rebuild(queue_head_t *q)
+{
+    struct qfilter *f = q->filter;
+    size_t n = q_size(&q->head);
+    size_t want = (2 * n * FILTER_BITS + FILTER_WORDS * 64 - 1) /
+                  (FILTER_WORDS * 64);
+    if (!want)
+        want = 1;
+    if (want > f->nblocks || want < f->nblocks / 4) {
+        size_t len = sizeof(*f->block) * want;
+        void *mem = malloc(len + sizeof(*f->block) - 1);
+        if (!mem)
+            return false;
+        free(f->mem);
+        f->mem = mem;
+        f->block = (void *) (((uintptr_t) mem + sizeof(*f->block) - 1) &
+                             ~(uintptr_t) (sizeof(*f->block) - 1));
+        f->nblocks = want;
+    }
+    memset(f->block, 0, sizeof(*f->block) * f->nblocks);
+    f->added = 0;
+    f->removed = 0;
+    f->stale = false;
+
+    element_t *e;
+    list_for_each_entry_prefetch(e, &q->head, list)
+        filter_set(f, e->value);
+    return true;
+}
+
+/* Note that elements came into the queue, or left it, behind the filter */
+static inline void filter_stale(queue_head_t *q)
+{
+    if (q->filter)
+        q->filter->stale = true;
+}
+
+/* Check the filter of queue, rebuilding it first if it is due. Return false
+ * only if no element holds s.
+ */
+static bool filter_maybe(queue_head_t *q, const char *s)
+{
+    struct qfilter *f = q->filter;
+    if ((f->stale || f->removed > f->added / 2 ||
+         f->added > filter_capacity(f)) &&
+        !filter_rebuild(q) && f->stale)
+        return true;
+    return filter_test(f, s);
+}
+
+/* Add a new element to the hash index if the queue has one */
+static void index_add(queue_head_t *q, element_t *e)
+{
+    if (q->filter && !q->filter->stale)
+        filter_set(q->filter, e->value);
+    if (!q->buckets) {
+        INIT_HLIST_NODE(&e->hash);
+        return;
+    }
+    index_link(q, e);
+    // Keep the load factor at most 1 as long as memory allows
+    if (q->hashed > (size_t) 1 << q->hash_bits && q->hash_bits < INDEX_MAX_BITS)
+        index_resize(q, q->hash_bits + 1);
+}
+
+/* Remove an element from the hash index if it is in there */
+static inline void index_del(queue_head_t *q, element_t *e)
+{
+    if (q->filter)
+        q->filter->removed++;
+    if (hlist_unhashed(&e->hash))
+        return;
+    hlist_del_init(&e->hash);
+    q->hashed--;
+}
+
+/* Free an element once its grace period is over */
+static void retire_element(struct ep_node *node)
+{
+    element_t *e = container_of(node, element_t, retire);
+    free(e->value);
+    free(e);
+}
+
+/* Free every element of the graveyard of queue */
+static size_t reap_graveyard(queue_head_t *q)
+{
+    struct ep_node *node = q->grave;
+    size_t n = q->buried;
+    q->grave = NULL;
+    q->buried = 0;
+    while (node) {
+        element_t *e = container_of(node, element_t, retire);
+        node = node->next;
+        // The next element is cold by now: start loading it during the frees
+        list_prefetch(node);
+        free(e->value);
+        free(e);
+    }
+    return n;
+}
+
+/* Release an element which has already been unlinked from the queue */
+static void drop_element(queue_head_t *q, element_t *e)
+{
+    index_del(q, e);
+    if (q->ep) {
+        ep_retire(q->ep, &e->retire, retire_element);
+        return;
+    }
+    if (q->grave_limit) {
+        e->retire.next = q->grave;
+        q->grave = &e->retire;
+        if (++q->buried >= q->grave_limit)
+            reap_graveyard(q);
+        return;
+    }
+    free(e->value);
+    free(e);
+}
+
+/* The ordering operations are written once as templates and expanded for each
+ * order, so that the default strcmp() order and the orders built in here
+ * compare inline instead of through a function pointer. An expansion takes
+ * ECMP(a, b, ord), comparing two elements like strcmp(), KEY(k, e, ord),
+ * filling the key k of element e, and CMP(ka, kb, ord), comparing two keys.
+ * Sorting and merging compare each element O(log n) times, so orders with a
+ * key function have it stamped on the elements once beforehand, and their
+ * ECMP compares the stamped keys.
+ */
+#define DEFINE_MERGE(name, ECMP)                                              \
+    static inline void merge_two_##name(struct list_head *ha,                 \
+                                        struct list_head *hb, bool descend,   \
+                                        const q_order_t *ord)                 \
+    {                                                                         \
+        struct list_head *a, *b, *c;                                          \
+                                                                              \
+        if (hb->next == hb)                                                   \
+            return;                                                           \
+        /* Concatenate directly if the last of ha does not go after the first \
+         * of hb */                                                           \
+        if (ha->next != ha) {                                                 \
+            int cmp = ECMP(list_to_element(ha->prev),                         \
+                           list_to_element(hb->next), ord);                   \
+            if (descend ? cmp >= 0 : cmp <= 0) {                              \
+                list_splice_tail_init(hb, ha);                                \
+                return;                                                       \
+            }                                                                 \
+        }                                                                     \
+                                                                              \
+        a = ha->next;                                                         \
+        b = hb->next;                                                         \
+        c = ha;                                                               \
+                                                                              \
+        /* Merge two sorted queeus into ha */                                 \
+        while (a != ha && b != hb) {                                          \
+            const element_t *ae = list_to_element(a);                         \
+            const element_t *be = list_to_element(b);                         \
+            /* Compare based on ascend/descend order */                       \
+            int cmp = ECMP(ae, be, ord);                                      \
+            if (descend ? cmp >= 0 : cmp <= 0) {                              \
+                c->next = a;                                                  \
+                a->prev = c;                                                  \
+                a = a->next;                                                  \
+            } else {                                                          \
+                c->next = b;                                                  \
+                b->prev = c;                                                  \
+                b = b->next;                                                  \
+            }                                                                 \
+            c = c->next;                                                      \
+        }                                                                     \
+        /* Link remaining nodes */                                            \
+        if (a == ha) {                                                        \
+            c->next = b;                                                      \
+            b->prev = c;                                                      \
+            hb->prev->next = ha;                                              \
+            ha->prev = hb->prev;                                              \
+        } else {                                                              \
+            c->next = a;                                                      \
+            a->prev = c;                                                      \
+        }                                                                     \
+        /* Let b become a NULL-queue */                                       \
+        hb->next = hb;                                                        \
+        hb->prev = hb;                                                        \
+    }                                                                         \
+                                                                              \
+    /* Bottom-up merge sort of a list, which may be a plain list_head */      \
+    static inline void merge_sort_##name(struct list_head *head,              \
+                                         bool descend, const q_order_t *ord)  \
+    {                                                                         \
+        size_t n = q_size(head);                                              \
+                                                                              \
+        for (size_t size = 1; size < n; size *= 2) {                          \
+            struct list_head *current = head->next;                           \
+                                                                              \
+            while (current != head) {                                         \
+                /* Left  queue */                                             \
+                struct list_head *left_start = current;                       \
+                size_t left_c = 0;                                            \
+                while (current != head && left_c < size) {                    \
+                    current = current->next;                                  \
+                    left_c++;                                                 \
+                }                                                             \
+                struct list_head *left_end = current->prev;                   \
+                                                                              \
+                /* Right queue */                                             \
+                struct list_head *right_start = current;                      \
+                size_t right_c = 0;                                           \
+                while (current != head && right_c < size) {                   \
+                    current = current->next;                                  \
+                    right_c++;                                                \
+                }                                                             \
+                struct list_head *right_end = current->prev;                  \
+                                                                              \
+                if (right_start == head)                                      \
+                    continue;                                                 \
+                /* Initailize for the merge_two */                            \
+                struct list_head *tmp_head = left_start->prev;                \
+                struct list_head head_a, head_b;                              \
+                /* Insert head at the left queue */                           \
+                head_a.next = left_start;                                     \
+                head_a.prev = left_end;                                       \
+                left_start->prev = &head_a;                                   \
+                left_end->next = &head_a;                                     \
+                /* Insert head at the right queue */                          \
+                head_b.next = right_start;                                    \
+                head_b.prev = right_end;                                      \
+                right_start->prev = &head_b;                                  \
+                right_end->next = &head_b;                                    \
+                                                                              \
+                /* Merge */                                                   \
+                merge_two_##name(&head_a, &head_b, descend, ord);             \
+                                                                              \
+                /* Update link */                                             \
+                tmp_head->next = head_a.next;                                 \
+                current->prev = head_a.prev;                                  \
+                head_a.next->prev = tmp_head;                                 \
+                head_a.prev->next = current;                                  \
+            }                                                                 \
+        }                                                                     \
+    }
+
+#define DEFINE_SCAN(name, KEY, CMP)                                           \
+    /* Delete from right to left every node which is on the wrong side of    \
+     * the extreme value seen so far, counting the survivors on the way */    \
+    static inline size_t monotonic_##name(queue_head_t *q, bool descend,      \
+                                          const q_order_t *ord)               \
+    {                                                                         \
+        struct list_head *head = &q->head;                                    \
+        struct list_head *node = head->prev->prev;                            \
+        q_key_t keep, k;                                                      \
+        KEY(&keep, list_to_element(head->prev), ord);                         \
+        size_t n = 1;                                                         \
+        while (node != head) {                                                \
+            struct list_head *prev = node->prev;                              \
+            element_t *e = list_to_element(node);                             \
+            KEY(&k, e, ord);                                                  \
+            int cmp = CMP(&k, &keep, ord);                                    \
+            if (descend ? cmp < 0 : cmp > 0) {                                \
+                list_del(node);                                               \
+                drop_element(q, e);                                           \
+            } else {                                                          \
+                keep = k;                                                     \
+                n++;                                                          \
+            }                                                                 \
+            node = prev;                                                      \
+        }                                                                     \
+        return n;                                                             \
+    }                                                                         \
+                                                                              \
+    /* Delete every run of adjacent nodes with equal keys */                  \
+    static inline void dedup_##name(queue_head_t *q, const q_order_t *ord)    \
+    {                                                                         \
+        struct list_head *head = &q->head, *a = head->next;                   \
+        q_key_t ka = {NULL}, kb = {NULL};                                     \
+        if (a != head)                                                        \
+            KEY(&ka, list_to_element(a), ord);                                \
+        while (a != head) {                                                   \
+            struct list_head *b = a->next;                                    \
+            while (b != head) {                                               \
+                KEY(&kb, list_to_element(b), ord);                            \
+                if (CMP(&ka, &kb, ord))                                       \
+                    break;                                                    \
+                b = b->next;                                                  \
+            }                                                                 \
+            if (b != a->next) {                                               \
+                a->prev->next = b;                                            \
+                b->prev = a->prev;                                            \
+                while (a != b) {                                              \
+                    element_t *del = list_to_element(a);                      \
+                    a = a->next;                                              \
+                    drop_element(q, del);                                     \
+                }                                                             \
+            }                                                                 \
+            a = b;                                                            \
+            ka = kb;                                                          \
+        }                                                                     \
+    }
+
+/* Keys of the orders built in */
+static inline void order_key_num(q_key_t *k, const char *s, void *arg)
+{
+    k->num = strtoll(s, NULL, 10);
+}
+
+static inline void order_key_len(q_key_t *k, const char *s, void *arg)
+{
+    k->num = strlen(s);
+}
+
+static inline int order_cmp_num(const q_key_t *a, const q_key_t *b, void *arg)
+{
+    return (a->num > b->num) - (a->num < b->num);
+}
+
+static inline int order_cmp_len(const q_key_t *a, const q_key_t *b, void *arg)
+{
+    if (a->num != b->num)
+        return a->num < b->num ? -1 : 1;
+    return strcmp(a->str, b->str);
+}
+
+static inline int order_cmp_fold(const q_key_t *a, const q_key_t *b, void *arg)
+{
+    return strcasecmp(a->str, b->str);
+}
+
+const q_order_t q_order_numeric = {order_key_num, order_cmp_num, NULL};
+const q_order_t q_order_length = {order_key_len, order_cmp_len, NULL};
+const q_order_t q_order_casefold = {NULL, order_cmp_fold, NULL};
+
+/* Keys computed on the fly */
+#define KEY_STR(k, e, ord) ((k)->str = (e)->value)
+#define KEY_NUM(k, e, ord) \
+    (KEY_STR(k, e, ord), order_key_num(k, (e)->value, NULL))
+#define KEY_LEN(k, e, ord) \
+    (KEY_STR(k, e, ord), order_key_len(k, (e)->value, NULL))
+#define KEY_ANY(k, e, ord) \
+    (KEY_STR(k, e, ord),   \
+     (ord)->key ? (ord)->key(k, (e)->value, (ord)->arg) : (void) 0)
+
+#define CMP_STR(ka, kb, ord) strcmp((ka)->str, (kb)->str)
+#define CMP_NUM(ka, kb, ord) order_cmp_num(ka, kb, NULL)
+#define CMP_LEN(ka, kb, ord) order_cmp_len(ka, kb, NULL)
+#define CMP_FOLD(ka, kb, ord) order_cmp_fold(ka, kb, NULL)
+#define CMP_ANY(ka, kb, ord) (ord)->cmp(ka, kb, (ord)->arg)
+
+/* Elements compared by their strings, or by the keys stamped on them */
+#define ECMP_STR(a, b, ord) strcmp((a)->value, (b)->value)
+#define ECMP_FOLD(a, b, ord) strcasecmp((a)->value, (b)->value)
+#define ECMP_NUM(a, b, ord) CMP_NUM(&(a)->key, &(b)->key, ord)
+#define ECMP_LEN(a, b, ord) CMP_LEN(&(a)->key, &(b)->key, ord)
+#define ECMP_ANY(a, b, ord) CMP_ANY(&(a)->key, &(b)->key, ord)
+
+DEFINE_MERGE(str, ECMP_STR)
+DEFINE_MERGE(num, ECMP_NUM)
+DEFINE_MERGE(len, ECMP_LEN)
+DEFINE_MERGE(fold, ECMP_FOLD)
+DEFINE_MERGE(any, ECMP_ANY)
+
+DEFINE_SCAN(str, KEY_STR, CMP_STR)
+DEFINE_SCAN(num, KEY_NUM, CMP_NUM)
+DEFINE_SCAN(len, KEY_LEN, CMP_LEN)
+DEFINE_SCAN(fold, KEY_STR, CMP_FOLD)
+DEFINE_SCAN(any, KEY_ANY, CMP_ANY)
+
+/* Call the expansion of an operation for an order */
+#define ORDER_CALL(op, ord, ...)                                    \
+    ((ord) == &q_order_numeric    ? op##_num(__VA_ARGS__)           \
+     : (ord) == &q_order_length   ? op##_len(__VA_ARGS__)           \
+     : (ord) == &q_order_casefold ? op##_fold(__VA_ARGS__)          \
+                                  : op##_any(__VA_ARGS__))
+
+/* Stamp the key of every element of a list on it, over its hash node. Return
+ * false if the order compares strings directly, so that nothing is stamped.
+ */
+static bool stamp_keys(struct list_head *head, const q_order_t *ord)
+{
+    if (ord == &q_order_casefold)
+        return false;
+    element_t *e;
+    list_for_each_entry(e, head, list) {
+        e->key.str = e->value;
+        if (ord->key)
+            ord->key(&e->key, e->value, ord->arg);
+    }
+    return true;
+}
+
+/* Give the elements of a queue stamped with keys their hash nodes back */
+static void unstamp_keys(queue_head_t *q)
+{
+    if (q->buckets) {
+        index_rehash(q);
+        return;
     }
-    // Let b become a NULL-queue
-    hb->next = hb;
-    hb->prev = hb;
+    element_t *e;
+    list_for_each_entry(e, &q->head, list)
+        INIT_HLIST_NODE(&e->hash);
 }
 
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *new_list = malloc(sizeof(struct list_head));
-    if (!new_list)
+    queue_head_t *q = malloc(sizeof(queue_head_t));
+    if (!q)
         return NULL;
-    new_list->next = new_list;
-    new_list->prev = new_list;
-    return new_list;
+    q->head.next = &q->head;
+    q->head.prev = &q->head;
+    q->flags = Q_ORDERED;
+    q->buckets = NULL;
+    q->hash_bits = 0;
+    q->hashed = 0;
+    q->filter = NULL;
+    q->ep = NULL;
+    q->grave = NULL;
+    q->buried = 0;
+    q->grave_limit = 0;
+    return &q->head;
 }
 
 /* Free all storage used by queue */
@@ -68,6 +582,9 @@ void q_free(struct list_head *head)
 {
     if (!head)
         return;
+    // A single walk from the head: in cautious mode the harness looks for
+    // each block starting from the newest one, which queues built at the
+    // head keep there, and freeing from the tail too made this quadratic
     struct list_head *current = head->next;
     while (current != head) {
         struct list_head *next = current->next;
@@ -76,7 +593,14 @@ void q_free(struct list_head *head)
         free(real_pos);
         current = next;
     }
-    free(head);
+    queue_head_t *q = to_qhead(head);
+    reap_graveyard(q);
+    if (q->filter) {
+        free(q->filter->mem);
+        free(q->filter);
+    }
+    free(q->buckets);
+    free(q);
 }
 
 /* Insert an element at head of queue */
@@ -84,7 +608,7 @@ bool q_insert_head(struct list_head *head, char *s)
 {
     if (!head)
         return false;
-    int len = strlen(s) + 1;
+    size_t len = strlen(s) + 1;
     char *value = malloc(len);
     if (!value)
         return false;
@@ -93,13 +617,23 @@ bool q_insert_head(struct list_head *head, char *s)
         free(value);
         return false;
     }
-    for (int i = 0; i < len; i++)
+    for (size_t i = 0; i < len; i++)
         *(value + i) = *(s + i);
     new->value = value;
+    queue_head_t *q = to_qhead(head);
+    if (q->flags && head->next != head) {
+        int cmp = strcmp(value, list_to_element(head->next)->value);
+        if (cmp > 0)
+            q->flags &= ~Q_ASCEND;
+        else if (cmp < 0)
+            q->flags &= ~Q_DESCEND;
+    }
     new->list.prev = head;
     new->list.next = head->next;
     head->next->prev = &new->list;
-    head->next = &new->list;
+    // Readers may follow the link as soon as it is stored
+    __atomic_store_n(&head->next, &new->list, __ATOMIC_RELEASE);
+    index_add(q, new);
     return true;
 }
 
@@ -108,7 +642,7 @@ bool q_insert_tail(struct list_head *head, char *s)
 {
     if (!head)
         return false;
-    int len = strlen(s) + 1;
+    size_t len = strlen(s) + 1;
     char *value = malloc(len);
     if (!value)
         return false;
@@ -117,13 +651,22 @@ bool q_insert_tail(struct list_head *head, char *s)
         free(value);
         return false;
     }
-    for (int i = 0; i < len; i++)
+    for (size_t i = 0; i < len; i++)
         *(value + i) = *(s + i);
     new->value = value;
+    queue_head_t *q = to_qhead(head);
+    if (q->flags && head->prev != head) {
+        int cmp = strcmp(list_to_element(head->prev)->value, value);
+        if (cmp > 0)
+            q->flags &= ~Q_ASCEND;
+        else if (cmp < 0)
+            q->flags &= ~Q_DESCEND;
+    }
     new->list.next = head;
     new->list.prev = head->prev;
-    head->prev->next = &new->list;
+    __atomic_store_n(&head->prev->next, &new->list, __ATOMIC_RELEASE);
     head->prev = &new->list;
+    index_add(q, new);
     return true;
 }
 
@@ -134,11 +677,16 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
         return NULL;
     head->next->next->prev = head;
     element_t *tmp = list_to_element(head->next);
-    head->next = head->next->next;
-    tmp->list.next = NULL;
+    __atomic_store_n(&head->next, head->next->next, __ATOMIC_RELEASE);
+    if (head->next == head->prev)
+        to_qhead(head)->flags = Q_ORDERED;
+    index_del(to_qhead(head), tmp);
+    // A reader standing on the element walks on from it
+    if (!to_qhead(head)->ep)
+        tmp->list.next = NULL;
     tmp->list.prev = NULL;
     if (sp) {
-        int i = 0;
+        size_t i = 0;
         while (i < bufsize - 1 && (tmp->value[i] != '\0')) {
             sp[i] = tmp->value[i];
             i++;
@@ -153,13 +701,17 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
 {
     if (!head || (head->next == head))
         return NULL;
-    head->prev->prev->next = head;
+    __atomic_store_n(&head->prev->prev->next, head, __ATOMIC_RELEASE);
     element_t *tmp = list_to_element(head->prev);
     head->prev = head->prev->prev;
+    if (head->next == head->prev)
+        to_qhead(head)->flags = Q_ORDERED;
+    index_del(to_qhead(head), tmp);
     tmp->list.prev = NULL;
-    tmp->list.next = NULL;
+    if (!to_qhead(head)->ep)
+        tmp->list.next = NULL;
     if (sp) {
-        int i = 0;
+        size_t i = 0;
         while (i < bufsize - 1 && (tmp->value[i] != '\0')) {
             sp[i] = tmp->value[i];
             i++;
@@ -169,17 +721,87 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
     return tmp;
 }
 
+/* View the string of an element in place */
+static q_view_t view_of(struct list_head *head, struct list_head *node)
+{
+    q_view_t v = {NULL, 0};
+    if (head && node != head) {
+        v.value = list_to_element(node)->value;
+        v.len = strlen(v.value);
+    }
+    return v;
+}
+
+/* Look at the string at head of queue */
+q_view_t q_peek_head(struct list_head *head)
+{
+    return view_of(head, head ? head->next : NULL);
+}
+
+/* Look at the string at tail of queue */
+q_view_t q_peek_tail(struct list_head *head)
+{
+    return view_of(head, head ? head->prev : NULL);
+}
+
+/* Remove the element at the head or the tail of queue, handing its string
+ * over. Readers in an epoch may still be reading the string, in which case it
+ * is retired along with the element, and the caller gets a copy made before
+ * anything is removed.
+ */
+static char *pop_owned(struct list_head *head, bool tail)
+{
+    if (!head || list_empty(head))
+        return NULL;
+    char *copy = NULL;
+    if (to_qhead(head)->ep) {
+        element_t *e = list_to_element(tail ? head->prev : head->next);
+        copy = strdup(e->value);
+        if (!copy)
+            return NULL;
+    }
+    element_t *e = tail ? q_remove_tail(head, NULL, 0)
+                        : q_remove_head(head, NULL, 0);
+    if (copy) {
+        q_retire_element(head, e);
+        return copy;
+    }
+    char *value = e->value;
+    free(e);
+    return value;
+}
+
+/* Remove an element from head of queue without copying its string */
+char *q_pop_head_owned(struct list_head *head)
+{
+    return pop_owned(head, false);
+}
+
+/* Remove an element from tail of queue without copying its string */
+char *q_pop_tail_owned(struct list_head *head)
+{
+    return pop_owned(head, true);
+}
+
 /* Return number of elements in queue */
-int q_size(struct list_head *head)
+size_t q_size(struct list_head *head)
 {
     if (!head)
         return 0;
 
-    int len = 0;
-    struct list_head *li;
-
-    list_for_each(li, head)
-        len++;
+    // Count from both ends until the cursors meet, which keeps two
+    // independent loads in flight instead of one
+    size_t len = 0;
+    struct list_head *f = head->next, *b = head->prev;
+    while (f != head) {
+        if (f == b)
+            return len + 1;
+        len += 2;
+        if (f->next == b)
+            break;
+        f = f->next;
+        b = b->prev;
+    }
     return len;
 }
 
@@ -197,13 +819,13 @@ bool q_delete_mid(struct list_head *head)
     }
 
     // update pointers
-    slow->prev->next = slow->next;
+    __atomic_store_n(&slow->prev->next, slow->next, __ATOMIC_RELEASE);
     slow->next->prev = slow->prev;
 
     // delete the node
-    element_t *del = list_to_element(slow);
-    free(del->value);
-    free(del);
+    drop_element(to_qhead(head), list_to_element(slow));
+    if (head->next == head->prev)
+        to_qhead(head)->flags = Q_ORDERED;
     return true;
 }
 
@@ -217,6 +839,45 @@ bool q_delete_dup(struct list_head *head)
     if (head->next->next == head)
         return true;
 
+    queue_head_t *q = to_qhead(head);
+
+    // duplicates are adjacent in an ordered queue
+    if (q->flags) {
+        dedup_str(q, NULL);
+        if (head->next == head->prev)
+            q->flags = Q_ORDERED;
+        return true;
+    }
+
+    // duplicates share a bucket of the hash index
+    if (q->buckets) {
+        struct list_head *a = head->next;
+        while (a != head) {
+            element_t *ae = list_to_element(a), *e;
+            struct list_head *next = a->next;
+            struct hlist_node *safe;
+            bool clear = false;
+            hlist_for_each_entry_safe(e, safe, index_bucket(q, ae->value),
+                                      hash) {
+                if (e == ae || strcmp(e->value, ae->value))
+                    continue;
+                if (&e->list == next)
+                    next = next->next;
+                list_del(&e->list);
+                drop_element(q, e);
+                clear = true;
+            }
+            if (clear) {
+                list_del(a);
+                drop_element(q, ae);
+            }
+            a = next;
+        }
+        if (head->next == head->prev)
+            q->flags = Q_ORDERED;
+        return true;
+    }
+
     // more than two nodes
     struct list_head *a, *b;
     a = head->next;
@@ -232,8 +893,7 @@ bool q_delete_dup(struct list_head *head)
                 b->prev->next = b->next;
                 b->next->prev = b->prev;
                 b = b->next;
-                free(be->value);
-                free(be);
+                drop_element(q, be);
                 clear = true;
             } else
                 b = b->next;
@@ -242,8 +902,7 @@ bool q_delete_dup(struct list_head *head)
             a->prev->next = a->next;
             a->next->prev = a->prev;
             a = a->next;
-            free(ae->value);
-            free(ae);
+            drop_element(q, ae);
         } else
             a = a->next;
     }
@@ -270,6 +929,8 @@ void q_swap(struct list_head *head)
         else
             break;
     }
+    if (head->next != head->prev)
+        to_qhead(head)->flags = 0;
 }
 
 /* Reverse elements in queue */
@@ -290,63 +951,85 @@ void q_reverse(struct list_head *head)
         } else
             break;
     }
+
+    // An ascending queue becomes a descending one and vice versa
+    queue_head_t *q = to_qhead(head);
+    q->flags = (q->flags & Q_ASCEND ? Q_DESCEND : 0) |
+               (q->flags & Q_DESCEND ? Q_ASCEND : 0);
 }
 
-/* Reverse the nodes of the list k at a time */
-void q_reverseK(struct list_head *head, int k)
+/* Reverse the nodes from first to last, which sit between prev and next */
+static inline void reverse_group(struct list_head *prev,
+                                 struct list_head *first,
+                                 struct list_head *last,
+                                 struct list_head *next)
 {
-    if (!head || head->next == head || head->next->next == head || k < 2)
-        return;
+    for (struct list_head *node = first; node != next;) {
+        struct list_head *tmp = node->next;
+        node->next = node->prev;
+        node->prev = tmp;
+        node = tmp;
+    }
+    prev->next = last;
+    last->prev = prev;
+    first->next = next;
+    next->prev = first;
+}
 
-    // Calculate the number of groups & nodes
-    int n = q_size(head);
-    int g = n / k;
+#define REVERSEK_MAX_WINDOW 64
 
-    // Handle k > n
-    if (k > n)
+/* Reverse the nodes k at a time in a single pass. Each step walks ahead over
+ * up to window whole groups, noting where they end, then reverses them while
+ * their nodes are still in the cache; a short tail is never touched twice.
+ */
+static void reverseK_window(struct list_head *head, size_t k, size_t window)
+{
+    if (!head || k < 2 || head->next == head)
         return;
+    if (window > REVERSEK_MAX_WINDOW)
+        window = REVERSEK_MAX_WINDOW;
 
-    // Initialization
-    struct list_head *a, *b, *tmp;
-    b = head->next;
-    tmp = NULL;
-
-    // Reverse each group
-    for (int i = 0; i < g; i++) {
-        a = b->next;
-        b = a->next;
-        // Save the group's tail
-        struct list_head *tail = a->prev;
-        tail->prev = a;
-        // Reverse k nodes in current group
-        int j = 0;
-        while (true) {
-            a->next = a->prev;
-            if (j < k - 2) {
-                a->prev = b;
-                a = b;
-                b = b->next;
-                j++;
-            } else
-                break;
-        }
-        // Connect the head node to the first group' head
-        if (!i) {
-            head->next = a;
-            a->prev = head;
+    struct list_head *last[REVERSEK_MAX_WINDOW];
+    struct list_head *prev = head;
+    size_t g;
+    do {
+        struct list_head *node = prev;
+        size_t i = 0;
+        for (g = 0; g < window && node->next != head;) {
+            node = node->next;
+            if (++i == k) {
+                last[g++] = node;
+                i = 0;
+            }
         }
-        // Connect the previous group's tail to this group's head
-        if (i) {
-            tmp->next = a;
-            a->prev = tmp;
+        if (g)
+            to_qhead(head)->flags = 0;
+        for (size_t j = 0; j < g; j++) {
+            struct list_head *first = prev->next;
+            reverse_group(prev, first, last[j], last[j]->next);
+            prev = first;
         }
-        // Save this group's tail for the next group
-        tmp = tail;
-    }
-    // After reversing g groups, link the last group's tail to the remaining
-    // nodes
-    tmp->next = b;
-    b->prev = tmp;
+    } while (g == window);
+}
+
+/* Reverse the nodes of the queue k at a time */
+void q_reverseK(struct list_head *head, size_t k)
+{
+    reverseK_window(head, k, 1);
+}
+
+/* Reverse the nodes of the queue k at a time, several groups per step */
+void q_reverseK_batch(struct list_head *head, size_t k, size_t window)
+{
+    reverseK_window(head, k, window ? window : 1);
+}
+
+/* Queues longer than this are sorted by q_sort_external(), 0 for never */
+static size_t spill_limit;
+
+void q_sort_set_spill(size_t limit)
+{
+    spill_limit = limit;
 }
 
 /* Sort elements of queue in ascending/descending order */
@@ -355,169 +1038,1165 @@ void q_sort(struct list_head *head, bool descend)
     if (!head || head->next == head || head->next->next == head)
         return;
 
-    int n = q_size(head);
-
-    for (int size = 1; size < n; size *= 2) {
-        struct list_head *current = head->next;
-
-        while (current != head) {
-            // Left  queue
-            struct list_head *left_start = current;
-            int left_c = 0;
-            while (current != head && left_c < size) {
-                current = current->next;
-                left_c++;
-            }
-            struct list_head *left_end = current->prev;
-
-            // Right queue
-            struct list_head *right_start = current;
-            int right_c = 0;
-            while (current != head && right_c < size) {
-                current = current->next;
-                right_c++;
-            }
-            struct list_head *right_end = current->prev;
-
-            if (right_start != head) {
-                // Initailize for the merge_two
-                struct list_head *tmp_head = left_start->prev;
-                struct list_head head_a, head_b;
-                // Insert head at the left queue
-                head_a.next = left_start;
-                head_a.prev = left_end;
-                left_start->prev = &head_a;
-                left_end->next = &head_a;
-                // Insert head at the right queue
-                head_b.next = right_start;
-                head_b.prev = right_end;
-                right_start->prev = &head_b;
-                right_end->next = &head_b;
-
-                // Merge
-                merge_two(&head_a, &head_b, descend);
-
-                // Update link
-                tmp_head->next = head_a.next;
-                current->prev = head_a.prev;
-                head_a.next->prev = tmp_head;
-                head_a.prev->next = current;
+    queue_head_t *q = to_qhead(head);
+    unsigned int want = descend ? Q_DESCEND : Q_ASCEND;
+    if (q->flags & want)
+        return;
+    if (q->flags) {
+        // Ordered the other way round: reverse the queue, then reverse every
+        // run of equal strings back to keep the sort stable.
+        q_reverse(head);
+        struct list_head *a = head->next;
+        while (a != head) {
+            const element_t *ae = list_to_element(a);
+            struct list_head *prev = a->prev, *b = a->next;
+            while (b != head && !strcmp(ae->value, list_to_element(b)->value)) {
+                struct list_head *next = b->next;
+                list_move(b, prev);
+                b = next;
             }
+            a = b;
         }
+        q->flags = want;
+        return;
+    }
+
+    if (spill_limit && q_size(head) > spill_limit) {
+        q_sort_external(head, descend, spill_limit, NULL);
+        return;
     }
+    merge_sort_str(head, descend, NULL);
+    q->flags = want;
 }
 
-/* Remove every node which has a node with a strictly less value anywhere to
- * the right side of it */
-int q_ascend(struct list_head *head)
+#define EXT_MAX_RUNS 256
+#define EXT_IO_BUF (64 * 1024)
+
+/* A sorted run of a queue being sorted externally. Its elements wait in order
+ * in @list; when the run has been spilled, @f holds their strings in the same
+ * order and the elements themselves hold none until they are read back.
+ */
+typedef struct {
+    FILE *f;
+    struct list_head list;
+    element_t *cur;
+} ext_run_t;
+
+typedef struct {
+    ext_run_t *runs;
+    bool descend;
+} ext_merge_t;
+
+/* Write the strings of a sorted run to a temporary file and free them. The
+ * run stays in memory if the file cannot be written.
+ */
+static void ext_spill(ext_run_t *run)
 {
-    if (!head || head->next == head)
-        return 0;
-    if (head->next->next == head)
-        return 1;
+    run->f = tmpfile();
+    if (!run->f)
+        return;
+    setvbuf(run->f, NULL, _IOFBF, EXT_IO_BUF);
 
-    // Initialization
-    struct list_head *t, *a, *b;
-    a = head;
-    b = a->next;
-    t = b->next;
-    bool delete = 0;
-    while (b->next != head) {
-        if (!delete) {
-            a = a->next;
-            b = a->next;
-            t = b->next;
-        } else {
-            b = t;
-            t = t->next;
-        }
-        const element_t *ae = list_to_element(a);
-        element_t *be = list_to_element(b);
-        delete = strcmp(ae->value, be->value) > 0 ? 1 : 0;
-        if (delete) {
-            a->next = t;
-            t->prev = a;
-            free(be->value);
-            free(be);
-            if (t == head)
-                break;
+    element_t *e;
+    list_for_each_entry(e, &run->list, list) {
+        size_t len = strlen(e->value);
+        if (fwrite(&len, sizeof(len), 1, run->f) != 1 ||
+            fwrite(e->value, 1, len, run->f) != len)
+            break;
+    }
+    if (fflush(run->f) || ferror(run->f) || fseek(run->f, 0, SEEK_SET)) {
+        fclose(run->f);
+        run->f = NULL;
+        return;
+    }
+    list_for_each_entry(e, &run->list, list) {
+        free(e->value);
+        e->value = NULL;
+    }
+}
+
+/* Read the string of the next element of a spilled run back into memory */
+static char *ext_read(FILE *f)
+{
+    size_t len;
+    if (fread(&len, sizeof(len), 1, f) != 1)
+        return NULL;
+    char *s = malloc(len + 1);
+    if (!s)
+        return NULL;
+    if (fread(s, 1, len, f) != len) {
+        free(s);
+        return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+/* Make the next element of a run current, releasing the elements whose
+ * strings cannot be read back. Return false if any was released.
+ */
+static bool ext_advance(queue_head_t *q, ext_run_t *run)
+{
+    bool ok = true;
+    run->cur = NULL;
+    while (!list_empty(&run->list)) {
+        element_t *e = list_first_entry(&run->list, element_t, list);
+        if (!run->f || (e->value = ext_read(run->f))) {
+            run->cur = e;
+            break;
         }
+        list_del(&e->list);
+        drop_element(q, e);
+        ok = false;
     }
+    return ok;
+}
 
-    // Count number of the nodes
-    return q_size(head);
+/* Compare the current elements of two runs, exhausted runs coming last */
+static int ext_cmp(void *ctx, int a, int b)
+{
+    const ext_merge_t *m = ctx;
+    const element_t *ea = m->runs[a].cur, *eb = m->runs[b].cur;
+    if (!ea || !eb)
+        return !ea - !eb;
+    int cmp = strcmp(ea->value, eb->value);
+    return m->descend ? -cmp : cmp;
 }
 
-/* Remove every node which has a node with a strictly greater value anywhere to
- * the right side of it */
-int q_descend(struct list_head *head)
+/* Sort queue through sorted runs spilled to temporary files */
+bool q_sort_external(struct list_head *head,
+                     bool descend,
+                     size_t run_len,
+                     FILE *out)
 {
-    if (!head || head->next == head)
-        return 0;
-    if (head->next->next == head)
-        return 1;
+    if (!head || list_empty(head))
+        return true;
+    queue_head_t *q = to_qhead(head);
+    size_t n = q_size(head);
+    if (run_len < 1)
+        run_len = 1;
+    if (n / run_len >= EXT_MAX_RUNS)
+        run_len = n / EXT_MAX_RUNS + 1;
+    int nruns = (n + run_len - 1) / run_len;
 
-    // Initialization
-    struct list_head *t, *a, *b;
-    b = head;
-    a = b->prev;
-    t = a->prev;
-    bool delete = 0;
-    while (a->prev != head) {
-        if (!delete) {
-            b = b->prev;
-            a = b->prev;
-            t = a->prev;
+    ext_run_t *runs = malloc(sizeof(ext_run_t) * nruns);
+    if (!runs) {
+        // Not even the bookkeeping fits: sort in memory instead
+        merge_sort_str(head, descend, NULL);
+        q->flags = descend ? Q_DESCEND : Q_ASCEND;
+        if (out) {
+            element_t *e, *safe;
+            list_for_each_entry_safe(e, safe, head, list) {
+                fprintf(out, "%s\n", e->value);
+                list_del(&e->list);
+                drop_element(q, e);
+            }
+            q->flags = Q_ORDERED;
+        }
+        return !out || !ferror(out);
+    }
+
+    // Cut the queue into runs, sort each of them in memory and spill it
+    for (int i = 0; i < nruns; i++) {
+        ext_run_t *run = &runs[i];
+        INIT_LIST_HEAD(&run->list);
+        struct list_head *last = head->next;
+        for (size_t j = 1; j < run_len && last->next != head; j++)
+            last = last->next;
+        list_cut_position(&run->list, head, last);
+        merge_sort_str(&run->list, descend, NULL);
+        ext_spill(run);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < nruns; i++)
+        ok &= ext_advance(q, &runs[i]);
+    ext_merge_t m = {runs, descend};
+    loser_tree_t lt = {0};
+    if (!lt_init(&lt, nruns, ext_cmp, &m))
+        lt.k = 0;  // Look for each winner by scanning the runs instead
+    for (;;) {
+        int w = 0;
+        if (lt.k) {
+            w = lt_winner(&lt);
         } else {
-            a = t;
-            t = t->prev;
+            for (int i = 1; i < nruns; i++)
+                if (ext_cmp(&m, i, w) < 0)
+                    w = i;
         }
-        element_t *ae = list_to_element(a);
-        const element_t *be = list_to_element(b);
-        delete = strcmp(ae->value, be->value) < 0 ? 1 : 0;
-        if (delete) {
-            t->next = b;
-            b->prev = t;
-            free(ae->value);
-            free(ae);
-            if (t == head)
-                break;
+        if (!runs[w].cur)
+            break;
+        element_t *e = runs[w].cur;
+        list_del(&e->list);
+        if (out) {
+            fprintf(out, "%s\n", e->value);
+            drop_element(q, e);
+        } else {
+            list_add_tail(&e->list, head);
         }
+        ok &= ext_advance(q, &runs[w]);
+        if (lt.k)
+            lt_replay(&lt);
     }
+    lt_free(&lt);
 
-    // Count number of the nodes
-    return q_size(head);
+    for (int i = 0; i < nruns; i++) {
+        if (runs[i].f)
+            fclose(runs[i].f);
+    }
+    free(runs);
+    // Streaming the result out leaves the queue empty, hence in every order
+    q->flags = out ? Q_ORDERED : descend ? Q_DESCEND : Q_ASCEND;
+    return ok && (!out || !ferror(out));
 }
 
-/* Convert a list_head pointer to its containing queue_contex_t pointer */
-static queue_contex_t *list_to_qc(struct list_head *pos)
+/* Phases of a sort in slices */
+enum { SORT_LEFT, SORT_RIGHT, SORT_MERGE };
+
+/* Prepare to sort queue in slices */
+void q_sort_begin(q_sort_state_t *st, struct list_head *head, bool descend)
 {
-    return (queue_contex_t *) ((char *) pos - offsetof(queue_contex_t, chain));
+    st->head = head;
+    st->descend = descend;
+    st->done = !head || head->next == head || head->next->next == head ||
+               to_qhead(head)->flags & (descend ? Q_DESCEND : Q_ASCEND);
+    st->phase = SORT_LEFT;
+    st->width = 1;
+    st->cnt = 0;
+    st->n = 0;
+    st->pass = 0;
+    st->pos = 0;
+    if (st->done)
+        return;
+    st->a = st->b = head->next;
+    // Nothing is known about the order until the sort completes
+    to_qhead(head)->flags = 0;
 }
 
-/* Merge all the queues into one sorted queue, which is in ascending/descending
- * order */
-int q_merge(struct list_head *head, bool descend)
+/* Run at most budget steps of the sort */
+bool q_sort_step(q_sort_state_t *st, size_t budget)
 {
-    if (!head || head->next == head)
-        return 0;
-    // Single queue: do nothing, only return its node count
-    if (head->next->next == head)
-        return q_size(list_to_qc(head->next)->q);
-
-    // Count number of the queues to merge
-    int n = q_size(head);
-
-    struct list_head *tmpb = head->next->next;
-    // Merge n queues into the first queue
-    for (int i = 0; i < n - 1; i++) {
-        // Get the two queues to merge
-        queue_contex_t *qa = list_to_qc(head->next);
-        queue_contex_t *qb = list_to_qc(tmpb);
-        merge_two(qa->q, qb->q, descend);
-        // Move tmpb to the next queue
-        tmpb = tmpb->next;
+    struct list_head *head = st->head;
+    while (!st->done && budget--) {
+        switch (st->phase) {
+        case SORT_LEFT:
+            if (st->cnt < st->width && st->b != head) {
+                st->b = st->b->next;
+                st->cnt++;
+                break;
+            }
+            if (st->b != head) {
+                st->end = st->b;
+                st->cnt = 0;
+                st->phase = SORT_RIGHT;
+                break;
+            }
+            // No right run: a single run spanning the queue means it is sorted
+            if (st->a == head->next) {
+                st->done = true;
+                break;
+            }
+            if (!st->pass)
+                st->n = st->pos + st->cnt;
+            st->pass++;
+            st->pos = 0;
+            st->width *= 2;
+            st->a = st->b = head->next;
+            st->cnt = 0;
+            break;
+        case SORT_RIGHT:
+            if (st->cnt < st->width && st->end != head) {
+                st->end = st->end->next;
+                st->cnt++;
+                break;
+            }
+            st->pos += st->width + st->cnt;
+            st->phase = SORT_MERGE;
+            break;
+        case SORT_MERGE:
+            if (st->a == st->b || st->b == st->end) {
+                if (!st->pass && st->end == head)
+                    st->n = st->pos;
+                // The last merge of a pass covering everything ends the sort
+                if (st->end == head && 2 * st->width >= st->n) {
+                    st->done = true;
+                    break;
+                }
+                st->a = st->b = st->end;
+                st->cnt = 0;
+                st->phase = SORT_LEFT;
+                if (st->a == head) {
+                    st->pass++;
+                    st->pos = 0;
+                    st->width *= 2;
+                    st->a = st->b = head->next;
+                }
+                break;
+            }
+            int cmp = strcmp(list_to_element(st->a)->value,
+                             list_to_element(st->b)->value);
+            if (st->descend ? cmp >= 0 : cmp <= 0) {
+                st->a = st->a->next;
+            } else {
+                // Move the node of the right run in front of the left run
+                struct list_head *next = st->b->next;
+                list_del(st->b);
+                list_add_tail(st->b, st->a);
+                st->b = next;
+            }
+            break;
+        }
+    }
+
+    if (st->done && head && head->next != head)
+        to_qhead(head)->flags = st->descend ? Q_DESCEND : Q_ASCEND;
+    return st->done;
+}
+
+/* Estimate the percentage of the sort done so far */
+int q_sort_progress(const q_sort_state_t *st)
+{
+    if (st->done)
+        return 100;
+    if (!st->n)
+        return 0;
+    size_t passes = 0;
+    while (((size_t) 1 << passes) < st->n)
+        passes++;
+    size_t pct = (st->pass * st->n + st->pos) * 100 / (passes * st->n);
+    return pct > 99 ? 99 : pct;
+}
+
+/* Slot of the bounded heap used by q_sort_topk() and q_select_kth(). The
+ * sequence number breaks ties so that equal strings keep their order.
+ */
+struct heap_slot {
+    element_t *e;
+    size_t seq;
+};
+
+/* Whether slot a ranks after slot b in the wanted order */
+static inline bool slot_after(const struct heap_slot *a,
+                              const struct heap_slot *b,
+                              bool descend)
+{
+    int cmp = strcmp(a->e->value, b->e->value);
+    if (descend)
+        cmp = -cmp;
+    return cmp > 0 || (cmp == 0 && a->seq > b->seq);
+}
+
+/* Restore the heap property below slot i; the root ranks last of all */
+static void heap_sift_down(struct heap_slot *heap,
+                           size_t n,
+                           size_t i,
+                           bool descend)
+{
+    while (true) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && slot_after(&heap[l], &heap[m], descend))
+            m = l;
+        if (r < n && slot_after(&heap[r], &heap[m], descend))
+            m = r;
+        if (m == i)
+            return;
+        struct heap_slot tmp = heap[i];
+        heap[i] = heap[m];
+        heap[m] = tmp;
+        i = m;
+    }
+}
+
+/* Collect the first k elements in the wanted order into a heap whose root is
+ * the last of them. *cnt is set to the number of collected elements, which is
+ * less than k if the queue is shorter.
+ */
+static struct heap_slot *heap_select(struct list_head *head,
+                                     size_t k,
+                                     bool descend,
+                                     size_t *cnt)
+{
+    if (k > SIZE_MAX / sizeof(struct heap_slot))
+        return NULL;
+    struct heap_slot *heap = malloc(k * sizeof(struct heap_slot));
+    if (!heap)
+        return NULL;
+
+    size_t n = 0, seq = 0;
+    element_t *e;
+    list_for_each_entry(e, head, list) {
+        struct heap_slot s = {.e = e, .seq = seq++};
+        if (n < k) {
+            heap[n++] = s;
+            if (n == k) {
+                for (size_t i = k / 2; i-- > 0;)
+                    heap_sift_down(heap, k, i, descend);
+            }
+        } else if (slot_after(&heap[0], &s, descend)) {
+            heap[0] = s;
+            heap_sift_down(heap, k, 0, descend);
+        }
+    }
+    *cnt = n;
+    return heap;
+}
+
+/* Move the K smallest/largest elements to the front of queue in order */
+void q_sort_topk(struct list_head *head, size_t k, bool descend)
+{
+    if (!head || head->next == head || !k)
+        return;
+
+    if (to_qhead(head)->flags & (descend ? Q_DESCEND : Q_ASCEND))
+        return;
+
+    if (k >= q_size(head)) {
+        q_sort(head, descend);
+        return;
+    }
+
+    size_t n;
+    struct heap_slot *heap = heap_select(head, k, descend, &n);
+    if (!heap) {
+        // Sorting everything also satisfies the contract
+        q_sort(head, descend);
+        return;
+    }
+
+    // Pop from the last-ranked one so that the first one ends up at front
+    while (n) {
+        list_move(&heap[0].e->list, head);
+        heap[0] = heap[--n];
+        heap_sift_down(heap, n, 0, descend);
+    }
+    free(heap);
+    to_qhead(head)->flags = 0;
+}
+
+/* Find the k-th element in ascending/descending order */
+element_t *q_select_kth(struct list_head *head, size_t k, bool descend)
+{
+    if (!head || head->next == head || k >= q_size(head))
+        return NULL;
+
+    size_t n;
+    struct heap_slot *heap = heap_select(head, k + 1, descend, &n);
+    if (!heap)
+        return NULL;
+
+    element_t *kth = n == k + 1 ? heap[0].e : NULL;
+    free(heap);
+    return kth;
+}
+
+/* Delete every node which is on the wrong side of a node to its right */
+static size_t monotonic(struct list_head *head, bool descend)
+{
+    if (!head || head->next == head)
+        return 0;
+    queue_head_t *q = to_qhead(head);
+    // Nothing to delete from a queue already in that order
+    if (q->flags & (descend ? Q_DESCEND : Q_ASCEND))
+        return q_size(head);
+
+    size_t n = monotonic_str(q, descend, NULL);
+    q->flags |= descend ? Q_DESCEND : Q_ASCEND;
+    return n;
+}
+
+/* Remove every node which has a node with a strictly less value anywhere to
+ * the right side of it */
+size_t q_ascend(struct list_head *head)
+{
+    return monotonic(head, false);
+}
+
+/* Remove every node which has a node with a strictly greater value anywhere to
+ * the right side of it */
+size_t q_descend(struct list_head *head)
+{
+    return monotonic(head, true);
+}
+
+/* Pass the elements q_ascend() or q_descend() would keep to fn, in order,
+ * leaving the queue untouched. A monotonic stack holds the elements with no
+ * smaller (larger) value to their right so far; each element pops those it
+ * proves wrong, so that one walk from the head is enough.
+ */
+size_t q_monotonic_each(const struct list_head *head,
+                        bool descend,
+                        void (*fn)(const element_t *, void *),
+                        void *arg)
+{
+    if (!head)
+        return 0;
+
+    const element_t **stack = NULL, *e;
+    size_t n = 0, cap = 0;
+    list_for_each_entry(e, head, list) {
+        while (n) {
+            int cmp = strcmp(stack[n - 1]->value, e->value);
+            if (descend ? cmp >= 0 : cmp <= 0)
+                break;
+            n--;
+        }
+        if (n == cap) {
+            cap = cap ? 2 * cap : 16;
+            const element_t **grown = malloc(cap * sizeof(element_t *));
+            if (!grown) {
+                free(stack);
+                return SIZE_MAX;
+            }
+            if (n)
+                memcpy(grown, stack, n * sizeof(element_t *));
+            free(stack);
+            stack = grown;
+        }
+        stack[n++] = e;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        fn(stack[i], arg);
+    free(stack);
+    return n;
+}
+
+/* Append copies of the elements q_ascend() or q_descend() would keep to dst,
+ * leaving head untouched. Walking from the tail finds them last first, so
+ * they are gathered at the head of a queue of their own, which is moved to
+ * dst in one piece once every copy has been made.
+ */
+size_t q_monotonic_copy(const struct list_head *head,
+                        bool descend,
+                        struct list_head *dst)
+{
+    if (!head || !dst)
+        return SIZE_MAX;
+    if (head->next == head)
+        return 0;
+
+    struct list_head *tmp = q_new();
+    if (!tmp)
+        return SIZE_MAX;
+    const element_t *keep = list_to_element(head->prev);
+    size_t n = 0;
+    for (struct list_head *node = head->prev; node != head;
+         node = node->prev) {
+        element_t *e = list_to_element(node);
+        int cmp = strcmp(e->value, keep->value);
+        if (n && (descend ? cmp < 0 : cmp > 0))
+            continue;
+        if (!q_insert_head(tmp, e->value)) {
+            q_free(tmp);
+            return SIZE_MAX;
+        }
+        keep = e;
+        n++;
+    }
+
+    q_splice_range(tmp, tmp->next, tmp->prev, dst, dst);
+    q_free(tmp);
+    return n;
+}
+
+/* Attach a hash index to the queue */
+bool q_index(struct list_head *head)
+{
+    if (!head)
+        return false;
+
+    queue_head_t *q = to_qhead(head);
+    if (q->buckets)
+        return true;
+
+    unsigned int bits = INDEX_MIN_BITS;
+    size_t n = q_size(head);
+    while (bits < INDEX_MAX_BITS && ((size_t) 1 << bits) < n)
+        bits++;
+    return index_resize(q, bits);
+}
+
+/* Attach a membership filter to the queue */
+bool q_filter(struct list_head *head)
+{
+    if (!head)
+        return false;
+
+    queue_head_t *q = to_qhead(head);
+    if (q->filter)
+        return true;
+    q->filter = malloc(sizeof(struct qfilter));
+    if (!q->filter)
+        return false;
+    q->filter->block = NULL;
+    q->filter->mem = NULL;
+    q->filter->nblocks = 0;
+    if (!filter_rebuild(q)) {
+        free(q->filter);
+        q->filter = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* Check whether any element may hold the given string */
+bool q_maybe_contains(struct list_head *head, const char *s)
+{
+    if (!head)
+        return false;
+    queue_head_t *q = to_qhead(head);
+    return q->filter ? filter_maybe(q, s) : q_contains(head, s);
+}
+
+/* Check whether any element holds the given string */
+bool q_contains(struct list_head *head, const char *s)
+{
+    if (!head)
+        return false;
+
+    queue_head_t *q = to_qhead(head);
+    element_t *e;
+    if (q->buckets) {
+        hlist_for_each_entry(e, index_bucket(q, s), hash) {
+            if (!strcmp(e->value, s))
+                return true;
+        }
+        return false;
+    }
+    if (q->filter && !filter_maybe(q, s))
+        return false;
+
+    list_for_each_entry(e, head, list) {
+        if (!strcmp(e->value, s))
+            return true;
+    }
+    return false;
+}
+
+/* Count the elements holding the given string */
+size_t q_count_value(struct list_head *head, const char *s)
+{
+    if (!head)
+        return 0;
+
+    queue_head_t *q = to_qhead(head);
+    element_t *e;
+    size_t cnt = 0;
+    if (q->buckets) {
+        hlist_for_each_entry(e, index_bucket(q, s), hash)
+            cnt += !strcmp(e->value, s);
+        return cnt;
+    }
+    if (q->filter && !filter_maybe(q, s))
+        return 0;
+
+    list_for_each_entry(e, head, list)
+        cnt += !strcmp(e->value, s);
+    return cnt;
+}
+
+/* Delete all elements holding the given string */
+size_t q_delete_value(struct list_head *head, const char *s)
+{
+    if (!head)
+        return 0;
+
+    queue_head_t *q = to_qhead(head);
+    element_t *e;
+    size_t cnt = 0;
+    if (q->buckets) {
+        struct hlist_node *safe;
+        hlist_for_each_entry_safe(e, safe, index_bucket(q, s), hash) {
+            if (strcmp(e->value, s))
+                continue;
+            list_del(&e->list);
+            drop_element(q, e);
+            cnt++;
+        }
+    } else {
+        element_t *safe;
+        list_for_each_entry_safe_prefetch(e, safe, head, list) {
+            if (strcmp(e->value, s))
+                continue;
+            list_del(&e->list);
+            drop_element(q, e);
+            cnt++;
+        }
+    }
+    if (head->next == head->prev)
+        q->flags = Q_ORDERED;
+    return cnt;
+}
+
+/* Hand the hash index entries of queue qb over to queue qa before the nodes
+ * of qb are moved into qa. No allocation happens here, so the index of qa may
+ * end up above its usual load factor.
+ */
+static void index_move(queue_head_t *qa, queue_head_t *qb)
+{
+    if (!list_empty(&qb->head)) {
+        filter_stale(qa);
+        filter_stale(qb);
+    }
+    if (!qa->buckets && !qb->buckets)
+        return;
+
+    element_t *e;
+    list_for_each_entry(e, &qb->head, list) {
+        if (qa->buckets)
+            index_link(qa, e);
+        else
+            INIT_HLIST_NODE(&e->hash);
     }
+    if (qb->buckets) {
+        for (size_t i = 0; i < (size_t) 1 << qb->hash_bits; i++)
+            INIT_HLIST_HEAD(&qb->buckets[i]);
+        qb->hashed = 0;
+    }
+}
+
+/* Convert a list_head pointer to its containing queue_contex_t pointer */
+static queue_contex_t *list_to_qc(struct list_head *pos)
+{
+    return (queue_contex_t *) ((char *) pos - offsetof(queue_contex_t, chain));
+}
+
+/* Merge all the queues into one sorted queue, which is in ascending/descending
+ * order */
+size_t q_merge(struct list_head *head, bool descend)
+{
+    if (!head || head->next == head)
+        return 0;
+    // Single queue: do nothing, only return its node count
+    if (head->next->next == head)
+        return q_size(list_to_qc(head->next)->q);
+
+    // Count number of the queues to merge
+    size_t n = q_size(head);
+
+    struct list_head *tmpb = head->next->next;
+    // Merge n queues into the first queue
+    for (size_t i = 0; i < n - 1; i++) {
+        // Get the two queues to merge
+        queue_contex_t *qa = list_to_qc(head->next);
+        queue_contex_t *qb = list_to_qc(tmpb);
+        index_move(to_qhead(qa->q), to_qhead(qb->q));
+        merge_two_str(qa->q, qb->q, descend, NULL);
+        to_qhead(qb->q)->flags = Q_ORDERED;
+        // Move tmpb to the next queue
+        tmpb = tmpb->next;
+    }
+    to_qhead(list_to_qc(head->next)->q)->flags =
+        descend ? Q_DESCEND : Q_ASCEND;
     // Return the node count of the first queue
     return q_size(list_to_qc(head->next)->q);
 }
+
+/* Sort elements of queue in the given order, stably */
+void q_sort_by(struct list_head *head, bool descend, const q_order_t *ord)
+{
+    if (!ord) {
+        q_sort(head, descend);
+        return;
+    }
+    if (!head || head->next == head || head->next->next == head)
+        return;
+
+    queue_head_t *q = to_qhead(head);
+    bool stamped = stamp_keys(head, ord);
+    ORDER_CALL(merge_sort, ord, head, descend, ord);
+    if (stamped)
+        unstamp_keys(q);
+    // Nothing is known about the order of strcmp() anymore
+    q->flags = 0;
+}
+
+/* Merge all the queues, each sorted in the given order, into the first one */
+size_t q_merge_by(struct list_head *head, bool descend, const q_order_t *ord)
+{
+    if (!ord)
+        return q_merge(head, descend);
+    if (!head || head->next == head)
+        return 0;
+    if (list_is_singular(head))
+        return q_size(list_to_qc(head->next)->q);
+
+    // Every element joins the index of the first queue before any key is
+    // stamped over its hash node
+    queue_contex_t *qa = list_to_qc(head->next), *qb;
+    list_for_each_entry(qb, head, chain) {
+        if (qb != qa)
+            index_move(to_qhead(qa->q), to_qhead(qb->q));
+    }
+    bool stamped = stamp_keys(qa->q, ord);
+    list_for_each_entry(qb, head, chain) {
+        if (qb == qa)
+            continue;
+        stamp_keys(qb->q, ord);
+        ORDER_CALL(merge_two, ord, qa->q, qb->q, descend, ord);
+        to_qhead(qb->q)->flags = Q_ORDERED;
+    }
+    if (stamped)
+        unstamp_keys(to_qhead(qa->q));
+    if (!list_empty(qa->q) && !list_is_singular(qa->q))
+        to_qhead(qa->q)->flags = 0;
+    return q_size(qa->q);
+}
+
+/* Delete every node which is on the wrong side of a node to its right, in the
+ * given order
+ */
+static size_t monotonic_by(struct list_head *head,
+                           bool descend,
+                           const q_order_t *ord)
+{
+    if (!ord)
+        return monotonic(head, descend);
+    if (!head || head->next == head)
+        return 0;
+    return ORDER_CALL(monotonic, ord, to_qhead(head), descend, ord);
+}
+
+size_t q_ascend_by(struct list_head *head, const q_order_t *ord)
+{
+    return monotonic_by(head, false, ord);
+}
+
+size_t q_descend_by(struct list_head *head, const q_order_t *ord)
+{
+    return monotonic_by(head, true, ord);
+}
+
+/* Delete every run of adjacent nodes equal in the given order */
+bool q_delete_dup_by(struct list_head *head, const q_order_t *ord)
+{
+    if (!ord)
+        return q_delete_dup(head);
+    if (!head || head->next == head)
+        return false;
+
+    queue_head_t *q = to_qhead(head);
+    ORDER_CALL(dedup, ord, q, ord);
+    if (head->next == head->prev)
+        q->flags = Q_ORDERED;
+    return true;
+}
+
+/* Split the queue into balanced pieces, in order */
+bool q_split(struct list_head *head, int parts, struct list_head *out_heads[])
+{
+    if (!head || parts < 1 || !out_heads)
+        return false;
+    for (int i = 0; i < parts; i++) {
+        if (!out_heads[i] || !list_empty(out_heads[i]))
+            return false;
+    }
+
+    queue_head_t *q = to_qhead(head);
+    filter_stale(q);
+    // The pieces have no index, so their elements leave the one of queue
+    if (q->buckets) {
+        element_t *e;
+        list_for_each_entry(e, head, list)
+            INIT_HLIST_NODE(&e->hash);
+        for (size_t i = 0; i < (size_t) 1 << q->hash_bits; i++)
+            INIT_HLIST_HEAD(&q->buckets[i]);
+        q->hashed = 0;
+    }
+
+    size_t n = q_size(head);
+    struct list_head *cut = head;
+    for (int i = 0; i < parts; i++) {
+        // The first n % parts pieces take one extra element
+        size_t len = n / parts + ((size_t) i < n % parts);
+        for (size_t j = 0; j < len; j++)
+            cut = cut->next;
+        list_cut_position(out_heads[i], head, cut);
+        queue_head_t *qi = to_qhead(out_heads[i]);
+        qi->flags = len > 1 ? q->flags : Q_ORDERED;
+        filter_stale(qi);
+        if (qi->buckets)
+            index_rehash(qi);
+        cut = head;
+    }
+    q->flags = Q_ORDERED;
+    return true;
+}
+
+/* Order holding between the elements at two adjacent nodes */
+static unsigned int seam_flags(struct list_head *a, struct list_head *b)
+{
+    int cmp = strcmp(list_to_element(a)->value, list_to_element(b)->value);
+    return cmp > 0 ? Q_DESCEND : cmp < 0 ? Q_ASCEND : Q_ORDERED;
+}
+
+/* Splice the pieces back to the end of queue, in order */
+void q_concat(struct list_head *head, int parts, struct list_head *heads[])
+{
+    if (!head || !heads)
+        return;
+
+    queue_head_t *q = to_qhead(head);
+    for (int i = 0; i < parts; i++) {
+        if (!heads[i] || list_empty(heads[i]))
+            continue;
+        queue_head_t *qi = to_qhead(heads[i]);
+        // Order holds if it holds within both sides and across the seam
+        if (!list_empty(head)) {
+            q->flags &= qi->flags & seam_flags(head->prev, heads[i]->next);
+        } else {
+            q->flags = qi->flags;
+        }
+        index_move(q, qi);
+        list_splice_tail_init(heads[i], head);
+        qi->flags = Q_ORDERED;
+    }
+}
+
+/* Hand the hash index entries of the elements from first to last over from
+ * queue qs to queue qd. As in index_move(), the index of qd is not resized.
+ */
+static void index_move_range(queue_head_t *qd,
+                             queue_head_t *qs,
+                             struct list_head *first,
+                             struct list_head *last)
+{
+    if (qd == qs)
+        return;
+    filter_stale(qd);
+    filter_stale(qs);
+    if (!qd->buckets && !qs->buckets)
+        return;
+
+    for (struct list_head *node = first;; node = node->next) {
+        element_t *e = list_to_element(node);
+        index_del(qs, e);
+        if (qd->buckets)
+            index_link(qd, e);
+        else
+            INIT_HLIST_NODE(&e->hash);
+        if (node == last)
+            break;
+    }
+}
+
+/* Move the nodes from first to last of queue qs in front of node position of
+ * queue qd. The range is relinked in place rather than parked on a list head,
+ * which would have to live on the stack.
+ */
+static void move_range(queue_head_t *qs,
+                       struct list_head *first,
+                       struct list_head *last,
+                       queue_head_t *qd,
+                       struct list_head *position)
+{
+    index_move_range(qd, qs, first, last);
+
+    // What is left of qs keeps its order, and so does the range
+    unsigned int flags = first == last ? Q_ORDERED : qs->flags;
+    first->prev->next = last->next;
+    last->next->prev = first->prev;
+    if (qs->head.next == qs->head.prev)
+        qs->flags = Q_ORDERED;
+
+    // Order holds if it holds within both sides and across both seams
+    if (!list_empty(&qd->head)) {
+        if (position->prev != &qd->head)
+            flags &= seam_flags(position->prev, first);
+        if (position != &qd->head)
+            flags &= seam_flags(last, position);
+        flags &= qd->flags;
+    }
+    qd->flags = flags;
+
+    first->prev = position->prev;
+    last->next = position;
+    position->prev->next = first;
+    position->prev = last;
+}
+
+/* Move a range of nodes to another queue, or elsewhere in the same queue */
+bool q_splice_range(struct list_head *src,
+                    struct list_head *first,
+                    struct list_head *last,
+                    struct list_head *dst,
+                    struct list_head *position)
+{
+    if (!src || !first || !last || !dst || !position || first == src ||
+        last == src)
+        return false;
+    move_range(to_qhead(src), first, last, to_qhead(dst), position);
+    return true;
+}
+
+/* Move the first n elements of a queue to the end of another queue */
+size_t q_move_n(struct list_head *src, size_t n, struct list_head *dst)
+{
+    if (!src || !dst || !n || list_empty(src))
+        return 0;
+
+    size_t cnt = 1;
+    struct list_head *last = src->next;
+    while (cnt < n && last->next != src) {
+        last = last->next;
+        cnt++;
+    }
+    move_range(to_qhead(src), src->next, last, to_qhead(dst), dst);
+    return cnt;
+}
+
+/* Reallocate every element and its string in list order */
+bool q_compact(struct list_head *head)
+{
+    if (!head)
+        return false;
+
+    // The old elements are chained through their next pointers and only freed
+    // at the end, so that new allocations cannot land in the holes they leave
+    struct list_head *old = NULL, *node = head->next;
+    bool ok = true;
+    while (node != head) {
+        element_t *e = list_to_element(node), *ne;
+        struct list_head *next = node->next;
+        size_t len = strlen(e->value) + 1;
+        char *value = malloc(len);
+        if (!value) {
+            ok = false;
+            break;
+        }
+        ne = malloc(sizeof(element_t));
+        if (!ne) {
+            free(value);
+            ok = false;
+            break;
+        }
+        memcpy(value, e->value, len);
+        ne->value = value;
+        ne->list.prev = node->prev;
+        ne->list.next = next;
+        node->prev->next = &ne->list;
+        next->prev = &ne->list;
+        node->next = old;
+        old = node;
+        node = next;
+    }
+
+    queue_head_t *q = to_qhead(head);
+    if (q->buckets)
+        index_rehash(q);
+    else {
+        element_t *e;
+        list_for_each_entry(e, head, list)
+            INIT_HLIST_NODE(&e->hash);
+    }
+
+    while (old) {
+        element_t *e = list_to_element(old);
+        old = old->next;
+        free(e->value);
+        free(e);
+    }
+    return ok;
+}
+
+/* Work shared by the tasks of q_parallel_for_each() */
+struct pfor_work {
+    struct list_head **heads;
+    int parts;
+    int next; /* next piece to claim */
+    void (*fn)(element_t *, void *);
+    void *arg;
+};
+
+struct pfor_task {
+    struct tp_task task;
+    struct pfor_work *w;
+};
+
+static void pfor_worker(struct tp_task *task)
+{
+    struct pfor_work *w = container_of(task, struct pfor_task, task)->w;
+    int i;
+    while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) <
+           w->parts) {
+        if (!w->heads[i])
+            continue;
+        element_t *e;
+        list_for_each_entry(e, w->heads[i], list)
+            w->fn(e, w->arg);
+    }
+}
+
+/* Run fn on every element of the pieces, one piece per task at a time */
+void q_parallel_for_each(struct list_head *heads[],
+                         int parts,
+                         void (*fn)(element_t *, void *),
+                         void *arg)
+{
+    if (!heads || parts < 1 || !fn)
+        return;
+
+    // One task per thread of the pool, each claiming pieces until none is
+    // left, so that a long piece does not hold up the others
+    struct pfor_work w = {
+        .heads = heads, .parts = parts, .next = 0, .fn = fn, .arg = arg};
+    struct pfor_task tasks[TP_MAX_THREADS];
+    int ntasks = tp_threads();
+    if (ntasks > parts)
+        ntasks = parts;
+    tp_group_t g = TP_GROUP_INIT;
+    for (int i = 0; i < ntasks; i++) {
+        tasks[i].w = &w;
+        tp_spawn(&g, &tasks[i].task, pfor_worker);
+    }
+    tp_wait(&g);
+
+    // Values may have been rewritten, so nothing is known about them anymore
+    for (int i = 0; i < parts; i++) {
+        if (!heads[i])
+            continue;
+        queue_head_t *qi = to_qhead(heads[i]);
+        if (!list_empty(heads[i]) && !list_is_singular(heads[i]))
+            qi->flags = 0;
+        filter_stale(qi);
+        if (qi->buckets)
+            index_rehash(qi);
+    }
+}
+
+/* Retire deleted elements to ep rather than freeing them */
+void q_set_epoch(struct list_head *head, ep_domain_t *ep)
+{
+    if (head)
+        to_qhead(head)->ep = ep;
+}
+
+/* Release a removed element through the epoch domain of queue, if any */
+void q_retire_element(struct list_head *head, element_t *e)
+{
+    if (!e)
+        return;
+    if (head && to_qhead(head)->ep) {
+        ep_retire(to_qhead(head)->ep, &e->retire, retire_element);
+        return;
+    }
+    free(e->value);
+    free(e);
+}
+
+/* Bury deleted elements until limit of them are waiting to be freed */
+void q_set_deferred(struct list_head *head, size_t limit)
+{
+    if (!head)
+        return;
+    queue_head_t *q = to_qhead(head);
+    q->grave_limit = limit;
+    if (q->buried && q->buried >= limit)
+        reap_graveyard(q);
+}
+
+/* Free the graveyard of queue */
+size_t q_flush_graveyard(struct list_head *head)
+{
+    return head ? reap_graveyard(to_qhead(head)) : 0;
+}
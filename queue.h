@@ -9,20 +9,70 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 
+#include "epoch.h"
 #include "harness.h"
 #include "list.h"
 
+/**
+ * q_key_t - Key a string is compared by in an order of q_order_t
+ * @str: string compared, the string itself unless the key function of the
+ *       order points it elsewhere in the string, past a prefix for example
+ * @num: integer the key function may extract from the string
+ * @real: floating-point number it may extract instead
+ */
+typedef struct {
+    const char *str;
+    union {
+        long long num;
+        double real;
+    };
+} q_key_t;
+
+/**
+ * q_order_t - Order of strings for the _by operations
+ * @key: fills in the key of a string, whose @str is the string already; NULL
+ *       to compare the strings themselves
+ * @cmp: compares two keys, returning a negative value, 0 or a positive value
+ *       like strcmp()
+ * @arg: opaque argument passed to @key and @cmp
+ */
+typedef struct {
+    void (*key)(q_key_t *k, const char *s, void *arg);
+    int (*cmp)(const q_key_t *a, const q_key_t *b, void *arg);
+    void *arg;
+} q_order_t;
+
+/* Orders built in, which the _by operations compare without indirect calls:
+ * integers parsed by strtoll(), the same strings regardless of case, and
+ * shorter strings first, then strcmp()
+ */
+extern const q_order_t q_order_numeric;
+extern const q_order_t q_order_casefold;
+extern const q_order_t q_order_length;
+
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
+ * @hash: node of the hash index of the queue, unhashed if it has none
+ * @retire: link of the element once retired to an epoch domain or buried in
+ *          the graveyard of its queue, which reuses @hash since such an
+ *          element is out of the index already
+ * @key: key of the element while a _by operation sorts or merges its queue,
+ *       which gives @hash back when done
  *
  * @value needs to be explicitly allocated and freed
  */
 typedef struct {
     char *value;
     struct list_head list;
+    union {
+        struct hlist_node hash;
+        struct ep_node retire;
+        q_key_t key;
+    };
 } element_t;
 
 /**
@@ -35,7 +85,7 @@ typedef struct {
 typedef struct {
     struct list_head *q;
     struct list_head chain;
-    int size;
+    size_t size;
     int id;
 } queue_contex_t;
 
@@ -120,13 +170,76 @@ static inline void q_release_element(element_t *e)
     test_free(e);
 }
 
+/**
+ * q_view_t - Read-only view of the string of an element
+ * @value: the string, which still belongs to the queue, %NULL for no element
+ * @len: length of @value, as strlen() would return it
+ */
+typedef struct {
+    const char *value;
+    size_t len;
+} q_view_t;
+
+/**
+ * q_peek_head() - Look at the string of the element at the head
+ * @head: header of queue
+ *
+ * Nothing is copied. The view stays valid until the element is removed or
+ * its string is changed.
+ *
+ * Return: view of the first string, with a %NULL value if queue is NULL or
+ * empty
+ */
+q_view_t q_peek_head(struct list_head *head);
+
+/**
+ * q_peek_tail() - Look at the string of the element at the tail
+ * @head: header of queue
+ *
+ * Return: view of the last string, with a %NULL value if queue is NULL or
+ * empty
+ */
+q_view_t q_peek_tail(struct list_head *head);
+
+/**
+ * q_pop_head_owned() - Remove the element at the head and keep its string
+ * @head: header of queue
+ *
+ * Unlike q_remove_head(), the string is not copied: the element is released
+ * and its string buffer is handed over to the caller, who must give it back
+ * with q_release_value(). With an epoch domain set by q_set_epoch(), readers
+ * may still be reading the string, so it is retired along with the element
+ * and the caller gets a copy instead.
+ *
+ * Return: the string of the removed element, %NULL if queue is NULL or empty,
+ * or if the copy could not be allocated, in which case nothing is removed
+ */
+char *q_pop_head_owned(struct list_head *head);
+
+/**
+ * q_pop_tail_owned() - Remove the element at the tail and keep its string
+ * @head: header of queue
+ *
+ * Return: the string of the removed element, %NULL if queue is NULL or empty
+ */
+char *q_pop_tail_owned(struct list_head *head);
+
+/**
+ * q_release_value() - Release a string handed over by q_pop_head_owned()
+ * @value: string, no effect if %NULL
+ */
+static inline void q_release_value(char *value)
+{
+    test_free(value);
+}
+
 /**
  * q_size() - Get the size of the queue
  * @head: header of queue
  *
  * Return: the number of elements in queue, zero if queue is NULL or empty
  */
-int q_size(struct list_head *head);
+size_t q_size(struct list_head *head);
 
 /**
  * q_delete_mid() - Delete the middle node in queue
@@ -188,7 +301,20 @@ void q_reverse(struct list_head *head);
  * Reference:
  * https://leetcode.com/problems/reverse-nodes-in-k-group/
  */
-void q_reverseK(struct list_head *head, int k);
+void q_reverseK(struct list_head *head, size_t k);
+
+/**
+ * q_reverseK_batch() - Reverse the nodes of the queue k at a time, several
+ * groups per step
+ * @head: header of queue
+ * @k: size of the groups
+ * @window: number of groups located before any is reversed, at most 64
+ *
+ * Same result as q_reverseK(). One walk locates the ends of @window groups,
+ * which are then reversed while their nodes are still in the cache, so that
+ * the walks ahead alternate less often with the relinking.
+ */
+void q_reverseK_batch(struct list_head *head, size_t k, size_t window);
 
 /**
  * q_sort() - Sort elements of queue in ascending/descending order
@@ -196,24 +322,155 @@ void q_reverseK(struct list_head *head, int k);
  * @descend: whether or not to sort in descending order
  *
  * No effect if queue is NULL or empty. If there is only one element, do
- * nothing.
+ * nothing. Queues longer than the limit set by q_sort_set_spill() are sorted
+ * by q_sort_external().
  */
 void q_sort(struct list_head *head, bool descend);
 
+/**
+ * q_sort_set_spill() - Set the size above which q_sort() spills to disk
+ * @limit: largest number of elements q_sort() sorts in memory, 0 for no limit
+ *
+ * The limit also serves as the length of the runs of q_sort_external().
+ */
+void q_sort_set_spill(size_t limit);
+
+/**
+ * q_sort_external() - Sort elements of queue through runs held on disk
+ * @head: header of queue
+ * @descend: whether or not to sort in descending order
+ * @run_len: number of elements sorted in memory at a time
+ * @out: stream receiving the sorted strings, NULL to keep them in the queue
+ *
+ * The queue is cut into runs of @run_len elements, each of which is sorted in
+ * memory. The strings of every sorted run are then written to a temporary
+ * file with buffered sequential I/O and freed, so that at most one run of
+ * strings, plus one string per run during the merge, is held in memory at a
+ * time. The elements themselves stay in memory, parked in their run, and get
+ * their strings back as a loser tree merges the runs into the queue. @run_len
+ * is raised if needed to keep to 256 temporary files. A run whose file cannot
+ * be written stays in memory and takes part in the merge as it is.
+ *
+ * When @out is given, every string is written to it on its own line as the
+ * merge goes, and the elements are released, which leaves the queue empty.
+ *
+ * The sort is stable. No effect if queue is NULL or empty.
+ *
+ * Return: false if a string could not be read back, in which case its
+ * element was released, or if writing to @out failed; true otherwise
+ */
+bool q_sort_external(struct list_head *head,
+                     bool descend,
+                     size_t run_len,
+                     FILE *out);
+
+/**
+ * q_sort_state_t - Progress of a sort performed in slices
+ * @head: header of queue being sorted
+ * @descend: whether the queue is sorted in descending order
+ * @done: whether the queue is sorted
+ * @phase: what the next step does: find the left run, find the right run or
+ * merge them
+ * @width: length of the runs merged by the current pass
+ * @cnt: nodes walked by the current phase
+ * @a: next node of the left run to merge, also the start of the left run
+ * @b: next node of the right run to merge
+ * @end: node following the right run
+ * @n: number of elements, known once the first pass is over
+ * @pass: number of passes completed
+ * @pos: number of elements before @a in the current pass
+ *
+ * The members are private to q_sort_begin() and q_sort_step().
+ */
+typedef struct {
+    struct list_head *head;
+    bool descend;
+    bool done;
+    int phase;
+    size_t width, cnt;
+    struct list_head *a, *b, *end;
+    size_t n, pass, pos;
+} q_sort_state_t;
+
+/**
+ * q_sort_begin() - Prepare to sort a queue in slices
+ * @st: sort state to initialize
+ * @head: header of queue
+ * @descend: whether or not to sort in descending order
+ *
+ * The queue is sorted by calls to q_sort_step(). In between, it stays a valid
+ * queue holding the same elements in some order and may be read, but must not
+ * be modified.
+ */
+void q_sort_begin(q_sort_state_t *st, struct list_head *head, bool descend);
+
+/**
+ * q_sort_step() - Run a bounded slice of a sort started by q_sort_begin()
+ * @st: sort state
+ * @budget: maximum number of steps, each of which walks, compares or moves
+ * one node in O(1)
+ *
+ * This is a stable bottom-up merge sort whose merges move nodes of the right
+ * run in front of the left run one at a time, so it can stop and resume after
+ * any step without allocation.
+ *
+ * Return: true once the queue is sorted, false if more steps are needed
+ */
+bool q_sort_step(q_sort_state_t *st, size_t budget);
+
+/**
+ * q_sort_progress() - Estimate how far a sort in slices has got
+ * @st: sort state
+ *
+ * Return: percentage of the work done, from 0 to 100
+ */
+int q_sort_progress(const q_sort_state_t *st);
+
+/**
+ * q_sort_topk() - Move the K smallest/largest elements to the front in order
+ * @head: header of queue
+ * @k: number of elements to select
+ * @descend: whether to select the largest instead of the smallest elements
+ *
+ * After the call, the first @k elements of the queue are the @k smallest (or
+ * largest when @descend is set) ones, sorted in ascending/descending order.
+ * Equal strings keep their original relative order. The remaining elements
+ * follow them in their original relative order. Runs in O(n log k) with a
+ * bounded heap; if @k is not less than the queue size, the whole queue is
+ * sorted instead.
+ *
+ * No effect if queue is NULL or empty, or if @k is zero.
+ */
+void q_sort_topk(struct list_head *head, size_t k, bool descend);
+
+/**
+ * q_select_kth() - Find the k-th element in ascending/descending order
+ * @head: header of queue
+ * @k: 0-based rank of the wanted element
+ * @descend: whether to rank the elements in descending order
+ *
+ * The queue itself is left untouched. Selecting the median takes
+ * k = q_size(head) / 2.
+ *
+ * Return: the element of rank @k, %NULL if queue is NULL, @k is out of range
+ * or allocation failed.
+ */
+element_t *q_select_kth(struct list_head *head, size_t k, bool descend);
+
 /**
  * q_ascend() - Delete every node which has a node with a strictly less
  * value anywhere to the right side of it.
  * @head: header of queue
  *
  * No effect if queue is NULL or empty. If there is only one element, do
- * nothing.
+ * nothing. Walks once from the tail, keeping the least value seen so far.
  *
  * Reference:
  * https://leetcode.com/problems/remove-nodes-from-linked-list/
  *
  * Return: the number of elements in queue after performing operation
  */
-int q_ascend(struct list_head *head);
+size_t q_ascend(struct list_head *head);
 
 /**
  * q_descend() - Delete every node which has a node with a strictly greater
@@ -221,14 +478,115 @@ int q_ascend(struct list_head *head);
  * @head: header of queue
  *
  * No effect if queue is NULL or empty. If there is only one element, do
- * nothing.
+ * nothing. Walks once from the tail, keeping the greatest value seen so far.
  *
  * Reference:
  * https://leetcode.com/problems/remove-nodes-from-linked-list/
  *
  * Return: the number of elements in queue after performing operation
  */
-int q_descend(struct list_head *head);
+size_t q_descend(struct list_head *head);
+
+/**
+ * q_monotonic_each() - Visit the elements q_ascend() or q_descend() would keep
+ * @head: header of queue, left untouched
+ * @descend: whether to visit those of q_descend() rather than q_ascend()
+ * @fn: function called with each element and @arg, from head to tail
+ * @arg: opaque argument passed to @fn
+ *
+ * One walk from the head keeps the candidates on a monotonic stack, so the
+ * elements are only passed to @fn once the walk has reached the tail.
+ *
+ * Return: the number of elements visited, SIZE_MAX if allocation failed, in
+ * which case @fn has not been called.
+ */
+size_t q_monotonic_each(const struct list_head *head,
+                        bool descend,
+                        void (*fn)(const element_t *, void *),
+                        void *arg);
+
+/**
+ * q_monotonic_copy() - Copy the elements q_ascend() or q_descend() would keep
+ * @head: header of queue, left untouched
+ * @descend: whether to copy those of q_descend() rather than q_ascend()
+ * @dst: header of the queue the copies are appended to
+ *
+ * Return: the number of elements copied, SIZE_MAX if @head or @dst is NULL or
+ * allocation failed, in which case @dst is left untouched.
+ */
+size_t q_monotonic_copy(const struct list_head *head,
+                        bool descend,
+                        struct list_head *dst);
+
+/**
+ * q_index() - Attach a hash index on string values to the queue
+ * @head: header of queue
+ *
+ * Once attached, the index is kept up to date by every operation that inserts
+ * or deletes elements until the queue is freed. It turns q_contains(),
+ * q_count_value() and q_delete_value() into O(1) operations on average, and
+ * q_delete_dup() into an O(n) one on unsorted queues. Calling it on a queue
+ * which is already indexed has no effect.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_index(struct list_head *head);
+
+/**
+ * q_contains() - Check whether any element holds the given string
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * Return: true if found, false if not found or queue is NULL
+ */
+bool q_contains(struct list_head *head, const char *s);
+
+/**
+ * q_filter() - Attach a membership filter on string values to the queue
+ * @head: header of queue
+ *
+ * The filter is a blocked Bloom filter of 8 to 16 bits per element. It sets
+ * the strings of new elements as they are inserted, and is rebuilt by the
+ * next lookup after elements were moved in by other means, after many were
+ * removed, or once the queue has outgrown it. It answers most lookups of
+ * strings which are not in the queue with a single cache line, and lets
+ * q_contains() and q_count_value() skip their scan for them when the queue
+ * has no hash index. Calling it on a queue which already has a filter has no
+ * effect.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_filter(struct list_head *head);
+
+/**
+ * q_maybe_contains() - Check whether any element may hold the given string
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * Without a filter attached by q_filter(), this is q_contains().
+ *
+ * Return: false if no element holds @s or queue is NULL, true if some element
+ * holds @s and, rarely, if none does
+ */
+bool q_maybe_contains(struct list_head *head, const char *s);
+
+/**
+ * q_count_value() - Count the elements holding the given string
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * Return: the number of matching elements, zero if queue is NULL
+ */
+size_t q_count_value(struct list_head *head, const char *s);
+
+/**
+ * q_delete_value() - Delete all elements holding the given string
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * Return: the number of deleted elements, zero if queue is NULL
+ */
+size_t q_delete_value(struct list_head *head, const char *s);
 
 /**
  * q_merge() - Merge all the queues into one sorted queue, which is in
@@ -248,6 +606,210 @@ int q_descend(struct list_head *head);
  *
  * Return: the number of elements in queue after merging
  */
-int q_merge(struct list_head *head, bool descend);
+size_t q_merge(struct list_head *head, bool descend);
+
+/**
+ * q_sort_by() - Sort elements of queue in the given order, stably
+ * @head: header of queue
+ * @descend: whether to sort in descending order
+ * @ord: order, NULL for the one of strcmp(), which is q_sort()
+ *
+ * Orders with a key function have it called once per element, not once per
+ * comparison.
+ */
+void q_sort_by(struct list_head *head, bool descend, const q_order_t *ord);
+
+/**
+ * q_merge_by() - Merge all the queues, each sorted in the given order, into
+ * the first one
+ * @head: header of the chain of queues
+ * @descend: whether the queues are in descending order
+ * @ord: order, NULL for the one of strcmp(), which is q_merge()
+ *
+ * Return: the number of elements in the first queue after merging
+ */
+size_t q_merge_by(struct list_head *head, bool descend, const q_order_t *ord);
+
+/**
+ * q_ascend_by() - q_ascend() in the given order
+ * @head: header of queue
+ * @ord: order, NULL for the one of strcmp()
+ *
+ * Return: the number of elements in queue after performing operation
+ */
+size_t q_ascend_by(struct list_head *head, const q_order_t *ord);
+
+/**
+ * q_descend_by() - q_descend() in the given order
+ * @head: header of queue
+ * @ord: order, NULL for the one of strcmp()
+ *
+ * Return: the number of elements in queue after performing operation
+ */
+size_t q_descend_by(struct list_head *head, const q_order_t *ord);
+
+/**
+ * q_delete_dup_by() - Delete all nodes whose string is equal to another one
+ * in the given order
+ * @head: header of queue
+ * @ord: order, NULL for the one of strcmp(), which is q_delete_dup()
+ *
+ * Equal strings must be adjacent, as after q_sort_by() in the same order.
+ *
+ * Return: true for success, false if list is NULL or empty.
+ */
+bool q_delete_dup_by(struct list_head *head, const q_order_t *ord);
+
+/**
+ * q_split() - Cut a queue into balanced pieces, keeping their order
+ * @head: header of queue, which becomes empty
+ * @parts: number of pieces
+ * @out_heads: array of @parts empty queues created by q_new()
+ *
+ * The elements are moved, not copied: the first elements of @head go to
+ * @out_heads[0], the following ones to @out_heads[1], and so on. Piece sizes
+ * differ by at most one, with the larger pieces first; pieces are left empty
+ * if there are fewer elements than pieces. A hash index attached to @head is
+ * emptied, while the pieces keep their own one up to date if they have any.
+ *
+ * Return: false if an argument is NULL, @parts is not positive or a piece is
+ * not empty, true otherwise
+ */
+bool q_split(struct list_head *head, int parts, struct list_head *out_heads[]);
+
+/**
+ * q_concat() - Move the elements of several queues to the end of a queue
+ * @head: header of queue
+ * @parts: number of queues in @heads
+ * @heads: queues to splice in order, which all become empty
+ *
+ * Undoes q_split() when @head is the queue that was split. Each queue is
+ * spliced in O(1), plus one walk over it if either side has a hash index.
+ */
+void q_concat(struct list_head *head, int parts, struct list_head *heads[]);
+
+/**
+ * q_splice_range() - Move a range of elements in front of an element
+ * @src: header of queue holding the range
+ * @first: node of the first element of the range
+ * @last: node of the last element of the range, @first or after it
+ * @dst: header of queue receiving the range, which may be @src
+ * @position: node of @dst the range goes in front of, @dst itself to append
+ *
+ * The nodes are relinked as a whole, without copying any string, so the move
+ * takes O(1) once the cut points are known, plus one walk over the range if
+ * either queue has a hash index. When @dst is @src, @position must not lie
+ * within the range.
+ *
+ * Return: true for success, false if an argument is NULL or the range starts
+ * or ends at @src
+ */
+bool q_splice_range(struct list_head *src,
+                    struct list_head *first,
+                    struct list_head *last,
+                    struct list_head *dst,
+                    struct list_head *position);
+
+/**
+ * q_move_n() - Move the first elements of a queue to the end of another queue
+ * @src: header of queue
+ * @n: number of elements to move
+ * @dst: header of queue receiving them, which may be @src
+ *
+ * Finding the cut point walks @n nodes; the move itself is the O(1) splice of
+ * q_splice_range().
+ *
+ * Return: number of elements moved, less than @n if @src holds fewer
+ */
+size_t q_move_n(struct list_head *src, size_t n, struct list_head *dst);
+
+/**
+ * q_compact() - Reallocate the elements of a queue in list order
+ * @head: header of queue
+ *
+ * After many insertions, removals and sorts, neighbors in the queue usually
+ * sit far apart in memory, so walking it misses the cache on every node. This
+ * allocates a new copy of every element and its string in list order, which
+ * the allocator tends to lay out contiguously, relinks the copies in place of
+ * the old elements and only then frees the old ones. The order, the hash
+ * index and the header are kept; pointers to the old elements become invalid.
+ * Peak memory use is twice that of the queue.
+ *
+ * Return: true for success, false if queue is NULL or an allocation failed,
+ * in which case the elements compacted so far stay compacted and the queue is
+ * still intact
+ */
+bool q_compact(struct list_head *head);
+
+/**
+ * q_parallel_for_each() - Call a function on every element of several queues
+ * @heads: array of queues, typically the pieces made by q_split()
+ * @parts: number of queues in @heads
+ * @fn: function called with each element and @arg
+ * @arg: opaque argument passed to @fn
+ *
+ * The queues are handed out one at a time to the threads of the pool of
+ * tpool.h, the calling thread included, so elements of the same queue are
+ * visited in order by one thread while different queues run concurrently.
+ * Returns once every element has been visited.
+ *
+ * @fn may rewrite the string of its element in place or replace it with a
+ * newly allocated one, freeing the old one, but must not relink the element.
+ */
+void q_parallel_for_each(struct list_head *heads[],
+                         int parts,
+                         void (*fn)(element_t *, void *),
+                         void *arg);
+
+/**
+ * q_set_epoch() - Let threads walk the queue without locks while it changes
+ * @head: header of queue
+ * @ep: epoch domain of the readers, NULL to go back to freeing at once
+ *
+ * Readers walk the queue between ep_enter() and ep_exit(), following next
+ * links with ep_list_next() only, while a single writer calls
+ * q_insert_head(), q_insert_tail(), q_remove_head(), q_remove_tail() and
+ * q_delete_mid(). These publish new elements only once they are complete,
+ * leave the next link of an unlinked element intact, and retire deleted
+ * elements to @ep instead of freeing them, so that a reader standing on one
+ * still finds its way back into the queue. Elements removed by the writer
+ * must be released with q_retire_element(). Any other operation, q_free()
+ * included, needs the readers to be out of the queue. The writer owns @ep:
+ * it is the only thread that may call ep_retire(), ep_reclaim() and
+ * ep_barrier().
+ */
+void q_set_epoch(struct list_head *head, ep_domain_t *ep);
+
+/**
+ * q_retire_element() - Release an element removed from the queue, once no
+ * reader of its epoch domain can reach it anymore
+ * @head: header of the queue the element was removed from
+ * @e: element
+ *
+ * Same as q_release_element() if the queue has no epoch domain.
+ */
+void q_retire_element(struct list_head *head, element_t *e);
+
+/**
+ * q_set_deferred() - Defer freeing the elements the queue deletes
+ * @head: header of queue
+ * @limit: number of elements the graveyard holds before it is flushed, 0 to
+ *         flush it and go back to freeing elements at once
+ *
+ * Elements deleted by q_delete_mid(), q_delete_dup(), q_ascend(),
+ * q_descend(), q_delete_value() and the like are pushed onto a graveyard
+ * list of the queue in O(1) instead of being freed one by one, so that these
+ * operations do not wait on the allocator. Pass SIZE_MAX to only free them
+ * when q_flush_graveyard() or q_free() is called.
+ */
+void q_set_deferred(struct list_head *head, size_t limit);
+
+/**
+ * q_flush_graveyard() - Free the elements deleted from the queue so far
+ * @head: header of queue
+ *
+ * Return: the number of elements freed
+ */
+size_t q_flush_graveyard(struct list_head *head);
 
 #endif /* LAB0_QUEUE_H */
@@ -0,0 +1,218 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "harness.h"
+#include "shmqueue.h"
+
+#define SHQ_MAGIC 0x7368715f6c616230ULL /* "shq_lab0" */
+
+/* Index of the head of the queue in the arena */
+#define SHQ_HEAD 0
+
+/**
+ * struct shq_shared - Header of the shared memory object
+ * @magic: SHQ_MAGIC once the queue is ready to use
+ * @lock: mutex shared between processes, guarding everything below
+ * @cap: number of slots, including the head
+ * @slot_len: bytes of each string slot
+ * @used: number of slots handed out so far, including the head
+ * @free_slot: first released slot, chained through link[].next, 0 if none
+ * @size: the number of elements in the queue, also read without @lock
+ *
+ * The arena of list nodes follows, then the string slots.
+ */
+struct shq_shared {
+    uint64_t magic;
+    pthread_mutex_t lock;
+    uint32_t cap;
+    uint32_t slot_len;
+    uint32_t used;
+    uint32_t free_slot;
+    uint32_t size;
+};
+
+/* Offset of the arena in the object, and size of the object */
+#define SHQ_LINK_OFF ((sizeof(struct shq_shared) + 63) & ~(size_t) 63)
+
+static size_t shq_map_len(uint32_t cap, uint32_t slot_len)
+{
+    return SHQ_LINK_OFF + sizeof(struct ilist_head) * (size_t) cap +
+           (size_t) slot_len * cap;
+}
+
+/* Map a shared memory object of cap slots and make a handle for it */
+static shqueue_t *shq_map(int fd, size_t len, uint32_t cap)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    shqueue_t *q = malloc(sizeof(shqueue_t));
+    if (!q) {
+        munmap(p, len);
+        return NULL;
+    }
+    q->sh = p;
+    q->link = (struct ilist_head *) ((char *) p + SHQ_LINK_OFF);
+    q->str = (char *) (q->link + cap);
+    q->map_len = len;
+    return q;
+}
+
+/* Create an empty shared queue */
+shqueue_t *shq_create(const char *name, uint32_t cap, uint32_t max_len)
+{
+    if (!name || !cap || cap == UINT32_MAX || max_len == UINT32_MAX)
+        return NULL;
+    cap++;
+    uint32_t slot_len = max_len + 1;
+    size_t len = shq_map_len(cap, slot_len);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return NULL;
+    shqueue_t *q = NULL;
+    if (!ftruncate(fd, len))
+        q = shq_map(fd, len, cap);
+    close(fd);
+    if (!q) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    struct shq_shared *sh = q->sh;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&sh->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    sh->cap = cap;
+    sh->slot_len = slot_len;
+    sh->used = 1;
+    sh->free_slot = 0;
+    sh->size = 0;
+    INIT_ILIST_HEAD(q->link, SHQ_HEAD);
+    // Only publish the queue once it is ready
+    __atomic_store_n(&sh->magic, SHQ_MAGIC, __ATOMIC_RELEASE);
+    return q;
+}
+
+/* Open a shared queue created by shq_create() */
+shqueue_t *shq_open(const char *name)
+{
+    if (!name)
+        return NULL;
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+
+    shqueue_t *q = NULL;
+    struct shq_shared head;
+    struct stat st;
+    if (!fstat(fd, &st) && st.st_size >= (off_t) sizeof(head) &&
+        pread(fd, &head, sizeof(head), 0) == sizeof(head) &&
+        head.magic == SHQ_MAGIC &&
+        (size_t) st.st_size == shq_map_len(head.cap, head.slot_len))
+        q = shq_map(fd, st.st_size, head.cap);
+    close(fd);
+    return q;
+}
+
+/* Release the handle of a shared queue */
+void shq_close(shqueue_t *q)
+{
+    if (!q)
+        return;
+    munmap(q->sh, q->map_len);
+    free(q);
+}
+
+/* Remove the name of a shared queue */
+bool shq_unlink(const char *name)
+{
+    return name && !shm_unlink(name);
+}
+
+/* Link a copy of s at the head or the tail of queue */
+static bool shq_insert(shqueue_t *q, const char *s, bool tail)
+{
+    if (!q || !s)
+        return false;
+    struct shq_shared *sh = q->sh;
+    size_t len = strlen(s) + 1;
+    if (len > sh->slot_len)
+        return false;
+
+    pthread_mutex_lock(&sh->lock);
+    uint32_t node = sh->free_slot;
+    if (node)
+        sh->free_slot = q->link[node].next;
+    else if (sh->used < sh->cap)
+        node = sh->used++;
+    if (node) {
+        memcpy(q->str + (size_t) sh->slot_len * node, s, len);
+        if (tail)
+            ilist_add_tail(q->link, node, SHQ_HEAD);
+        else
+            ilist_add(q->link, node, SHQ_HEAD);
+        __atomic_store_n(&sh->size, sh->size + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return node;
+}
+
+bool shq_insert_head(shqueue_t *q, const char *s)
+{
+    return shq_insert(q, s, false);
+}
+
+bool shq_insert_tail(shqueue_t *q, const char *s)
+{
+    return shq_insert(q, s, true);
+}
+
+/* Unlink the node at the head or the tail of queue and copy its string */
+static bool shq_remove(shqueue_t *q, char *sp, size_t bufsize, bool tail)
+{
+    if (!q)
+        return false;
+    struct shq_shared *sh = q->sh;
+
+    pthread_mutex_lock(&sh->lock);
+    uint32_t node =
+        tail ? ilist_last(q->link, SHQ_HEAD) : ilist_first(q->link, SHQ_HEAD);
+    if (node != SHQ_HEAD) {
+        if (sp && bufsize) {
+            const char *s = q->str + (size_t) sh->slot_len * node;
+            size_t n = strnlen(s, bufsize - 1);
+            memcpy(sp, s, n);
+            sp[n] = '\0';
+        }
+        ilist_del(q->link, node);
+        q->link[node].next = sh->free_slot;
+        sh->free_slot = node;
+        __atomic_store_n(&sh->size, sh->size - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return node != SHQ_HEAD;
+}
+
+bool shq_remove_head(shqueue_t *q, char *sp, size_t bufsize)
+{
+    return shq_remove(q, sp, bufsize, false);
+}
+
+bool shq_remove_tail(shqueue_t *q, char *sp, size_t bufsize)
+{
+    return shq_remove(q, sp, bufsize, true);
+}
+
+/* Get the size of the queue */
+uint32_t shq_size(const shqueue_t *q)
+{
+    return q ? __atomic_load_n(&q->sh->size, __ATOMIC_RELAXED) : 0;
+}
@@ -0,0 +1,124 @@
+#ifndef LAB0_SHMQUEUE_H
+#define LAB0_SHMQUEUE_H
+
+/* This program implements a queue of strings shared between processes.
+ *
+ * The whole queue lives in one POSIX shared memory object, which every process
+ * maps wherever it likes, so nodes cannot point at each other. They are slots
+ * of an array linked by the 32-bit indices of ilist.h instead, and each slot
+ * holds its string in place, up to a length fixed when the queue is created.
+ * A mutex shared between processes guards the queue, so a producer and a
+ * consumer in different processes exchange strings with one copy each way and
+ * no pipe in between.
+ *
+ * The number of slots is fixed as well: once they are all in use, inserting
+ * fails like an allocation failure of q_insert_head(), until a consumer has
+ * removed some.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ilist.h"
+
+/**
+ * shqueue_t - Handle of a shared queue in the calling process
+ * @sh: header of the shared memory object
+ * @link: arena of list nodes; node 0 is the head of the queue
+ * @str: string slots, one per node
+ * @map_len: size of the mapping
+ */
+typedef struct {
+    struct shq_shared *sh;
+    struct ilist_head *link;
+    char *str;
+    size_t map_len;
+} shqueue_t;
+
+/**
+ * shq_create() - Create an empty shared queue
+ * @name: name of the shared memory object, starting with a slash
+ * @cap: largest number of elements
+ * @max_len: longest string the queue can hold
+ *
+ * Fails if an object named @name already exists.
+ *
+ * Return: handle of the queue, NULL on failure
+ */
+shqueue_t *shq_create(const char *name, uint32_t cap, uint32_t max_len);
+
+/**
+ * shq_open() - Open a shared queue created by shq_create()
+ * @name: name of the shared memory object
+ *
+ * Return: handle of the queue, NULL on failure
+ */
+shqueue_t *shq_open(const char *name);
+
+/**
+ * shq_close() - Release the handle of a shared queue
+ * @q: handle, no effect if NULL
+ *
+ * The queue itself lives on until shq_unlink() and the last shq_close().
+ */
+void shq_close(shqueue_t *q);
+
+/**
+ * shq_unlink() - Remove the name of a shared queue
+ * @name: name of the shared memory object
+ *
+ * Return: true for success, false if there is no such object
+ */
+bool shq_unlink(const char *name);
+
+/**
+ * shq_insert_head() - Insert a copy of a string at the head
+ * @q: handle of the queue
+ * @s: string would be inserted
+ *
+ * Return: true for success, false if queue is NULL or full, or @s is longer
+ * than the queue allows
+ */
+bool shq_insert_head(shqueue_t *q, const char *s);
+
+/**
+ * shq_insert_tail() - Insert a copy of a string at the tail
+ * @q: handle of the queue
+ * @s: string would be inserted
+ *
+ * Return: true for success, false if queue is NULL or full, or @s is longer
+ * than the queue allows
+ */
+bool shq_insert_tail(shqueue_t *q, const char *s);
+
+/**
+ * shq_remove_head() - Remove the element from the head
+ * @q: handle of the queue
+ * @sp: buffer receiving the removed string, may be NULL
+ * @bufsize: size of @sp
+ *
+ * Return: true for success, false if queue is NULL or empty
+ */
+bool shq_remove_head(shqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * shq_remove_tail() - Remove the element from the tail
+ * @q: handle of the queue
+ * @sp: buffer receiving the removed string, may be NULL
+ * @bufsize: size of @sp
+ *
+ * Return: true for success, false if queue is NULL or empty
+ */
+bool shq_remove_tail(shqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * shq_size() - Get the size of the queue in O(1)
+ * @q: handle of the queue
+ *
+ * Return: the number of elements in queue, only a snapshot while other
+ * processes insert or remove, zero if queue is NULL
+ */
+uint32_t shq_size(const shqueue_t *q);
+
+#endif /* LAB0_SHMQUEUE_H */
@@ -0,0 +1,196 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "squeue.h"
+
+#define SQ_CACHE_LINE 64
+
+/* Shard where the next round-robin push of the calling thread goes. Threads
+ * start on different shards, so that they do not march in step.
+ */
+static __thread unsigned int rr_next;
+static __thread bool rr_started;
+static unsigned int rr_ticket;
+
+/* Create an empty sharded queue */
+squeue_t *sq_new(int shards, sq_route_t route)
+{
+    if (shards < 1 || shards > SQ_MAX_SHARDS)
+        return NULL;
+    squeue_t *sq = malloc(sizeof(squeue_t));
+    if (!sq)
+        return NULL;
+
+    // Round the shards up to whole cache lines, so that no two share one
+    size_t stride = (sizeof(sq_shard_t) + SQ_CACHE_LINE - 1) &
+                    ~(size_t) (SQ_CACHE_LINE - 1);
+    sq->mem = malloc(stride * shards + SQ_CACHE_LINE - 1);
+    if (!sq->mem) {
+        free(sq);
+        return NULL;
+    }
+    uintptr_t base = ((uintptr_t) sq->mem + SQ_CACHE_LINE - 1) &
+                     ~(uintptr_t) (SQ_CACHE_LINE - 1);
+
+    sq->n = shards;
+    sq->route = route;
+    for (int i = 0; i < shards; i++) {
+        sq_shard_t *s = (sq_shard_t *) (base + stride * i);
+        s->q = q_new();
+        if (!s->q) {
+            sq->n = i;
+            sq_free(sq);
+            return NULL;
+        }
+        pthread_mutex_init(&s->lock, NULL);
+        s->size = 0;
+        sq->shard[i] = s;
+    }
+    return sq;
+}
+
+/* Free a sharded queue and its elements */
+void sq_free(squeue_t *sq)
+{
+    if (!sq)
+        return;
+    for (int i = 0; i < sq->n; i++) {
+        q_free(sq->shard[i]->q);
+        pthread_mutex_destroy(&sq->shard[i]->lock);
+    }
+    free(sq->mem);
+    free(sq);
+}
+
+/* Move up to n elements from the head of queue from to the tail of a shard,
+ * with the lock of the shard held
+ */
+static size_t shard_take(sq_shard_t *s, struct list_head *from, size_t n)
+{
+    size_t cnt = q_move_n(from, n, s->q);
+    __atomic_store_n(&s->size, s->size + cnt, __ATOMIC_RELAXED);
+    return cnt;
+}
+
+/* Move elements of queue from into the sharded queue */
+size_t sq_push(squeue_t *sq, struct list_head *from, size_t n)
+{
+    if (!sq || !from || !n || list_empty(from))
+        return 0;
+
+    if (sq->route == SQ_HASH) {
+        size_t cnt = 0;
+        while (cnt < n && !list_empty(from)) {
+            const char *s = list_first_entry(from, element_t, list)->value;
+            sq_shard_t *sh = sq->shard[hash_string(s) % sq->n];
+            pthread_mutex_lock(&sh->lock);
+            cnt += shard_take(sh, from, 1);
+            pthread_mutex_unlock(&sh->lock);
+        }
+        return cnt;
+    }
+
+    if (!rr_started) {
+        rr_next = __atomic_fetch_add(&rr_ticket, 1, __ATOMIC_RELAXED);
+        rr_started = true;
+    }
+    int first = rr_next++ % sq->n;
+    // Settle for the first shard which is free, or wait for the planned one
+    sq_shard_t *sh = NULL;
+    for (int i = 0; i < sq->n && !sh; i++) {
+        sq_shard_t *s = sq->shard[(first + i) % sq->n];
+        if (!pthread_mutex_trylock(&s->lock))
+            sh = s;
+    }
+    if (!sh) {
+        sh = sq->shard[first];
+        pthread_mutex_lock(&sh->lock);
+    }
+    size_t cnt = shard_take(sh, from, n);
+    pthread_mutex_unlock(&sh->lock);
+    return cnt;
+}
+
+/* Move elements from one shard of the sharded queue into queue to */
+size_t sq_pop(squeue_t *sq, int home, struct list_head *to, size_t n)
+{
+    if (!sq || !to || !n)
+        return 0;
+
+    home = (unsigned int) home % sq->n;
+    for (int i = 0; i < sq->n; i++) {
+        sq_shard_t *s = sq->shard[(home + i) % sq->n];
+        // Skip shards seen empty without bouncing their locks around
+        if (!__atomic_load_n(&s->size, __ATOMIC_RELAXED))
+            continue;
+        pthread_mutex_lock(&s->lock);
+        size_t cnt = q_move_n(s->q, n, to);
+        __atomic_store_n(&s->size, s->size - cnt, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&s->lock);
+        if (cnt)
+            return cnt;
+    }
+    return 0;
+}
+
+/* Count the elements of the sharded queue */
+size_t sq_size(squeue_t *sq)
+{
+    if (!sq)
+        return 0;
+    size_t cnt = 0;
+    for (int i = 0; i < sq->n; i++)
+        cnt += __atomic_load_n(&sq->shard[i]->size, __ATOMIC_RELAXED);
+    return cnt;
+}
+
+/* Move every shard to the end of queue to */
+void sq_drain(squeue_t *sq, struct list_head *to)
+{
+    if (!sq || !to)
+        return;
+    for (int i = 0; i < sq->n; i++) {
+        sq_shard_t *s = sq->shard[i];
+        pthread_mutex_lock(&s->lock);
+        q_concat(to, 1, &s->q);
+        __atomic_store_n(&s->size, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+/* Merge queue b into queue a, both sorted */
+static void merge_pair(struct list_head *a, struct list_head *b, bool descend)
+{
+    queue_contex_t qa = {.q = a}, qb = {.q = b};
+    struct list_head chain;
+    INIT_LIST_HEAD(&chain);
+    list_add_tail(&qa.chain, &chain);
+    list_add_tail(&qb.chain, &chain);
+    q_merge(&chain, descend);
+}
+
+/* Sort every shard, then merge them pairwise into queue to */
+size_t sq_sort(squeue_t *sq, struct list_head *to, bool descend)
+{
+    if (!sq || !to)
+        return 0;
+
+    size_t cnt = 0;
+    for (int i = 0; i < sq->n; i++) {
+        pthread_mutex_lock(&sq->shard[i]->lock);
+        q_sort(sq->shard[i]->q, descend);
+        cnt += sq->shard[i]->size;
+    }
+    for (int step = 1; step < sq->n; step *= 2) {
+        for (int i = 0; i + step < sq->n; i += 2 * step)
+            merge_pair(sq->shard[i]->q, sq->shard[i + step]->q, descend);
+    }
+    q_concat(to, 1, &sq->shard[0]->q);
+    for (int i = sq->n - 1; i >= 0; i--) {
+        __atomic_store_n(&sq->shard[i]->size, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&sq->shard[i]->lock);
+    }
+    return cnt;
+}
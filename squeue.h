@@ -0,0 +1,137 @@
+#ifndef LAB0_SQUEUE_H
+#define LAB0_SQUEUE_H
+
+/* This program implements a queue sharded over several locked queues.
+ *
+ * A single queue behind one lock serializes every producer on its head and
+ * tail. A sharded queue spreads its elements over independent queues created
+ * by q_new(), the shards, each behind its own mutex on cache lines of its own.
+ * Producers pick a shard round-robin, each thread in turn and skipping shards
+ * which are busy, or by the hash of the string, so that equal strings share a
+ * shard. Consumers take from a home shard and steal from the others once it
+ * runs dry. Elements only ever move in and out with q_move_n(), so nothing is
+ * allocated or copied while a lock is held.
+ *
+ * Order is only kept within a shard. sq_sort() sorts every shard and merges
+ * them into one queue.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+#define SQ_MAX_SHARDS 64
+
+/**
+ * sq_route_t - How elements pushed into a sharded queue are spread
+ * @SQ_ROUND_ROBIN: each thread in turn over all shards, skipping busy ones
+ * @SQ_HASH: by the hash of the string
+ */
+typedef enum { SQ_ROUND_ROBIN, SQ_HASH } sq_route_t;
+
+/**
+ * sq_shard_t - Shard of a sharded queue
+ * @lock: mutex guarding @q and writes to @size
+ * @q: queue of the shard
+ * @size: number of elements in @q, also read without @lock
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    struct list_head *q;
+    size_t size;
+} sq_shard_t;
+
+/**
+ * squeue_t - Queue sharded over several locked queues
+ * @n: number of shards
+ * @route: how pushed elements are spread over the shards
+ * @shard: the shards, each on cache lines of its own
+ * @mem: block holding the shards
+ */
+typedef struct {
+    int n;
+    sq_route_t route;
+    sq_shard_t *shard[SQ_MAX_SHARDS];
+    void *mem;
+} squeue_t;
+
+/**
+ * sq_new() - Create an empty sharded queue
+ * @shards: number of shards, from 1 to SQ_MAX_SHARDS
+ * @route: how pushed elements are spread over the shards
+ *
+ * Return: NULL for an invalid number of shards or allocation failed
+ */
+squeue_t *sq_new(int shards, sq_route_t route);
+
+/**
+ * sq_free() - Free a sharded queue and all the elements it holds
+ * @sq: sharded queue, no effect if NULL
+ *
+ * No other thread may use @sq anymore.
+ */
+void sq_free(squeue_t *sq);
+
+/**
+ * sq_push() - Move the first elements of a queue into a sharded queue
+ * @sq: sharded queue
+ * @from: header of queue, usually owned by the calling thread
+ * @n: number of elements to move
+ *
+ * With SQ_ROUND_ROBIN the @n elements go together to the tail of one shard,
+ * taking a single lock; with SQ_HASH each goes to the shard of its string.
+ * Safe to call from several threads at once.
+ *
+ * Return: number of elements moved, less than @n if @from holds fewer
+ */
+size_t sq_push(squeue_t *sq, struct list_head *from, size_t n);
+
+/**
+ * sq_pop() - Move elements from a sharded queue to the end of a queue
+ * @sq: sharded queue
+ * @home: shard tried first, usually one per consumer thread
+ * @to: header of queue, usually owned by the calling thread
+ * @n: largest number of elements to move
+ *
+ * The elements are taken from the head of a single shard: @home if it holds
+ * any, otherwise the next one which does. Safe to call from several threads
+ * at once.
+ *
+ * Return: number of elements moved, 0 if every shard was found empty
+ */
+size_t sq_pop(squeue_t *sq, int home, struct list_head *to, size_t n);
+
+/**
+ * sq_size() - Count the elements of a sharded queue
+ * @sq: sharded queue
+ *
+ * Return: number of elements, only a snapshot while other threads push or pop
+ */
+size_t sq_size(squeue_t *sq);
+
+/**
+ * sq_drain() - Move all the elements of a sharded queue to the end of a queue
+ * @sq: sharded queue
+ * @to: header of queue
+ *
+ * The shards are spliced in turn, each in O(1).
+ */
+void sq_drain(squeue_t *sq, struct list_head *to);
+
+/**
+ * sq_sort() - Sort a sharded queue into a queue
+ * @sq: sharded queue, which becomes empty
+ * @to: header of an empty queue receiving the elements
+ * @descend: whether to sort in descending order
+ *
+ * Every shard is sorted with q_sort(), then pairs of shards are merged with
+ * q_merge() in rounds, so that each element takes part in log2(n) merges
+ * rather than n. All shards are locked meanwhile.
+ *
+ * Return: number of elements in @to
+ */
+size_t sq_sort(squeue_t *sq, struct list_head *to, bool descend);
+
+#endif /* LAB0_SQUEUE_H */
@@ -0,0 +1,180 @@
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "tpool.h"
+#include "wsdeque.h"
+
+#define TP_DEQUE_CAP 64
+
+/* The pool, which lives as long as the process. Workers are numbered from 0
+ * and worker i owns deque[i]; @nworkers is only raised once the deque of the
+ * new worker is ready, so thieves may read it without the lock.
+ */
+static struct {
+    pthread_mutex_t lock; /* guards the inbox, sleeping and growing */
+    pthread_cond_t wake;
+    int nworkers;
+    int sleeping;
+    size_t queued; /* tasks spawned and not taken yet */
+    struct tp_task *inbox, *inbox_tail;
+    ws_deque_t deque[TP_MAX_THREADS - 1];
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static bool pool_started;
+
+/* Index of the worker running on this thread, -1 on any other thread */
+static __thread int self = -1;
+static __thread uint32_t victim_seed;
+
+/* Take a task from the own deque, the inbox or another worker */
+static struct tp_task *tp_find(void)
+{
+    struct tp_task *t = NULL;
+    if (self >= 0)
+        t = ws_pop(&pool.deque[self]);
+
+    if (!t && __atomic_load_n(&pool.inbox, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&pool.lock);
+        t = pool.inbox;
+        if (t)
+            __atomic_store_n(&pool.inbox, t->next, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    int n = __atomic_load_n(&pool.nworkers, __ATOMIC_ACQUIRE);
+    if (!t && n) {
+        // Start from a random victim, so that thieves spread out
+        victim_seed = victim_seed * 1103515245 + 12345;
+        int first = (victim_seed >> 16) % n;
+        for (int i = 0; i < n && !t; i++) {
+            int v = (first + i) % n;
+            if (v != self)
+                t = ws_steal(&pool.deque[v]);
+        }
+    }
+
+    if (t)
+        __atomic_sub_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+    return t;
+}
+
+static void tp_run(struct tp_task *t)
+{
+    tp_group_t *g = t->group;
+    t->fn(t);
+    __atomic_sub_fetch(&g->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void *tp_worker(void *data)
+{
+    self = (int) (intptr_t) data;
+    victim_seed = self + 1;
+    for (;;) {
+        struct tp_task *t = tp_find();
+        if (t) {
+            tp_run(t);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        __atomic_add_fetch(&pool.sleeping, 1, __ATOMIC_SEQ_CST);
+        bool idle = !__atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        __atomic_sub_fetch(&pool.sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool.lock);
+        // A task is out there but was taken by someone else first
+        if (!idle)
+            sched_yield();
+    }
+    return NULL;
+}
+
+/* Grow the pool to a number of threads */
+int tp_reserve(int threads)
+{
+    if (threads > TP_MAX_THREADS)
+        threads = TP_MAX_THREADS;
+
+    pthread_mutex_lock(&pool.lock);
+    __atomic_store_n(&pool_started, true, __ATOMIC_RELEASE);
+    // Workers inherit the signal mask of the thread creating them
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    while (pool.nworkers < threads - 1) {
+        int i = pool.nworkers;
+        pthread_t tid;
+        if (!ws_init(&pool.deque[i], TP_DEQUE_CAP))
+            break;
+        if (pthread_create(&tid, NULL, tp_worker, (void *) (intptr_t) i)) {
+            ws_destroy(&pool.deque[i]);
+            break;
+        }
+        pthread_detach(tid);
+        __atomic_store_n(&pool.nworkers, i + 1, __ATOMIC_RELEASE);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    int n = pool.nworkers + 1;
+    pthread_mutex_unlock(&pool.lock);
+    return n;
+}
+
+/* Start the pool with one thread per CPU the first time it is used */
+int tp_threads(void)
+{
+    if (!__atomic_load_n(&pool_started, __ATOMIC_ACQUIRE)) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        return tp_reserve(ncpu > 0 ? ncpu : 1);
+    }
+    return __atomic_load_n(&pool.nworkers, __ATOMIC_ACQUIRE) + 1;
+}
+
+/* Hand a task over to the pool */
+void tp_spawn(tp_group_t *group,
+              struct tp_task *task,
+              void (*fn)(struct tp_task *task))
+{
+    tp_threads();
+    task->fn = fn;
+    task->group = group;
+    task->next = NULL;
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+    // Counted before it can be taken, so that the count never drops below 0
+    __atomic_add_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+
+    if (self < 0 || !ws_push(&pool.deque[self], task)) {
+        pthread_mutex_lock(&pool.lock);
+        if (pool.inbox)
+            pool.inbox_tail->next = task;
+        else
+            __atomic_store_n(&pool.inbox, task, __ATOMIC_RELAXED);
+        pool.inbox_tail = task;
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    if (__atomic_load_n(&pool.sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_signal(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+/* Run tasks until every task of group has finished */
+void tp_wait(tp_group_t *group)
+{
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) {
+        struct tp_task *t = tp_find();
+        if (t)
+            tp_run(t);
+        else
+            sched_yield();
+    }
+}
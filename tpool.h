@@ -0,0 +1,89 @@
+#ifndef LAB0_TPOOL_H
+#define LAB0_TPOOL_H
+
+/* This program implements a fork-join thread pool shared by the process.
+ *
+ * Every worker thread owns a work-stealing deque of wsdeque.h. Tasks spawned
+ * by a worker go to the bottom of its own deque, and the worker runs them
+ * newest first, so that a task splitting its work in two keeps the halves hot
+ * in its cache; idle workers steal the oldest tasks, which tend to be the
+ * largest, from the top of the others. Tasks spawned by any other thread go
+ * to a shared inbox instead. A thread waiting for a group of tasks runs tasks
+ * meanwhile rather than blocking, so tasks may spawn and wait for subtasks
+ * freely, and the waiting thread makes progress even without any worker.
+ *
+ * Tasks are embedded in the structure of the caller, like list_head, so that
+ * spawning never allocates. The pool starts with one thread per CPU, counting
+ * the caller, the first time it is used. Workers block every signal, so that
+ * SIGALRM and the like keep reaching the thread that set them up.
+ */
+
+#include <stddef.h>
+
+#define TP_MAX_THREADS 64
+
+struct tp_group;
+
+/**
+ * struct tp_task - Task of the pool, embedded in the structure of the caller
+ * @fn: function running the task, usually finding its structure through
+ *      container_of()
+ * @group: group the task belongs to
+ * @next: next task in the inbox
+ */
+struct tp_task {
+    void (*fn)(struct tp_task *task);
+    struct tp_group *group;
+    struct tp_task *next;
+};
+
+/**
+ * tp_group_t - Tasks waited for together
+ * @pending: number of tasks spawned and not finished yet
+ */
+typedef struct tp_group {
+    size_t pending;
+} tp_group_t;
+
+#define TP_GROUP_INIT {0}
+
+/**
+ * tp_threads() - Get the number of threads running tasks
+ *
+ * Starts the pool if it is not running yet.
+ *
+ * Return: number of workers plus one for the calling thread
+ */
+int tp_threads(void);
+
+/**
+ * tp_reserve() - Grow the pool to a number of threads
+ * @threads: number of threads wanted, counting the calling thread, at most
+ *           TP_MAX_THREADS
+ *
+ * The pool never shrinks.
+ *
+ * Return: number of threads the pool has now
+ */
+int tp_reserve(int threads);
+
+/**
+ * tp_spawn() - Hand a task over to the pool
+ * @group: group to account the task to, initialized with TP_GROUP_INIT
+ * @task: task, which must stay valid until @group has been waited for
+ * @fn: function running the task
+ */
+void tp_spawn(tp_group_t *group,
+              struct tp_task *task,
+              void (*fn)(struct tp_task *task));
+
+/**
+ * tp_wait() - Wait until every task of a group has finished
+ * @group: group
+ *
+ * The calling thread runs tasks of the pool, of any group, while it waits.
+ * Everything the tasks wrote is visible to the caller once this returns.
+ */
+void tp_wait(tp_group_t *group);
+
+#endif /* LAB0_TPOOL_H */
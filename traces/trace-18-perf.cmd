@@ -0,0 +1,42 @@
+# Test performance of 'q_sort_topk' and 'q_select_kth': 'q_new', 'q_insert_head', 'q_insert_tail', 'q_sort', and 'q_free'
+option fail 0
+option malloc 0
+new
+ih b
+ih e
+it a
+ih d
+it c
+topk 2
+topk 5
+kth 0
+kth 4
+kth 5
+kth 1152921504606846975
+kth 1000000000
+option descend 1
+topk 3
+kth 1
+option descend 0
+free
+new
+it b
+it a
+it b
+it a 2
+it c
+it b
+topk 3
+option descend 1
+topk 2
+option descend 0
+free
+new
+ih RAND 200000
+topk 10
+topk 1000
+kth 100000
+option descend 1
+topk 100
+kth 0
+free
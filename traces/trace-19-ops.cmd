@@ -0,0 +1,49 @@
+# Test of ordered queues: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_remove_head', 'q_reverse', 'q_sort', 'q_delete_dup', 'q_ascend', 'q_descend', and 'q_merge'
+option fail 0
+option malloc 0
+new
+ih a
+ih b
+ih b
+ih c
+it a
+sort
+rh a
+rh a
+rh b
+rh b
+rh c
+it a
+it b
+it b
+it c
+it c
+it d
+option descend 1
+sort
+option descend 0
+sort
+dedup
+rh a
+rh d
+ih b
+it e
+descend
+it f
+ascend
+reverse
+sort
+new
+it a
+it c
+new
+it d
+it g
+merge
+rh a
+rh c
+rh d
+rh e
+rh f
+rh g
+free
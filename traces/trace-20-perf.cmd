@@ -0,0 +1,53 @@
+# Test performance of the hash index: 'q_new', 'q_insert_head', 'q_insert_tail', 'q_remove_head', 'q_remove_tail', 'q_delete_mid', 'q_delete_dup', 'q_merge', 'q_index', 'q_contains', 'q_count_value', and 'q_delete_value'
+option fail 0
+option malloc 0
+new
+ih gerbil
+it bear
+index
+ih dolphin
+it gerbil
+it meerkat
+ih bear
+contains bear
+count gerbil
+rh bear
+count bear
+rt meerkat
+contains meerkat
+dm
+count dolphin
+delval gerbil
+contains gerbil
+it vulture
+it vulture
+it bear
+it bear
+it emu
+dedup
+contains vulture
+count bear
+count emu
+new
+it aardvark
+it bear
+index
+sort
+merge
+count bear
+contains aardvark
+free
+new
+ih RAND 100000
+index
+it zebra 3
+contains zebra 100000
+contains giraffe 100000
+it giraffe
+sort
+dedup
+contains zebra
+contains giraffe
+delval giraffe
+contains giraffe 100000
+free
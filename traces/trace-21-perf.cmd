@@ -0,0 +1,14 @@
+# Test performance of priority queue insert, remove and meld
+option fail 0
+option malloc 0
+pq_insert dolphin
+pq_insert bear
+pq_insert gerbil
+pq_insert bear
+pq_pop 4
+pq_insert RAND 200000
+pq_pop 100000
+new
+ih RAND 100000
+pq_meld
+pq_pop 200000
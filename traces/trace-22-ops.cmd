@@ -0,0 +1,21 @@
+# Test of split, parallel for-each and concat
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+ih gerbil
+it Zebra
+pfor upper 3
+pfor lower 8
+pfor hash 1
+sort
+index
+pfor upper 2
+contains ZEBRA
+contains zebra
+new
+ih RAND 200000
+pfor hash 16
+pfor upper 7
+size
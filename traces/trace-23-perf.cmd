@@ -0,0 +1,16 @@
+# Test performance of prefetching and interleaved traversals
+option fail 0
+option malloc 0
+new
+ih RAND 5
+traverse 8
+it bear
+dm
+size
+new
+ih RAND 200000
+sort
+traverse
+traverse 32
+size 5
+free
@@ -0,0 +1,20 @@
+# Test of queue operations on arena-backed queue with 32-bit links
+option fail 0
+option malloc 0
+new
+arena
+ih a
+arena
+ih b
+ih b
+it c
+it a
+arena 2
+new
+ih RAND 50000
+ih dup 3
+it dup 2
+arena 4
+arena 1
+sort
+arena
@@ -0,0 +1,21 @@
+# Test performance of compaction of a queue scattered over memory
+option fail 0
+option malloc 0
+new
+ih dolphin
+it bear
+ih gerbil
+compact
+rh gerbil
+rh dolphin
+rh bear
+compact
+ih RAND 150000
+sort
+swap
+index
+compact
+size 5
+swap
+sort
+contains meerkat 1000
@@ -0,0 +1,36 @@
+# Test of sort running in the background between commands
+option fail 0
+option malloc 0
+new
+ih b
+ih a
+ih c
+it a
+sort &
+wait
+rh a
+rh a
+rh b
+rh c
+free
+new
+ih RAND 100000
+sort &
+new
+ih gerbil
+ih bear
+sort
+prev
+it zzz
+wait
+option descend 1
+sort &
+next
+wait
+prev
+reverse
+option descend 0
+new
+ih RAND 50000
+sort &
+merge
@@ -0,0 +1,31 @@
+# Test of sorting through runs spilled to disk
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+ih gerbil
+ih bear
+ih meerkat
+ih bear
+option spill 2
+sort
+option descend 1
+sort
+option descend 0
+reverse
+sort
+it zebra
+it apple
+sortto /tmp/qtest-sortto.txt
+new
+ih RAND 100000
+option spill 1000
+sort
+option descend 1
+sort
+free
+new
+ih RAND 50000
+option spill 0
+sortto /tmp/qtest-sortto.txt
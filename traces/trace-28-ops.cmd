@@ -0,0 +1,28 @@
+# Test of merging sorted files into a queue or a file
+option fail 0
+option malloc 0
+new
+it apple
+it dog
+it dog
+it zebra
+sortto /tmp/qtest-merge1.txt
+it bear
+it dog
+it yak
+sortto /tmp/qtest-merge2.txt
+it cat
+sortto /tmp/qtest-merge3.txt
+mergefiles /tmp/qtest-merge1.txt /tmp/qtest-merge2.txt /tmp/qtest-merge3.txt /dev/null
+mergefiles -o /tmp/qtest-merge4.txt /tmp/qtest-merge1.txt /tmp/qtest-merge2.txt
+free
+new
+mergefiles /tmp/qtest-merge4.txt /tmp/qtest-merge3.txt
+option descend 1
+ih RAND 50000
+sortto /tmp/qtest-merge1.txt
+ih RAND 50000
+sortto /tmp/qtest-merge2.txt
+mergefiles -o /tmp/qtest-merge4.txt /tmp/qtest-merge1.txt /tmp/qtest-merge2.txt
+mergefiles /tmp/qtest-merge4.txt /tmp/qtest-merge1.txt /tmp/qtest-merge2.txt
+size
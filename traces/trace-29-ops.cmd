@@ -0,0 +1,21 @@
+# Test of peek and pop, which hand out the strings held by the queue
+option fail 0
+option malloc 0
+new
+peek
+pop
+ih dolphin
+ih bear
+it gerbil
+peek bear
+peek tail gerbil
+peek head bear
+pop bear
+pop tail gerbil
+peek tail dolphin
+it meerkat
+pop head dolphin
+pop meerkat
+pop
+size
+free
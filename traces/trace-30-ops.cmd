@@ -0,0 +1,80 @@
+# Test of move and splice, which relink ranges of elements between queues
+option fail 0
+option malloc 0
+new
+it a
+it b
+it c
+it d
+it e
+new
+it x
+it y
+prev
+move 2 1
+splice 1 2 1 1
+splice 0 0 0
+move 9 1
+next
+peek head x
+splice 4 6 1 0
+splice 0 1 1
+sort
+rh a
+rh b
+rh c
+rh d
+rh e
+rh x
+rh y
+size
+free
+free
+new
+it m
+it n
+it o
+sort
+new
+it q
+it p
+it l
+sort
+prev
+splice 0 0 1
+next
+sort
+rh l
+rh m
+rh p
+rh q
+size
+free
+free
+new
+index
+it u
+it v
+it u
+it w
+new
+it v
+index
+prev
+move 3 1
+count u
+count v
+next
+count u
+count v
+delval u
+count v
+prev
+splice 0 0 1 0
+count w
+next
+count w
+delval w
+size
+free
+free
@@ -0,0 +1,25 @@
+# Test of shard and sqbench, which move elements through a sharded queue
+option fail 0
+option malloc 0
+new
+shard 4
+it RAND 1000
+ih dup 5
+shard 7
+shard 16 hash
+option descend 1
+shard 1
+shard 64
+option descend 0
+shard 5 hash
+option spill 64
+shard 1
+shard 8 hash
+option descend 1
+shard 3
+option descend 0
+option spill 0
+rh
+sqbench 5000 8
+sqbench 100 64
+free
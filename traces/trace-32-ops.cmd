@@ -0,0 +1,12 @@
+# Test of shmq and shmbench, which move strings through shared memory
+option fail 0
+option malloc 0
+new
+shmq
+it gerbil
+shmq
+it RAND 500
+ih abc
+shmq
+shmbench 20000
+free
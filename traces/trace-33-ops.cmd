@@ -0,0 +1,14 @@
+# Test of tpsum and pfor, which run as tasks of the work-stealing pool
+option fail 0
+option malloc 0
+new
+tpsum
+it RAND 20000
+tpsum
+tpsum 8
+tpsum 64 16
+tpsum 4 1
+pfor upper 16
+pfor lower 3
+pfor hash 100
+free
@@ -0,0 +1,10 @@
+# Test performance of 'q_new', 'q_insert_head', 'q_insert_tail', and 'q_reverseK'
+option fail 0
+option malloc 0
+new
+ih dolphin 500000
+it gerbil 500001
+reverseK 3
+reverseK 3 16
+reverseK 1000
+reverseK 3
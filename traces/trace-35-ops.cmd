@@ -0,0 +1,31 @@
+# Test of ascend and descend, in place and leaving the queue untouched
+option fail 0
+option malloc 0
+new
+ascend each
+it c
+it a
+it b
+ascend copy
+prev
+descend copy
+prev
+ascend each
+descend each
+ascend
+it RAND 5000
+ih RAND 5000
+descend copy
+prev
+ascend copy
+prev
+descend each
+ascend each
+descend
+it a
+ascend
+free
+free
+free
+free
+free
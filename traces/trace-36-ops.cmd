@@ -0,0 +1,37 @@
+# Test of the membership filter through inserts, removals and moves
+option fail 0
+option malloc 0
+new
+maybe gerbil
+filter
+maybe gerbil
+ih gerbil
+maybe gerbil
+it RAND 5000
+fprate 5000
+ih bear 3
+rh bear
+rh bear
+maybe bear
+rh bear
+maybe bear
+contains bear
+sort
+dedup
+fprate 2000
+new
+it RAND 3000
+ih zebra
+filter
+move 1000 0
+prev
+maybe zebra
+fprate 2000
+next
+fprate 2000
+delval zebra
+maybe zebra
+it RAND 20000
+fprate 5000
+free
+free
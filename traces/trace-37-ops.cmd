@@ -0,0 +1,17 @@
+# Test of front-coded storage of sorted queues
+option fail 0
+option malloc 0
+new
+frontcode
+ih gerbil
+frontcode
+keys 20000
+frontcode
+frontcode 1
+frontcode 3
+frontcode 64
+it RAND 2000
+option descend 1
+frontcode 5
+option descend 0
+free
@@ -0,0 +1,12 @@
+# Test of lock-free readers walking a queue while it changes
+option fail 0
+option malloc 0
+new
+ih dolphin
+it gerbil
+rcubench 1
+rcubench 5000 4
+rcubench 2000
+dm
+rh dolphin
+free
@@ -0,0 +1,41 @@
+# Test of deferred freeing of deleted elements
+option fail 0
+option malloc 0
+new
+reap
+defer
+ih gerbil
+ih bear
+ih dolphin
+ih bear
+it gerbil
+it meerkat
+sort
+dedup
+dm
+reap
+reap
+defer 2
+it zebra
+it zebra
+it yak
+descend
+ascend
+dedup
+reap
+ih vulture
+ih vulture
+ih vulture
+defer 0
+dedup
+free
+new
+defer 3
+ih aardvark
+ih bear
+ih aardvark
+sort
+dedup
+free
+deferbench 1
+deferbench 20000
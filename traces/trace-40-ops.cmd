@@ -0,0 +1,68 @@
+# Test of ordering operations in other orders than strcmp
+option fail 0
+option malloc 0
+new
+by num sort
+nums 30
+ih 7
+it 7
+by num sort
+by num dedup
+by num descend
+nums 20
+by len sort
+by len ascend
+free
+new
+ih bear
+ih Apple
+ih apple
+it Cat
+it BEAR
+it cat
+index
+by fold sort
+contains apple
+count BEAR
+by fold dedup
+contains apple
+delval Cat
+it Zebra
+it yak
+by fold ascend
+by fold descend
+free
+new
+nums 1000
+by gnum sort
+new
+nums 1000
+by num sort
+new
+nums 1000
+index
+by num sort
+by num merge
+by num dedup
+option descend 1
+by len sort
+by str sort
+by num ascend
+option descend 0
+free
+new
+nums 20000
+by num sort
+by gnum sort
+by str sort
+by len sort
+by fold sort
+free
+new
+it RAND 3
+new
+ih RAND 50000
+sort &
+prev
+by str merge
+free
@@ -0,0 +1,25 @@
+# Test of allocating and freeing on several threads at once
+option fail 0
+option malloc 0
+new
+ih gerbil 3
+it bear 2
+it dolphin
+pfor copy 4
+pfor copy 1
+pfor upper 3
+pfor copy 8
+rh GERBIL
+rh GERBIL
+rh GERBIL
+rh BEAR
+rh BEAR
+rh DOLPHIN
+new
+ih RAND 2000
+pfor copy 16
+pfor hash 16
+pfor copy 3
+pfor copy 7
+free
+free
@@ -0,0 +1,23 @@
+# Test performance of queues of more than 2^32 elements, which needs a machine
+# with about 1 TB of memory
+option fail 0
+option malloc 0
+option timeout 0
+new
+ih a 2000000000
+it b 2000000000
+it c 1000000000
+size
+reverse
+reverseK 3
+dm
+sort
+size
+count b
+descend
+size
+free
+new
+ih RAND 1400000000
+arena 3
+free
